@@ -13,6 +13,7 @@
 */
 
 #include	<koliba.h>
+#include	"freliba.h"
 #include	<stdlib.h>
 #include	<string.h>
 
@@ -52,6 +53,7 @@ typedef	struct _anachromatic_instance {
 	double				rotation;	// In turns
 	double				dchannel;
 	size_t				count;
+	FRELIBA_FASTFLUT	fast;
 	unsigned int		channel;
 	unsigned char		normalize;
 	unsigned char		srgb;
@@ -61,10 +63,10 @@ typedef	struct _anachromatic_instance {
 typedef	void	*f0r_param_t;
 
 void f0r_get_plugin_info(f0r_plugin_info_t* info) {
-	info->name				= "Koliba Anachromatic";
+	info->name				= "Koliba Anachromatic" FRELIBA_NAME_SUFFIX;
 	info->author			= "G. Adam Stanislav";
 	info->plugin_type		= F0R_PLUGIN_TYPE_FILTER;
-	info->color_model		= F0R_COLOR_MODEL_RGBA8888;
+	info->color_model		= FRELIBA_COLOR_MODEL;
 	info->frei0r_version	= FREI0R_MAJOR_VERSION;
 	info->major_version		= 1;
 	info->minor_version		= 0;
@@ -81,6 +83,7 @@ f0r_instance_t f0r_construct(unsigned int width, unsigned int height) {
 
 	if ((instance = malloc(sizeof(anachromatic_instance))) != NULL) {
 		instance->count					= (size_t)width * (size_t)height;
+		FRELIBA_InitFastFlut(&instance->fast);
 
 		// We will use the default (Rec. 2020) chroma model.
 		// We only need to do this once.
@@ -355,13 +358,15 @@ void f0r_get_param_value(f0r_instance_t instance, f0r_param_t param, int param_i
 	}
 }
 
-void f0r_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe) {
+// Does the actual work for f0r_update and freliba_update,
+// count pixels at a time.
+static void update(void *data, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe, size_t count) {
+	f0r_instance_t instance = (f0r_instance_t)data;
+
 	if ((instance != NULL) && (inframe != NULL) && (outframe != NULL)) {
-		size_t i = instance->count;
-		const double *iconv;
-		const unsigned char *oconv;
+		size_t i = count;
 
-		if (instance->anachroma.efficacy == 0.0) memcpy(outframe, inframe, i*sizeof(KOLIBA_RGBA8PIXEL));
+		if (instance->anachroma.efficacy == 0.0) FRELIBA_FastCopyRgba8Frame(&instance->fast, outframe, inframe, i);
 		else {
 			if (instance->changed) {
 				KOLIBA_AnachromaticMatrix(&instance->matrix, &instance->anachroma, instance->normalize, instance->channel);
@@ -369,18 +374,19 @@ void f0r_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *i
 				instance->changed	= 0;
 			}
 
-			if (instance->srgb) {
-				iconv = KOLIBA_SrgbByteToLinear;
-				oconv = KOLIBA_LinearByteToSrgb;
-			}
-			else {
-				iconv = NULL;
-				oconv = NULL;
-			}
-
-		for (; i; i--, inframe++, outframe++) {
-				KOLIBA_Rgba8Pixel(outframe, inframe, &instance->fLut, KOLIBA_MatrixFlutFlags, iconv, oconv)->a = inframe->a;
-			}
+			FRELIBA_FlutRgba8Frame(&instance->fast, outframe, inframe, i, &instance->fLut, KOLIBA_MatrixFlutFlags, instance->srgb);
 		}
 	}
 }
+
+void f0r_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe) {
+	if (instance != NULL) update(instance, inframe, outframe, instance->count);
+}
+
+void freliba_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, ptrdiff_t instride, KOLIBA_RGBA8PIXEL *outframe, ptrdiff_t outstride, size_t width, size_t height) {
+	FRELIBA_Rgba8Rows(update, instance, inframe, instride, outframe, outstride, width, height);
+}
+
+const FRELIBA_FASTFLUT * freliba_fastflut(f0r_instance_t instance) {
+	return &instance->fast;
+}
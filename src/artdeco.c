@@ -1,5 +1,6 @@
 #define  KOLIBCALLS
 #include <koliba.h>
+#include "freliba.h"
 #include <stdlib.h>
 #include <string.h>
 
@@ -85,10 +86,10 @@ static const KOLIBA_LDX ldxArtDeco = {
 };
 
 void f0r_get_plugin_info(f0r_plugin_info_t* info) {
-	info->name				= "Koliba Art Deco";
+	info->name				= "Koliba Art Deco" FRELIBA_NAME_SUFFIX;
 	info->author			= "G. Adam Stanislav";
 	info->plugin_type		= F0R_PLUGIN_TYPE_FILTER;
-	info->color_model		= F0R_COLOR_MODEL_RGBA8888;
+	info->color_model		= FRELIBA_COLOR_MODEL;
 	info->frei0r_version	= FREI0R_MAJOR_VERSION;
 	info->major_version		= 1;
 	info->minor_version		= 0;
@@ -193,7 +194,11 @@ void f0r_get_param_value(f0r_instance_t instance, f0r_param_t param, int param_i
 	}
 }
 
-void f0r_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe) {
+// Does the actual work for f0r_update and freliba_update,
+// count pixels at a time.
+static void update(void *data, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe, size_t count) {
+	f0r_instance_t instance = (f0r_instance_t)data;
+
 	if ((instance != NULL) && (inframe != NULL) && (outframe != NULL)) {
 		size_t i;
 		const double *iconv;
@@ -215,10 +220,26 @@ void f0r_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *i
 			oconv = NULL;
 		}
 
-		for (i = instance->count; i; i--, inframe++, outframe++) {
+		for (i = count; i; i--, inframe++, outframe++) {
 			KOLIBA_LumiduxRgba8Pixel(outframe, inframe, &instance->fLut, instance->flags, &instance->ldx, NULL, iconv, oconv)->a = inframe->a;
 		}
 	}
 }
 
+void freliba_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, ptrdiff_t instride, KOLIBA_RGBA8PIXEL *outframe, ptrdiff_t outstride, size_t width, size_t height) {
+	FRELIBA_RgbaOnlyRows(update, instance, inframe, instride, outframe, outstride, width, height);
+}
+
+// We do not work through a FRELIBA_FASTFLUT, so there is
+// no RGBA64 path for us.
+const FRELIBA_FASTFLUT * freliba_fastflut(f0r_instance_t instance) {
+	return NULL;
+}
+
+// Koliba only knows RGBA, so in BGRA builds even the frames
+// frei0r gives us go through freliba_update.
+void f0r_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe) {
+	if (instance != NULL) freliba_update(instance, time, inframe, 0, outframe, 0, instance->count, 1);
+}
+
 
@@ -0,0 +1,371 @@
+/*
+	autobalance.c
+
+	Copyright 2021 G. Adam Stanislav.
+	All rights reserved.
+
+	http://www.pantarheon.org
+
+	This is a frei0r-compatible plug-in, balancing the white
+	and stretching the contrast of each frame on its own, in
+	a single pass over it.
+
+	Rather than looking at a frame first and grading it next,
+	we grade each frame with the sLut we made from the frames
+	before it, and look at it while we are at it, so the next
+	frame gets the sLut made from this one. Scenes do not change
+	much from one frame to the next, and the sLut should not
+	change abruptly, either, so we smooth it over time anyway.
+	The very first frame has nothing to go by and is left alone.
+
+	We only look at every few pixels, which is plenty for the
+	histograms. From them we find the black and white points
+	of each channel, leaving out the darkest and the brightest
+	few pixels (Clip), and of the luma. Stretching each channel
+	on its own from its black to its white point balances the
+	colors as well, stretching all of them by the luma only
+	stretches the contrast. Balance picks anything in between.
+
+	The sLut is the identity sLut with each channel stretched,
+	so it converts to a FLUT which is a separable matrix, and
+	is as cheap to apply as a FLUT gets.
+
+	Since its FLUT changes from frame to frame, we do not offer
+	it to anyone who might fold it into theirs (see the end of
+	this file), nor do we take it for a new frame unless the
+	time of the frame changes.
+
+	It needs to be linked dynamically using the -lkoliba switch
+	in Unix and its derivatives, or koliba.lib in Windows.
+*/
+
+#include	<koliba.h>
+#include	"freliba.h"
+#include	<stdlib.h>
+#include	<string.h>
+
+/* From frei0r.h, which may or may not be on your system */
+typedef struct f0r_plugin_info
+{
+  const char* name;
+  const char* author;
+  int plugin_type;
+  int color_model;
+  int frei0r_version;
+  int major_version;
+  int minor_version;
+  int num_params;
+  const char* explanation;
+} f0r_plugin_info_t;
+
+typedef struct f0r_param_info
+{
+  const char* name;
+  int type;
+  const char* explanation;
+} f0r_param_info_t;
+
+#define FREI0R_MAJOR_VERSION 1
+#define F0R_PLUGIN_TYPE_FILTER 0
+#define F0R_COLOR_MODEL_RGBA8888 1
+#define	F0R_PARAM_BOOL	0
+#define F0R_PARAM_DOUBLE    1
+#define F0R_PARAM_COLOR     2
+/* End of frei0r.h extract */
+
+// We look at one pixel in this many. It is odd, so we do not
+// keep looking at the same columns of frames with even widths.
+#define	AUTOBALANCE_STEP	7
+
+// How close the black and white points may be, so a frame that
+// is nearly flat does not get stretched beyond all recognition.
+#define	AUTOBALANCE_MINRANGE	32
+
+// The histograms are of the red, green and blue channels (as
+// such, even in BGRA) and of the luma (Rec. 709 weights).
+#define	AUTOBALANCE_LUMA	3
+
+#ifdef	FRELIBA_BGRA
+#define	RED(p)		((p)->b)
+#define	BLUE(p)		((p)->r)
+#else
+#define	RED(p)		((p)->r)
+#define	BLUE(p)		((p)->b)
+#endif
+#define	GREEN(p)	((p)->g)
+
+typedef	struct _autobalance_instance {
+	KOLIBA_SLUT		sLut;
+	KOLIBA_VERTICES	vert;
+	KOLIBA_FLUT		fLut;
+	unsigned int	hist[4][256];
+	unsigned int	samples;
+	unsigned int	skip;		// Pixels until the next sample
+	double			strength;
+	double			balance;
+	double			clip;
+	double			smoothing;
+	double			time;		// Of the frame we are grading
+	size_t			count;
+	FRELIBA_FASTFLUT	fast;
+	KOLIBA_FLAGS	flags;
+	unsigned char	srgb;
+	unsigned char	primed;		// Have we made an sLut yet?
+	unsigned char	changed;
+	unsigned char	copy;
+} autobalance_instance, *f0r_instance_t;
+
+typedef	void	*f0r_param_t;
+
+void f0r_get_plugin_info(f0r_plugin_info_t* info) {
+	info->name				= "Koliba Auto Balance" FRELIBA_NAME_SUFFIX;
+	info->author			= "G. Adam Stanislav";
+	info->plugin_type		= F0R_PLUGIN_TYPE_FILTER;
+	info->color_model		= FRELIBA_COLOR_MODEL;
+	info->frei0r_version	= FREI0R_MAJOR_VERSION;
+	info->major_version		= 1;
+	info->minor_version		= 0;
+	info->num_params		= 5;
+	info->explanation		= "Balances the white and stretches the contrast of each frame by what the frames before it were like.";
+}
+
+int f0r_init() {
+	return 1;
+}
+
+void f0r_deinit() {}
+
+f0r_instance_t f0r_construct(unsigned int width, unsigned int height) {
+	f0r_instance_t	instance;
+
+	if ((instance = calloc(1, sizeof(autobalance_instance))) != NULL) {
+		instance->sLut		= KOLIBA_IdentitySlut;
+		instance->strength	= 1.0;
+		instance->balance	= 1.0;
+		instance->clip		= 0.005;
+		instance->smoothing	= 0.9;
+		instance->count		= (size_t)width * (size_t)height;
+		FRELIBA_InitFastFlut(&instance->fast);
+		instance->flags		= KOLIBA_AllFlutFlags;
+		instance->changed	= 1;
+
+		// We only need to initialize the pointers to the vertices once
+		// because their addresses within an instance never change.
+		KOLIBA_SlutToVertices(&instance->vert, &instance->sLut);
+	}
+	return instance;
+}
+
+void f0r_destruct(f0r_instance_t instance) {
+	if (instance != NULL) free(instance);
+}
+
+void f0r_get_param_info(f0r_param_info_t* info, int param_index) {
+	switch (param_index) {
+		case 0:
+			info->name			= "Strength";
+			info->type			= F0R_PARAM_DOUBLE;
+			info->explanation	= "How much of the correction to apply.";
+			break;
+		case 1:
+			info->name			= "Balance";
+			info->type			= F0R_PARAM_DOUBLE;
+			info->explanation	= "1 stretches each channel on its own, balancing the white, 0 only stretches the contrast.";
+			break;
+		case 2:
+			info->name			= "Clip";
+			info->type			= F0R_PARAM_DOUBLE;
+			info->explanation	= "The fraction of the darkest and of the brightest pixels allowed to clip.";
+			break;
+		case 3:
+			info->name			= "Smoothing";
+			info->type			= F0R_PARAM_DOUBLE;
+			info->explanation	= "How slowly the correction follows the frames, from 0 (at once) to 1 (never).";
+			break;
+		case 4:
+			info->name			= "sRGB";
+			info->type			= F0R_PARAM_BOOL;
+			info->explanation	= "Accomodates the sRGB model.";
+			break;
+	}
+}
+
+void f0r_set_param_value(f0r_instance_t instance, f0r_param_t param, int param_index) {
+	double d;
+
+	if ((instance != NULL) && (param != NULL)) {
+		d	= *(double *)param;
+		if (param_index < 4) d = (d < 0.0) ? 0.0 : (d > 1.0) ? 1.0 : d;
+
+		switch (param_index) {
+			case 0:
+				instance->strength	= d;
+				break;
+			case 1:
+				instance->balance	= d;
+				break;
+			case 2:
+				instance->clip		= (d > 0.25) ? 0.25 : d;
+				break;
+			case 3:
+				instance->smoothing	= d;
+				break;
+			case 4:
+				instance->srgb		= (d >= 0.5);
+				break;
+		}
+	}
+}
+
+void f0r_get_param_value(f0r_instance_t instance, f0r_param_t param, int param_index) {
+	if ((instance != NULL) && (param != NULL)) switch(param_index) {
+		case 0:
+			*(double *)param = instance->strength;
+			break;
+		case 1:
+			*(double *)param = instance->balance;
+			break;
+		case 2:
+			*(double *)param = instance->clip;
+			break;
+		case 3:
+			*(double *)param = instance->smoothing;
+			break;
+		case 4:
+			*(double *)param = (double)instance->srgb;
+			break;
+	}
+}
+
+// Finds the black and white points of a histogram of n samples,
+// leaving out clip of them at either end.
+static void points(const unsigned int hist[256], unsigned int n, double clip, unsigned int *black, unsigned int *white) {
+	const unsigned int limit = (unsigned int)(clip * (double)n);
+	unsigned int lo, hi, sum, mid;
+
+	for (lo = 0, sum = hist[0]; (lo < 255) && (sum <= limit); sum += hist[++lo]);
+	for (hi = 255, sum = hist[255]; (hi > lo) && (sum <= limit); sum += hist[--hi]);
+
+	if (hi - lo < AUTOBALANCE_MINRANGE) {
+		mid	= (lo + hi) / 2;
+		lo	= (mid < AUTOBALANCE_MINRANGE / 2) ? 0 : mid - AUTOBALANCE_MINRANGE / 2;
+		if (lo > 255 - AUTOBALANCE_MINRANGE) lo = 255 - AUTOBALANCE_MINRANGE;
+		hi	= lo + AUTOBALANCE_MINRANGE;
+	}
+
+	*black	= lo;
+	*white	= hi;
+}
+
+// Makes the sLut of the frames we have looked at, blends it with
+// the one we have been using, and forgets the histograms.
+static void nextframe(f0r_instance_t instance) {
+	KOLIBA_SLUT target = KOLIBA_IdentitySlut;
+	KOLIBA_VERTEX *v;
+	unsigned int black[4], white[4], c, i;
+	double lo[3], hi[3], p, q;
+
+	if (instance->samples == 0) return;
+
+	for (c = 0; c < 4; c++) points(instance->hist[c], instance->samples, instance->clip, black + c, white + c);
+
+	for (c = 0; c < 3; c++) {
+		p	= (double)black[AUTOBALANCE_LUMA] + instance->balance * ((double)black[c] - (double)black[AUTOBALANCE_LUMA]);
+		q	= (double)white[AUTOBALANCE_LUMA] + instance->balance * ((double)white[c] - (double)white[AUTOBALANCE_LUMA]);
+
+		// The FLUT sees linear values in sRGB mode, so that is
+		// where the points go. Between bytes we interpolate.
+		if (instance->srgb) {
+			i	= (unsigned int)p;
+			p	= KOLIBA_SrgbByteToLinear[i] + (p - (double)i) * (KOLIBA_SrgbByteToLinear[(i < 255) ? i + 1 : 255] - KOLIBA_SrgbByteToLinear[i]);
+			i	= (unsigned int)q;
+			q	= KOLIBA_SrgbByteToLinear[i] + (q - (double)i) * (KOLIBA_SrgbByteToLinear[(i < 255) ? i + 1 : 255] - KOLIBA_SrgbByteToLinear[i]);
+		}
+		else {
+			p	/= 255.0;
+			q	/= 255.0;
+		}
+
+		lo[c]	= p;
+		hi[c]	= q;
+	}
+
+	// Each vertex of the identity sLut is a corner of the cube,
+	// with each of its channels either 0 or 1, which is where
+	// the black or the white point of the channel is stretched to.
+	for (v = &target.Black; v <= &target.White; v++) {
+		v->r	= (v->r - lo[0]) / (hi[0] - lo[0]);
+		v->g	= (v->g - lo[1]) / (hi[1] - lo[1]);
+		v->b	= (v->b - lo[2]) / (hi[2] - lo[2]);
+	}
+
+	KOLIBA_SlutEfficacy(&target, &target, instance->strength);
+
+	if (instance->primed) KOLIBA_InterpolateSluts(&instance->sLut, &instance->sLut, 1.0 - instance->smoothing, &target);
+	else instance->sLut = target;
+
+	memset(instance->hist, 0, sizeof(instance->hist));
+	instance->samples	= 0;
+	instance->primed	= 1;
+	instance->changed	= 1;
+}
+
+// Does the actual work for f0r_update and freliba_update,
+// count pixels at a time.
+static void update(void *data, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe, size_t count) {
+	f0r_instance_t instance = (f0r_instance_t)data;
+	const KOLIBA_RGBA8PIXEL *p;
+	size_t i;
+
+	if ((instance != NULL) && (inframe != NULL) && (outframe != NULL)) {
+
+		if (instance->changed) {
+			instance->copy		= KOLIBA_IsIdentityFlut(KOLIBA_ConvertSlutToFlut(&instance->fLut, &instance->vert));
+			instance->flags		= KOLIBA_FlutFlags(&instance->fLut);
+			instance->changed	= 0;
+		}
+
+		// We look before we grade, since the frame may be graded in place.
+		for (i = instance->skip, p = inframe + i; i < count; i += AUTOBALANCE_STEP, p += AUTOBALANCE_STEP) {
+			instance->hist[0][RED(p)]++;
+			instance->hist[1][GREEN(p)]++;
+			instance->hist[2][BLUE(p)]++;
+			instance->hist[AUTOBALANCE_LUMA][((unsigned int)RED(p) * 54 + (unsigned int)GREEN(p) * 183 + (unsigned int)BLUE(p) * 19 + 128) >> 8]++;
+			instance->samples++;
+		}
+		instance->skip	= (unsigned int)(i - count);
+
+		if (instance->copy)
+			FRELIBA_FastCopyRgba8Frame(&instance->fast, outframe, inframe, count);
+		else
+			FRELIBA_FlutRgba8Frame(&instance->fast, outframe, inframe, count, &instance->fLut, instance->flags, instance->srgb);
+	}
+}
+
+// Every call of f0r_update is a frame of its own.
+void f0r_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe) {
+	if (instance != NULL) {
+		nextframe(instance);
+		update(instance, inframe, outframe, instance->count);
+	}
+}
+
+// But freliba_update may be given a frame a part at a time, so a
+// new frame is one with a new time. A call with no pixels in it
+// only prepares us, and is not a frame at all.
+void freliba_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, ptrdiff_t instride, KOLIBA_RGBA8PIXEL *outframe, ptrdiff_t outstride, size_t width, size_t height) {
+	if ((instance != NULL) && (width) && (height) && (time != instance->time)) {
+		instance->time	= time;
+		nextframe(instance);
+	}
+
+	FRELIBA_Rgba8Rows(update, instance, inframe, instride, outframe, outstride, width, height);
+}
+
+// Our FLUT changes from frame to frame, so we pretend we have
+// none. That way, a stack or a chain of effects always gives us
+// the frames rather than folding the FLUT we happen to have now
+// into its own, after which we would never see another frame.
+const FRELIBA_FASTFLUT * freliba_fastflut(f0r_instance_t instance) {
+	return NULL;
+}
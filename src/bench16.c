@@ -0,0 +1,100 @@
+/*
+	bench16.c
+
+	Copyright 2021 G. Adam Stanislav.
+	All rights reserved.
+
+	http://www.pantarheon.org
+
+	Times FRELIBA_Apply against FRELIBA_ApplyRgba16 for every
+	effect in libfreliba that can do both, at their default
+	settings, on a 1920 by 1080 frame, and prints how many
+	megapixels a second each of them gets through.
+
+	Usage: bench16 [frames [effect...]]
+
+	Build it with "make bench16".
+*/
+
+#include	"libfreliba.h"
+#include	<stdio.h>
+#include	<stdlib.h>
+#include	<time.h>
+
+#define	WIDTH	1920
+#define	HEIGHT	1080
+
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void bench(unsigned int effect, unsigned int frames, unsigned char *frame8, unsigned short *frame16) {
+	FRELIBA *fx;
+	double t8, t16;
+	unsigned int i;
+
+	if ((fx = FRELIBA_CreateEffect(effect)) == NULL) return;
+
+	// The first one is there to find out if it can be done
+	// at all, and to have the tables built before we time it.
+	if (FRELIBA_ApplyRgba16(fx, frame16, 0, frame16, 0, WIDTH, HEIGHT) == 0) {
+		FRELIBA_Apply(fx, frame8, 0, frame8, 0, WIDTH, HEIGHT);
+
+		t8 = now();
+		for (i = 0; i < frames; i++) FRELIBA_Apply(fx, frame8, 0, frame8, 0, WIDTH, HEIGHT);
+		t8 = now() - t8;
+
+		t16 = now();
+		for (i = 0; i < frames; i++) FRELIBA_ApplyRgba16(fx, frame16, 0, frame16, 0, WIDTH, HEIGHT);
+		t16 = now() - t16;
+
+		printf("%-24s %10.1f %10.1f\n", FRELIBA_EffectName(effect),
+			(double)WIDTH * HEIGHT * frames / t8 / 1e6,
+			(double)WIDTH * HEIGHT * frames / t16 / 1e6);
+	}
+
+	FRELIBA_Destroy(fx);
+}
+
+int main(int argc, char *argv[]) {
+	unsigned char *frame8;
+	unsigned short *frame16;
+	unsigned int frames = 20;
+	unsigned int effect;
+	size_t i;
+	int a, e;
+
+	if (argc > 1) frames = (unsigned int)atoi(argv[1]);
+	if (frames == 0) frames = 1;
+
+	frame8	= malloc((size_t)WIDTH * HEIGHT * 4);
+	frame16	= malloc((size_t)WIDTH * HEIGHT * 4 * sizeof(unsigned short));
+
+	if ((frame8 == NULL) || (frame16 == NULL)) {
+		fprintf(stderr, "bench16: Out of memory\n");
+		return 1;
+	}
+
+	// Anything but a flat frame, so no effect gets it easy.
+	srand(1);
+	for (i = 0; i < (size_t)WIDTH * HEIGHT * 4; i++) {
+		frame8[i]	= (unsigned char)rand();
+		frame16[i]	= (unsigned short)(frame8[i] * 257 + (rand() & 0xFF));
+	}
+
+	printf("%-24s %10s %10s\n", "effect (Mpixel/s)", "8-bit", "16-bit");
+
+	if (argc > 2) for (a = 2; a < argc; a++) {
+		if ((e = FRELIBA_FindEffect(argv[a])) < 0) fprintf(stderr, "bench16: No effect named %s\n", argv[a]);
+		else bench((unsigned int)e, frames, frame8, frame16);
+	}
+	else for (effect = 0; effect < FRELIBA_Effects(); effect++)
+		bench(effect, frames, frame8, frame16);
+
+	free(frame8);
+	free(frame16);
+	return 0;
+}
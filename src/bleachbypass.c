@@ -13,6 +13,7 @@
 */
 
 #include	<koliba.h>
+#include	"freliba.h"
 #include	<stdlib.h>
 #include	<string.h>
 
@@ -51,6 +52,7 @@ typedef	struct _erythropy_instance {
 	KOLIBA_VERTICES	vert;
 	KOLIBA_FLUT	fLut;
 	size_t	count;
+	FRELIBA_FASTFLUT	fast;
 	KOLIBA_FLAGS	flags;
 	unsigned char	srgb;
 	unsigned char	changed;
@@ -60,10 +62,10 @@ typedef	struct _erythropy_instance {
 typedef	void	*f0r_param_t;
 
 void f0r_get_plugin_info(f0r_plugin_info_t* info) {
-	info->name				= "Koliba Bleach Bypass";
+	info->name				= "Koliba Bleach Bypass" FRELIBA_NAME_SUFFIX;
 	info->author			= "G. Adam Stanislav";
 	info->plugin_type		= F0R_PLUGIN_TYPE_FILTER;
-	info->color_model		= F0R_COLOR_MODEL_RGBA8888;
+	info->color_model		= FRELIBA_COLOR_MODEL;
 	info->frei0r_version	= FREI0R_MAJOR_VERSION;
 	info->major_version		= 1;
 	info->minor_version		= 0;
@@ -87,6 +89,7 @@ f0r_instance_t f0r_construct(unsigned int width, unsigned int height) {
 		instance->mallet[0].natcon		= 0.45;
 		instance->mallet[1].saturation	= 0.5;
 		instance->count					= (size_t)width * (size_t)height;
+		FRELIBA_InitFastFlut(&instance->fast);
 		instance->flags					= KOLIBA_AllFlutFlags;
 		instance->srgb					= 1;
 		instance->changed				= 1;
@@ -156,11 +159,12 @@ void f0r_get_param_value(f0r_instance_t instance, f0r_param_t param, int param_i
 	}
 }
 
-void f0r_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe) {
+// Does the actual work for f0r_update and freliba_update,
+// count pixels at a time.
+static void update(void *data, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe, size_t count) {
+	f0r_instance_t instance = (f0r_instance_t)data;
+
 	if ((instance != NULL) && (inframe != NULL) && (outframe != NULL)) {
-		size_t i;
-		const double *iconv;
-		const unsigned char *oconv;
 
 		if (instance->changed) {
 			KOLIBA_ConvertMalletsToSlut(&instance->sLut, NULL, instance->mallet, NULL, 2);
@@ -170,20 +174,20 @@ void f0r_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *i
 		}
 
 		if (instance->copy)
-			memcpy(outframe, inframe, i*sizeof(KOLIBA_RGBA8PIXEL));
-		else {
-			if (instance->srgb) {
-				iconv = KOLIBA_SrgbByteToLinear;
-				oconv = KOLIBA_LinearByteToSrgb;
-			}
-			else {
-				iconv = NULL;
-				oconv = NULL;
-			}
-
-			for (i = instance->count; i; i--, inframe++, outframe++) {
-				KOLIBA_Rgba8Pixel(outframe, inframe, &instance->fLut, instance->flags, iconv, oconv)->a = inframe->a;
-			}
-		}
+			FRELIBA_FastCopyRgba8Frame(&instance->fast, outframe, inframe, count);
+		else
+			FRELIBA_FlutRgba8Frame(&instance->fast, outframe, inframe, count, &instance->fLut, instance->flags, instance->srgb);
 	}
 }
+
+void f0r_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe) {
+	if (instance != NULL) update(instance, inframe, outframe, instance->count);
+}
+
+void freliba_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, ptrdiff_t instride, KOLIBA_RGBA8PIXEL *outframe, ptrdiff_t outstride, size_t width, size_t height) {
+	FRELIBA_Rgba8Rows(update, instance, inframe, instride, outframe, outstride, width, height);
+}
+
+const FRELIBA_FASTFLUT * freliba_fastflut(f0r_instance_t instance) {
+	return &instance->fast;
+}
@@ -13,6 +13,7 @@
 */
 
 #include	<koliba.h>
+#include	"freliba.h"
 #include	<stdlib.h>
 #include	<string.h>
 
@@ -49,6 +50,7 @@ typedef	struct _lift_instance {
 	KOLIBA_FLUT		fLut;
 	double			efficacy;
 	unsigned int	count;
+	FRELIBA_FASTFLUT	fast;
 	KOLIBA_FLAGS	flags;
 	signed int		channel;
 	unsigned char	srgb;
@@ -59,10 +61,10 @@ typedef	struct _lift_instance {
 typedef	void	*f0r_param_t;
 
 void f0r_get_plugin_info(f0r_plugin_info_t* info) {
-	info->name				= "Koliba Channel Extraction (Primary)";
+	info->name				= "Koliba Channel Extraction (Primary)" FRELIBA_NAME_SUFFIX;
 	info->author			= "G. Adam Stanislav";
 	info->plugin_type		= F0R_PLUGIN_TYPE_FILTER;
-	info->color_model		= F0R_COLOR_MODEL_RGBA8888;
+	info->color_model		= FRELIBA_COLOR_MODEL;
 	info->frei0r_version	= FREI0R_MAJOR_VERSION;
 	info->major_version		= 1;
 	info->minor_version		= 0;
@@ -82,6 +84,7 @@ f0r_instance_t f0r_construct(unsigned int width, unsigned int height) {
 	if ((instance = malloc(sizeof(lift_instance))) != NULL) {
 		instance->efficacy			= 1.0;
 		instance->count				= width * height;
+		FRELIBA_InitFastFlut(&instance->fast);
 		instance->channel			= 0;
 		instance->srgb				= 1;
 		instance->changed			= 1;
@@ -150,12 +153,12 @@ void f0r_get_param_value(f0r_instance_t instance, f0r_param_t param, int param_i
 	}
 }
 
-void f0r_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe) {
-	if ((instance != NULL) && (inframe != NULL) && (outframe != NULL)) {
-		size_t i = instance->count;
-		const double *iconv;
-		const unsigned char *oconv;
+// Does the actual work for f0r_update and freliba_update,
+// count pixels at a time.
+static void update(void *data, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe, size_t count) {
+	f0r_instance_t instance = (f0r_instance_t)data;
 
+	if ((instance != NULL) && (inframe != NULL) && (outframe != NULL)) {
 		if (instance->changed) {
 			instance->flags		= KOLIBA_FlutFlags(KOLIBA_FlutEfficacy(&instance->fLut, KOLIBA_ConvertMatrixToFlut(&instance->fLut, (instance->channel < 1) ? &KOLIBA_Redx : (instance->channel <= 2) ? &KOLIBA_Greenx : &KOLIBA_Bluex), instance->efficacy));
 			instance->copy		= KOLIBA_IsIdentityFlut(&instance->fLut);
@@ -163,20 +166,20 @@ void f0r_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *i
 		}
 
 		if (instance->copy)
-			memcpy(outframe, inframe, i*sizeof(KOLIBA_RGBA8PIXEL));
-		else {
-			if (instance->srgb) {
-				iconv = KOLIBA_SrgbByteToLinear;
-				oconv = KOLIBA_LinearByteToSrgb;
-			}
-			else {
-				iconv = NULL;
-				oconv = NULL;
-			}
-
-			for (; i; i--, inframe++, outframe++) {
-				KOLIBA_Rgba8Pixel(outframe, inframe, &instance->fLut, instance->flags, iconv, oconv)->a = inframe->a;
-			}
-		}
+			FRELIBA_FastCopyRgba8Frame(&instance->fast, outframe, inframe, count);
+		else
+			FRELIBA_FlutRgba8Frame(&instance->fast, outframe, inframe, count, &instance->fLut, instance->flags, instance->srgb);
 	}
 }
+
+void f0r_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe) {
+	if (instance != NULL) update(instance, inframe, outframe, instance->count);
+}
+
+void freliba_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, ptrdiff_t instride, KOLIBA_RGBA8PIXEL *outframe, ptrdiff_t outstride, size_t width, size_t height) {
+	FRELIBA_Rgba8Rows(update, instance, inframe, instride, outframe, outstride, width, height);
+}
+
+const FRELIBA_FASTFLUT * freliba_fastflut(f0r_instance_t instance) {
+	return &instance->fast;
+}
@@ -13,6 +13,7 @@
 */
 
 #include	<koliba.h>
+#include	"freliba.h"
 #include	<stdlib.h>
 
 /* From frei0r.h, which may or may not be on your system */
@@ -51,6 +52,7 @@ typedef	struct _chroma_instance {
 	double				angle;		// In turns
 	double				efficacy;
 	size_t				count;
+	FRELIBA_FASTFLUT	fast;
 	unsigned char		changed;
 	unsigned char		invert;
 	unsigned char		srgb;
@@ -59,10 +61,10 @@ typedef	struct _chroma_instance {
 typedef	void	*f0r_param_t;
 
 void f0r_get_plugin_info(f0r_plugin_info_t* info) {
-	info->name				= "Koliba Chroma";
+	info->name				= "Koliba Chroma" FRELIBA_NAME_SUFFIX;
 	info->author			= "G. Adam Stanislav";
 	info->plugin_type		= F0R_PLUGIN_TYPE_FILTER;
-	info->color_model		= F0R_COLOR_MODEL_RGBA8888;
+	info->color_model		= FRELIBA_COLOR_MODEL;
 	info->frei0r_version	= FREI0R_MAJOR_VERSION;
 	info->major_version		= 1;
 	info->minor_version		= 0;
@@ -79,6 +81,7 @@ f0r_instance_t f0r_construct(unsigned int width, unsigned int height) {
 
 	if ((instance = malloc(sizeof(chroma_instance))) != NULL) {
 		instance->count			= (size_t)width * (size_t)height;
+		FRELIBA_InitFastFlut(&instance->fast);
 
 		// We will use the default (Rec. 2020) chroma model.
 		// We only need to do this once.
@@ -239,11 +242,12 @@ void f0r_get_param_value(f0r_instance_t instance, f0r_param_t param, int param_i
 	}
 }
 
-void f0r_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe) {
+// Does the actual work for f0r_update and freliba_update,
+// count pixels at a time.
+static void update(void *data, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe, size_t count) {
+	f0r_instance_t instance = (f0r_instance_t)data;
+
 	if ((instance != NULL) && (inframe != NULL) && (outframe != NULL)) {
-		size_t i;
-		const double *iconv;
-		const unsigned char *oconv;
 
 		if (instance->changed) {
 			KOLIBA_ChromaMatrix(&instance->matrix, &instance->chroma, &instance->model);
@@ -252,17 +256,18 @@ void f0r_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *i
 			instance->changed	= 0;
 		}
 
-		if (instance->srgb) {
-			iconv = KOLIBA_SrgbByteToLinear;
-			oconv = KOLIBA_LinearByteToSrgb;
-		}
-		else {
-			iconv = NULL;
-			oconv = NULL;
-		}
-
-		for (i = instance->count; i; i--, inframe++, outframe++) {
-			KOLIBA_Rgba8Pixel(outframe, inframe, &instance->fLut, KOLIBA_MatrixFlutFlags, iconv, oconv)->a = inframe->a;
-		}
+		FRELIBA_FlutRgba8Frame(&instance->fast, outframe, inframe, count, &instance->fLut, KOLIBA_MatrixFlutFlags, instance->srgb);
 	}
 }
+
+void f0r_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe) {
+	if (instance != NULL) update(instance, inframe, outframe, instance->count);
+}
+
+void freliba_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, ptrdiff_t instride, KOLIBA_RGBA8PIXEL *outframe, ptrdiff_t outstride, size_t width, size_t height) {
+	FRELIBA_Rgba8Rows(update, instance, inframe, instride, outframe, outstride, width, height);
+}
+
+const FRELIBA_FASTFLUT * freliba_fastflut(f0r_instance_t instance) {
+	return &instance->fast;
+}
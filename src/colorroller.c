@@ -17,6 +17,7 @@
 */
 
 #include	<koliba.h>
+#include	"freliba.h"
 #include	<stdlib.h>
 #include	<string.h>
 
@@ -69,10 +70,10 @@ typedef	struct _colorroller_instance {
 typedef	void	*f0r_param_t;
 
 void f0r_get_plugin_info(f0r_plugin_info_t* info) {
-	info->name				= "Koliba Color Roller";
+	info->name				= "Koliba Color Roller" FRELIBA_NAME_SUFFIX;
 	info->author			= "G. Adam Stanislav";
 	info->plugin_type		= F0R_PLUGIN_TYPE_FILTER;
-	info->color_model		= F0R_COLOR_MODEL_RGBA8888;
+	info->color_model		= FRELIBA_COLOR_MODEL;
 	info->frei0r_version	= FREI0R_MAJOR_VERSION;
 	info->major_version		= 1;
 	info->minor_version		= 1;
@@ -249,13 +250,17 @@ void f0r_get_param_value(f0r_instance_t instance, f0r_param_t param, int param_i
 	}
 }
 
-void f0r_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe) {
+// Does the actual work for f0r_update and freliba_update,
+// count pixels at a time.
+static void update(void *data, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe, size_t count) {
+	f0r_instance_t instance = (f0r_instance_t)data;
+
 	if ((instance != NULL) && (inframe != NULL) && (outframe != NULL)) {
-		size_t i = instance->count;
+		size_t i = count;
 		const double *iconv;
 		const unsigned char *oconv;
 
-		if (instance->efficacy == 0.0) memcpy(outframe, inframe, i*sizeof(KOLIBA_RGBA8PIXEL));
+		if (instance->efficacy == 0.0) FRELIBA_CopyRgba8Frame(outframe, inframe, i);
 		else {
 			if (instance->srgb) {
 				iconv = KOLIBA_SrgbByteToLinear;
@@ -268,16 +273,32 @@ void f0r_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *i
 
 			if (instance->changed) {
 				KOLIBA_ColorRoller(&instance->sLut, instance->imp, instance->angle * 360.0, instance->atmo * 360.0, instance->fx, (instance->inverse) ? -instance->efficacy : instance->efficacy);
-				instance->flags = KOLIBA_FlutFlags(KOLIBA_ConvertSlutToFlut(&instance->fLut, &instance->vertices));
+				instance->flags = KOLIBA_FlutFlags(FRELIBA_OrderFlut(KOLIBA_ConvertSlutToFlut(&instance->fLut, &instance->vertices)));
 				KOLIBA_ScaleFlut(&instance->fLut, &instance->fLut, 255.0);
 				KOLIBA_SlutToRgba8Palette(instance->palette, &instance->sLut, iconv, oconv);
+				FRELIBA_OrderRgba8(instance->palette, 256);
 				instance->changed	= 0;
 			}
 
 			if (instance->preview) KOLIBA_PaletteToRgba8Alpha(outframe, inframe, instance->palette, i);
+			else if (FRELIBA_IsNearIdentityScaledFlut(&instance->fLut, instance->srgb)) FRELIBA_CopyRgba8Frame(outframe, inframe, i);
 			else for (; i; i--, inframe++, outframe++) {
 				KOLIBA_ScaledRgba8Pixel(outframe, inframe, &instance->fLut, instance->flags, iconv, oconv)->a = inframe->a;
 			}
 		}
 	}
 }
+
+void f0r_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe) {
+	if (instance != NULL) update(instance, inframe, outframe, instance->count);
+}
+
+void freliba_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, ptrdiff_t instride, KOLIBA_RGBA8PIXEL *outframe, ptrdiff_t outstride, size_t width, size_t height) {
+	FRELIBA_Rgba8Rows(update, instance, inframe, instride, outframe, outstride, width, height);
+}
+
+// We do not work through a FRELIBA_FASTFLUT, so there is
+// no RGBA64 path for us.
+const FRELIBA_FASTFLUT * freliba_fastflut(f0r_instance_t instance) {
+	return NULL;
+}
@@ -25,6 +25,7 @@
 */
 
 #include	<koliba.h>
+#include	"freliba.h"
 #include	<stdlib.h>
 
 /* From frei0r.h, which may or may not be on your system */
@@ -60,6 +61,7 @@ typedef	struct _colors_instance {
 	KOLIBA_FFLUT	ffLut[2];
 	KOLIBA_XYZ		lift, gamma, gain, offset;
 	size_t			count;
+	FRELIBA_FASTFLUT	fast;
 	unsigned char	changed;
 	unsigned char	srgb;
 } colors_instance, *f0r_instance_t;
@@ -67,10 +69,10 @@ typedef	struct _colors_instance {
 typedef	void	*f0r_param_t;
 
 void f0r_get_plugin_info(f0r_plugin_info_t* info) {
-	info->name				= "Koliba Colors";
+	info->name				= "Koliba Colors" FRELIBA_NAME_SUFFIX;
 	info->author			= "G. Adam Stanislav";
 	info->plugin_type		= F0R_PLUGIN_TYPE_FILTER;
-	info->color_model		= F0R_COLOR_MODEL_RGBA8888;
+	info->color_model		= FRELIBA_COLOR_MODEL;
 	info->frei0r_version	= FREI0R_MAJOR_VERSION;
 	info->major_version		= 1;
 	info->minor_version		= 0;
@@ -91,6 +93,9 @@ f0r_instance_t f0r_construct(unsigned int width, unsigned int height) {
 		instance->ffLut[0].fLut	= &instance->fLut[0];
 		instance->ffLut[1].fLut	= &instance->fLut[1];
 
+		// Our FLUTs are already in the order of the frame.
+		FRELIBA_InitFastFlutModel(&instance->fast, FRELIBA_MODEL_RGBA8888);
+
 		instance->gain.x		= 1.0;
 		instance->gain.y		= 1.0;
 		instance->gain.z		= 1.0;
@@ -304,10 +309,16 @@ void f0r_get_param_value(f0r_instance_t instance, f0r_param_t param, int param_i
 	}
 }
 
-void f0r_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe) {
+// Does the actual work for f0r_update and freliba_update,
+// count pixels at a time.
+static void update(void *data, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe, size_t count) {
+	f0r_instance_t instance = (f0r_instance_t)data;
 	KOLIBA_MATRIX mat;
 	KOLIBA_XYZ xyz;
 	KOLIBA_EXTERNAL ext;
+	KOLIBA_FFLUT fChain[2];
+	KOLIBA_FLUT fLuts[2];
+	unsigned int pre, post;
 
 	if ((instance != NULL) && (inframe != NULL) && (outframe != NULL)) {
 		size_t i;
@@ -316,13 +327,13 @@ void f0r_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *i
 
 		if (instance->changed) {
 			KOLIBA_MatrixLift(&mat, NULL, (KOLIBA_VERTEX *)&instance->lift);
-			KOLIBA_ConvertMatrixToFlut(&instance->fLut[0], &mat);
+			FRELIBA_OrderFlut(KOLIBA_ConvertMatrixToFlut(&instance->fLut[0], &mat));
 			instance->ffLut[0].flags = KOLIBA_FlutFlags(&instance->fLut[0]);
 			KOLIBA_MatrixGain(&mat, NULL,(KOLIBA_VERTEX *)&instance->gain);
 			mat.Red.o	= instance->offset.x;
 			mat.Green.o	= instance->offset.y;
 			mat.Blue.o	= instance->offset.z;
-			KOLIBA_ConvertMatrixToFlut(&instance->fLut[1], &mat);
+			FRELIBA_OrderFlut(KOLIBA_ConvertMatrixToFlut(&instance->fLut[1], &mat));
 			instance->ffLut[1].flags = KOLIBA_FlutFlags(&instance->fLut[1]);
 			instance->changed	= 0;
 		}
@@ -332,19 +343,66 @@ void f0r_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *i
 		else {
 			KOLIBA_PrepareGammaParameters(&xyz, &instance->gamma);
 			ext = KOLIBA_Gamma;
+#ifdef	FRELIBA_BGRA
+			// The gamma goes by the order of the channels in
+			// the pixel, so in BGRA its red is the third one.
+			{
+				double swap	= xyz.x;
+				xyz.x		= xyz.z;
+				xyz.z		= swap;
+			}
+#endif
 		}
 
-		if (instance->srgb) {
-			iconv = KOLIBA_SrgbByteToLinear;
-			oconv = KOLIBA_LinearByteToSrgb;
+		// The lift and the gain/offset FLUTs are identities at their
+		// default settings, so we drop whichever one does nothing.
+		// Without the gamma between them they are just two matrices
+		// in a row, i.e., a single FLUT, which is all we apply then.
+		// The gamma can stretch a tiny change near black into a big
+		// one, so we only drop the lift before it when it is an
+		// exact identity, not merely close to one.
+		if (ext == NULL) {
+			pre		= FRELIBA_CollapseFlutChain(fLuts, fChain, instance->ffLut, 2, instance->srgb);
+			post	= 0;
 		}
 		else {
-			iconv = NULL;
-			oconv = NULL;
+			pre		= 0;
+			if (!KOLIBA_IsIdentityFlut(instance->ffLut[0].fLut)) fChain[pre++] = instance->ffLut[0];
+			post	= FRELIBA_PruneFlutChain(fChain + pre, instance->ffLut + 1, 1, instance->srgb);
 		}
 
-		for (i = instance->count; i; i--, inframe++, outframe++) {
-			KOLIBA_ExternalRgba8Pixel(outframe, inframe, instance->ffLut, 1, 1, ext, &xyz, iconv, oconv)->a = inframe->a;
+		if ((ext == NULL) && (pre == 0)) FRELIBA_CopyRgba8Frame(outframe, inframe, count);
+		else if ((ext == NULL) && (pre == 1)) FRELIBA_FlutRgba8Frame(&instance->fast, outframe, inframe, count, fChain[0].fLut, fChain[0].flags, instance->srgb);
+		else {
+			if (instance->srgb) {
+				iconv = KOLIBA_SrgbByteToLinear;
+				oconv = KOLIBA_LinearByteToSrgb;
+			}
+			else {
+				iconv = NULL;
+				oconv = NULL;
+			}
+
+			if (ext != NULL) for (i = count; i; i--, inframe++, outframe++) {
+				KOLIBA_ExternalRgba8Pixel(outframe, inframe, fChain, pre, post, ext, &xyz, iconv, oconv)->a = inframe->a;
+			}
+			else for (i = count; i; i--, inframe++, outframe++) {
+				KOLIBA_PolyRgba8Pixel(outframe, inframe, fChain, pre, iconv, oconv)->a = inframe->a;
+			}
 		}
 	}
 }
+
+void f0r_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe) {
+	if (instance != NULL) update(instance, inframe, outframe, instance->count);
+}
+
+void freliba_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, ptrdiff_t instride, KOLIBA_RGBA8PIXEL *outframe, ptrdiff_t outstride, size_t width, size_t height) {
+	FRELIBA_Rgba8Rows(update, instance, inframe, instride, outframe, outstride, width, height);
+}
+
+// Our FRELIBA_FASTFLUT only covers the settings without any
+// gamma, so there is no RGBA64 path for us.
+const FRELIBA_FASTFLUT * freliba_fastflut(f0r_instance_t instance) {
+	return NULL;
+}
@@ -0,0 +1,304 @@
+/*
+	cube.c
+
+	Copyright 2021 G. Adam Stanislav.
+	All rights reserved.
+
+	http://www.pantarheon.org
+
+	This is a frei0r-compatible plug-in, applying a 3D LUT
+	from a .cube file. It reads the file once, and again
+	whenever its path or the file itself changes, turning
+	every cell of the LUT into a FLUT, so each pixel only
+	costs a table lookup and one FLUT. All instances using
+	the same file share the same FLUTs.
+
+	Each cell takes 192 bytes, so a LUT_3D_SIZE of 33 takes
+	6 MiB, and the largest we accept, 65, takes 48 MiB. We
+	refuse bigger files rather than use gigabytes of memory.
+
+	It needs to be linked dynamically using the -lkoliba
+	switch in Unix and its derivatives, or koliba.lib in
+	Windows.
+*/
+
+#include	<koliba.h>
+#include	"freliba.h"
+#include	<stdlib.h>
+#include	<string.h>
+
+/* From frei0r.h, which may or may not be on your system */
+typedef struct f0r_plugin_info
+{
+  const char* name;
+  const char* author;
+  int plugin_type;
+  int color_model;
+  int frei0r_version;
+  int major_version;
+  int minor_version;
+  int num_params;
+  const char* explanation;
+} f0r_plugin_info_t;
+
+typedef struct f0r_param_info
+{
+  const char* name;
+  int type;
+  const char* explanation;
+} f0r_param_info_t;
+
+#define FREI0R_MAJOR_VERSION 1
+#define F0R_PLUGIN_TYPE_FILTER 0
+#define F0R_COLOR_MODEL_RGBA8888 1
+#define	F0R_PARAM_BOOL	0
+#define F0R_PARAM_DOUBLE    1
+#define F0R_PARAM_COLOR     2
+#define F0R_PARAM_POSITION  3
+#define F0R_PARAM_STRING    4
+/* End of frei0r.h extract */
+
+typedef	struct _cube_instance {
+	char			*path;
+	FRELIBA_LATTICE	*lattice;
+	FRELIBA_FILESTAMP	stamp;
+	size_t			count;
+	unsigned char	srgb;
+	unsigned char	changed;
+} cube_instance, *f0r_instance_t;
+
+typedef	void	*f0r_param_t;
+
+void f0r_get_plugin_info(f0r_plugin_info_t* info) {
+	info->name				= "Koliba Cube" FRELIBA_NAME_SUFFIX;
+	info->author			= "G. Adam Stanislav";
+	info->plugin_type		= F0R_PLUGIN_TYPE_FILTER;
+	info->color_model		= FRELIBA_COLOR_MODEL;
+	info->frei0r_version	= FREI0R_MAJOR_VERSION;
+	info->major_version		= 1;
+	info->minor_version		= 0;
+	info->num_params		= 2;
+	info->explanation		= "Applies a 3D LUT from a .cube file.";
+}
+
+int f0r_init() {
+	return 1;
+}
+
+void f0r_deinit() {}
+
+// The files can be big (a 65-point cube has over 270,000
+// lines), so we read the numbers ourselves rather than through
+// strtod, which has to care about the locale and much else.
+static const double powers[] = {
+	1.0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+	1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20
+};
+
+static int blank(char c) {
+	return (c == ' ') || (c == '\t') || (c == '\r');
+}
+
+// Reads a number at p, skipping any blanks before it. Returns
+// where the number ends, or NULL if there is no number at p.
+static const char * number(const char *p, const char *end, double *value) {
+	double v = 0.0;
+	int negative = 0, exponent = 0, e = 0, eneg = 0, digits = 0;
+
+	while ((p < end) && blank(*p)) p++;
+
+	if ((p < end) && ((*p == '-') || (*p == '+'))) negative = (*p++ == '-');
+
+	for (; (p < end) && (*p >= '0') && (*p <= '9'); p++, digits++) v = v * 10.0 + (double)(*p - '0');
+
+	if ((p < end) && (*p == '.')) for (p++; (p < end) && (*p >= '0') && (*p <= '9'); p++, digits++) {
+		v	= v * 10.0 + (double)(*p - '0');
+		exponent--;
+	}
+
+	if (digits == 0) return NULL;
+
+	if ((p < end) && ((*p == 'e') || (*p == 'E'))) {
+		p++;
+		if ((p < end) && ((*p == '-') || (*p == '+'))) eneg = (*p++ == '-');
+		for (; (p < end) && (*p >= '0') && (*p <= '9'); p++) if (e < 1000) e = e * 10 + (*p - '0');
+		exponent	+= (eneg) ? -e : e;
+	}
+
+	for (; exponent > 20; exponent -= 20) v *= powers[20];
+	for (; exponent < -20; exponent += 20) v /= powers[20];
+	v	= (exponent < 0) ? v / powers[-exponent] : v * powers[exponent];
+
+	*value	= (negative) ? -v : v;
+	return p;
+}
+
+// Does the line at p start with the keyword?
+static int keyword(const char *p, const char *end, const char *key) {
+	size_t n = strlen(key);
+
+	return ((size_t)(end - p) > n) && (memcmp(p, key, n) == 0) && blank(p[n]);
+}
+
+// Makes a lattice of a .cube file, as Adobe and Resolve write them.
+// We do not do 1D LUTs (nor files with both a 1D and a 3D LUT).
+static FRELIBA_LATTICE * parsecube(const char *data, size_t size) {
+	const char *p = data, *end = data + size, *eol, *q;
+	FRELIBA_LATTICE *lattice = NULL;
+	float *points = NULL;
+	double dmin[3] = {0.0, 0.0, 0.0}, dmax[3] = {1.0, 1.0, 1.0}, v[3], *d;
+	size_t n = 0, total = 0;
+	unsigned int lsize = 0, i;
+
+	for (; p < end; p = eol + 1) {
+		if ((eol = memchr(p, '\n', end - p)) == NULL) eol = end;
+		while ((p < eol) && blank(*p)) p++;
+
+		if ((p == eol) || (*p == '#') || keyword(p, eol, "TITLE")) continue;
+
+		else if (keyword(p, eol, "LUT_3D_SIZE")) {
+			if ((points != NULL) || (number(p + 11, eol, v) == NULL) || (v[0] < 2.0) || (v[0] > (double)FRELIBA_MAXLATTICE)) break;
+			lsize	= (unsigned int)v[0];
+			total	= (size_t)lsize * lsize * lsize;
+			if ((points = malloc(total * 3 * sizeof(float))) == NULL) break;
+		}
+
+		else if (keyword(p, eol, "DOMAIN_MIN") || keyword(p, eol, "DOMAIN_MAX")) {
+			d	= (p[9] == 'N') ? dmin : dmax;
+			for (i = 0, q = p + 10; (i < 3) && ((q = number(q, eol, d + i)) != NULL); i++);
+			if (i < 3) break;
+		}
+
+		else if (keyword(p, eol, "LUT_3D_INPUT_RANGE")) {
+			if (((q = number(p + 18, eol, dmin)) == NULL) || (number(q, eol, dmax) == NULL)) break;
+			dmin[1]	= dmin[2] = dmin[0];
+			dmax[1]	= dmax[2] = dmax[0];
+		}
+
+		else if (keyword(p, eol, "LUT_1D_SIZE")) break;
+
+		// Any other keyword we can live without.
+		else if (((*p >= 'A') && (*p <= 'Z')) || ((*p >= 'a') && (*p <= 'z'))) continue;
+
+		else {
+			if ((points == NULL) || (n == total)) break;
+			for (i = 0, q = p; (i < 3) && ((q = number(q, eol, v + i)) != NULL); i++) points[n * 3 + i] = (float)v[i];
+			if (i < 3) break;
+			n++;
+		}
+	}
+
+	// We only get to the end if we liked every line.
+	if ((p >= end) && (points != NULL) && (n == total)) lattice = FRELIBA_CreateLattice(points, lsize, dmin, dmax);
+	free(points);
+	return lattice;
+}
+
+f0r_instance_t f0r_construct(unsigned int width, unsigned int height) {
+	f0r_instance_t	instance;
+
+	if ((instance = calloc(sizeof(cube_instance),1)) != NULL) {
+		instance->count			= (size_t)width * (size_t)height;
+		instance->changed		= 1;
+	}
+	return instance;
+}
+
+void f0r_destruct(f0r_instance_t instance) {
+	if (instance != NULL) {
+		FRELIBA_ReleaseLattice(instance->lattice);
+		free(instance->path);
+		free(instance);
+	}
+}
+
+void f0r_get_param_info(f0r_param_info_t* info, int param_index) {
+	switch (param_index) {
+		case 0:
+			info->name			= "Path";
+			info->type			= F0R_PARAM_STRING;
+			info->explanation	= "The .cube file to apply.";
+			break;
+		case 1:
+			info->name			= "sRGB";
+			info->type			= F0R_PARAM_BOOL;
+			info->explanation	= "The LUT expects linear light, so linearize sRGB input (and encode the output).";
+			break;
+	}
+}
+
+void f0r_set_param_value(f0r_instance_t instance, f0r_param_t param, int param_index) {
+	const char *path;
+	char *copy;
+
+	if ((instance != NULL) && (param != NULL)) switch (param_index) {
+		case 0:
+			if ((path = *(const char **)param) == NULL) path = "";
+			if (((instance->path == NULL) || (strcmp(instance->path, path) != 0)) &&
+				((copy = strdup(path)) != NULL)) {
+				free(instance->path);
+				instance->path		= copy;
+				instance->changed	= 1;
+			}
+			break;
+		case 1:
+			instance->srgb	= (*(double *)param >= 0.5);
+			break;
+	}
+}
+
+void f0r_get_param_value(f0r_instance_t instance, f0r_param_t param, int param_index) {
+	if ((instance != NULL) && (param != NULL)) switch(param_index) {
+		case 0:
+			*(const char **)param = (instance->path != NULL) ? instance->path : "";
+			break;
+		case 1:
+			*(double *)param	= (double)instance->srgb;
+			break;
+	}
+}
+
+// Does the actual work for f0r_update and freliba_update,
+// count pixels at a time.
+static void update(void *data, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe, size_t count) {
+	f0r_instance_t instance = (f0r_instance_t)data;
+
+	if ((instance != NULL) && (inframe != NULL) && (outframe != NULL)) {
+
+		if (instance->changed) {
+			FRELIBA_ReleaseLattice(instance->lattice);
+			FRELIBA_FileStamp(instance->path, &instance->stamp);
+			instance->lattice	= ((instance->path != NULL) && (*instance->path != '\0')) ? FRELIBA_LoadLattice(instance->path, parsecube) : NULL;
+			instance->changed	= 0;
+		}
+
+		// Without a LUT (e.g., if we could not read the file)
+		// we leave the frame as it is.
+		if (instance->lattice == NULL) FRELIBA_CopyRgba8Frame(outframe, inframe, count);
+		else FRELIBA_LatticeRgba8Frame(instance->lattice, outframe, inframe, count, instance->srgb, FRELIBA_COLOR_MODEL == FRELIBA_MODEL_BGRA8888);
+	}
+}
+
+// A new version of the file replaces the old one at the
+// next frame.
+static void checkfile(f0r_instance_t instance) {
+	if ((instance != NULL) && (instance->path != NULL) && (*instance->path != '\0') &&
+		(FRELIBA_FileChanged(instance->path, &instance->stamp))) instance->changed = 1;
+}
+
+void f0r_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe) {
+	if (instance != NULL) {
+		checkfile(instance);
+		update(instance, inframe, outframe, instance->count);
+	}
+}
+
+void freliba_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, ptrdiff_t instride, KOLIBA_RGBA8PIXEL *outframe, ptrdiff_t outstride, size_t width, size_t height) {
+	checkfile(instance);
+	FRELIBA_Rgba8Rows(update, instance, inframe, instride, outframe, outstride, width, height);
+}
+
+// A LUT is not a FLUT, but a FLUT for every cell of it.
+const FRELIBA_FASTFLUT * freliba_fastflut(f0r_instance_t instance) {
+	return NULL;
+}
@@ -0,0 +1,1137 @@
+/*
+	freliba-apply.c
+
+	Copyright 2021 G. Adam Stanislav.
+	All rights reserved.
+
+	http://www.pantarheon.org
+
+	Applies a chain of freliba effects to a stream of frames,
+	without any host. The frames are either raw RGBA (or BGRA),
+	8 bits per channel, or a YUV4MPEG2 (.y4m) stream, read from
+	a file or the standard input and written to a file or the
+	standard output.
+
+	Usage:
+
+		freliba-apply [options] effect[:param=value...] ...
+
+	Options:
+
+		-i file		Read from file instead of stdin.
+		-o file		Write to file instead of stdout.
+		-s WxH		The size of raw frames (required for them).
+		-y		The input is YUV4MPEG2 (the output will be, too).
+		-M matrix	601, 709, or 2020 for YUV4MPEG2 (default 709).
+		-B		Raw frames are BGRA, not RGBA.
+		-j n		Use n worker threads (default: one per CPU;
+				just one if an effect changes over time).
+		-b n		Keep n frames in flight (default: 2 per worker).
+		-c		Use read and write even where we could do without.
+		-g images	Grade still images instead (see below).
+		-O dir		Where to put the graded images.
+		-q		Do not report the throughput on stderr.
+		-S file		Write the statistics of all frames to file.
+
+	Each effect is named as in libfreliba (e.g., palette), and may
+	be followed by any number of its parameters, each after a colon.
+	Boolean and numeric parameters take a number, colors take r,g,b,
+	positions take x,y, and strings take the rest of the argument up
+	to the next colon. For example:
+
+		freliba-apply -s 1920x1080 "palette:sRGB=1:Efficacy=0.5" tint
+
+	One thread reads the frames into a bounded ring of buffers, a pool
+	of workers applies the effects to them (each worker with its own
+	instances of the effects, so they never wait for each other), and
+	one thread writes them out in their original order.
+
+	Effects that change from one frame to the next (autobalance,
+	see FRELIBA_Timed) have to see every frame, in order, so when
+	the chain has one, a single worker grades all the frames (or
+	images), whatever -j says.
+
+	With -g, the input is a directory of PPM, PAM and TGA images (8
+	bits per channel), or a (quoted) glob pattern matching them. The
+	workers take the images one at a time, each with the effects it
+	set up just once, and write them to the -O directory under the
+	same names, in the same formats. The images are mapped to memory
+	rather than read.
+
+	When the input is a regular file, we map it to memory instead of
+	reading it, and the workers take each frame straight from there
+	to their output buffer. On Linux, when the output is a pipe, we
+	hand the buffers over to it with vmsplice instead of copying them
+	with write, and only reuse a buffer once the pipe has room for
+	no more than the frames written after it. Comparing the throughput
+	reported with and without -c shows what that saves.
+
+	With -S, every worker gathers the statistics of the frames (or
+	images) it grades, as it grades them (see FRELIBA_ApplyChainStats),
+	and once they are all done, we add them up and write them to the
+	file as JSON. That only works with RGBA (or BGRA) pixels.
+
+	Build it with "make freliba-apply".
+*/
+
+#ifdef	__linux__
+#define	_GNU_SOURCE
+#endif
+
+#include	"libfreliba.h"
+#include	<stdio.h>
+#include	<stdlib.h>
+#include	<string.h>
+#include	<errno.h>
+#include	<fcntl.h>
+#include	<unistd.h>
+#include	<pthread.h>
+#include	<time.h>
+#include	<ctype.h>
+#include	<glob.h>
+#include	<strings.h>
+#include	<sys/types.h>
+#include	<sys/stat.h>
+#include	<sys/mman.h>
+#ifdef	__linux__
+#include	<sys/uio.h>
+#endif
+
+// The states of a frame buffer in the ring.
+#define	SLOT_FREE	0
+#define	SLOT_READ	1
+#define	SLOT_BUSY	2
+#define	SLOT_DONE	3
+
+typedef struct _EFFECT {
+	const char	*name;
+	char		**params;	// "param=value" strings
+	unsigned int	nparams;
+} EFFECT;
+
+typedef struct _STREAM {
+	int				infd;
+	int				outfd;
+	size_t			width;
+	size_t			height;
+	size_t			framesize;	// In bytes, all planes together
+	size_t			planesize[3];
+	unsigned int	xshift;
+	unsigned int	yshift;
+	int				model;
+	int				y4m;
+	int				matrix;
+	int				full;
+	char			header[1024];	// The YUV4MPEG2 stream header
+	const unsigned char	*map;	// The input, if mapped,
+	size_t			mapsize;	// its size,
+	size_t			mapoffset;	// and where the next frame is.
+	int				splice;		// Hand the output to a pipe?
+	unsigned int	lag;		// How many frames it may hold.
+} STREAM;
+
+typedef struct _RING {
+	pthread_mutex_t	lock;
+	pthread_cond_t	changed;
+	unsigned char	**buffers;
+	const unsigned char	**sources;	// Where each frame comes from
+	unsigned char	*state;
+	unsigned int	slots;
+	size_t			nextread;	// The next frame to read,
+	size_t			nextwork;	// to process,
+	size_t			nextwrite;	// and to write.
+	size_t			frames;		// All of them, once known.
+	int				eof;
+	int				failed;
+} RING;
+
+static STREAM stream;
+static RING ring;
+static EFFECT *effects;
+static unsigned int neffects;
+static FRELIBA_STATS *totals;	// With -S
+
+static void fail(const char *msg) {
+	fprintf(stderr, "freliba-apply: %s\n", msg);
+	exit(1);
+}
+
+// Each worker keeps its own statistics, and only adds them to
+// the totals when it is done.
+static FRELIBA_STATS * workerstats(void) {
+	FRELIBA_STATS *stats;
+
+	if (totals == NULL) return NULL;
+	if ((stats = calloc(1, sizeof(FRELIBA_STATS))) == NULL) fail("Out of memory");
+	return stats;
+}
+
+static void addstats(FRELIBA_STATS *stats, pthread_mutex_t *lock) {
+	if (stats != NULL) {
+		pthread_mutex_lock(lock);
+		FRELIBA_MergeStats(totals, stats);
+		pthread_mutex_unlock(lock);
+		free(stats);
+	}
+}
+
+static int writestats(const char *path) {
+	size_t size = FRELIBA_StatsReport(totals, NULL, 0) + 1;
+	char *text;
+	FILE *f;
+	int result;
+
+	if ((text = malloc(size)) == NULL) fail("Out of memory");
+	FRELIBA_StatsReport(totals, text, size);
+
+	if ((f = fopen(path, "w")) == NULL) result = -1;
+	else {
+		result	= ((fputs(text, f) < 0) || (fputc('\n', f) < 0)) ? -1 : 0;
+		if (fclose(f) != 0) result = -1;
+	}
+
+	if (result < 0) fprintf(stderr, "freliba-apply: %s: %s\n", path, strerror(errno));
+	free(text);
+	return result;
+}
+
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Returns the number of bytes read, which is only less than
+// size at the end of the input.
+static size_t readfull(int fd, unsigned char *buffer, size_t size) {
+	size_t done = 0;
+	ssize_t n;
+
+	while (done < size) {
+		n	= read(fd, buffer + done, size - done);
+		if (n == 0) break;
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			break;
+		}
+		done	+= (size_t)n;
+	}
+
+	return done;
+}
+
+static int writefull(int fd, const unsigned char *buffer, size_t size) {
+	ssize_t n;
+
+	while (size) {
+		n	= write(fd, buffer, size);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		buffer	+= n;
+		size	-= (size_t)n;
+	}
+
+	return 0;
+}
+
+// Reads one line (the YUV4MPEG2 headers are lines) into line,
+// without the newline. Returns -1 at the end of the input.
+static int readline(int fd, char *line, size_t size) {
+	size_t i = 0;
+	char c;
+
+	for (;;) {
+		if (readfull(fd, (unsigned char *)&c, 1) != 1) return -1;
+		if (c == '\n') break;
+		if (i < size - 1) line[i++] = c;
+	}
+
+	line[i] = '\0';
+	return 0;
+}
+
+static void parsey4m(STREAM *s) {
+	char *token;
+	char copy[sizeof(s->header)];
+
+	if ((readline(s->infd, s->header, sizeof(s->header)) < 0) ||
+		(strncmp(s->header, "YUV4MPEG2 ", 10) != 0))
+		fail("The input is not YUV4MPEG2");
+
+	s->xshift	= 1;
+	s->yshift	= 1;
+	s->full		= 0;
+
+	strcpy(copy, s->header);
+	for (token = strtok(copy + 10, " "); token != NULL; token = strtok(NULL, " ")) switch (*token) {
+		case 'W':
+			s->width	= (size_t)strtoul(token + 1, NULL, 10);
+			break;
+		case 'H':
+			s->height	= (size_t)strtoul(token + 1, NULL, 10);
+			break;
+		case 'C':
+			if (strncmp(token, "C420", 4) == 0) s->yshift = 1, s->xshift = 1;
+			else if (strcmp(token, "C422") == 0) s->yshift = 0, s->xshift = 1;
+			else if (strcmp(token, "C444") == 0) s->yshift = 0, s->xshift = 0;
+			else fail("Only 4:2:0, 4:2:2 and 4:4:4 YUV4MPEG2 is supported");
+			break;
+		case 'X':
+			if (strcmp(token, "XCOLORRANGE=FULL") == 0) s->full = 1;
+			break;
+	}
+
+	if ((s->width == 0) || (s->height == 0)) fail("The YUV4MPEG2 header has no size");
+
+	s->planesize[0]	= s->width * s->height;
+	s->planesize[1]	= ((s->width + (1 << s->xshift) - 1) >> s->xshift) * ((s->height + (1 << s->yshift) - 1) >> s->yshift);
+	s->planesize[2]	= s->planesize[1];
+	s->framesize	= s->planesize[0] + s->planesize[1] + s->planesize[2];
+}
+
+// Finds the next frame, or reads it into buffer. Either way,
+// source is where it is. Returns 0 at the end.
+static int readframe(STREAM *s, unsigned char *buffer, const unsigned char **source) {
+	const unsigned char *eol;
+	char line[256];
+
+	if (s->map != NULL) {
+		if (s->y4m) {
+			if ((eol = memchr(s->map + s->mapoffset, '\n', s->mapsize - s->mapoffset)) == NULL) return 0;
+			s->mapoffset	= (size_t)(eol - s->map) + 1;
+		}
+		if (s->mapsize - s->mapoffset < s->framesize) return 0;
+
+		*source			= s->map + s->mapoffset;
+		s->mapoffset	+= s->framesize;
+		return 1;
+	}
+
+	*source	= buffer;
+	if ((s->y4m) && (readline(s->infd, line, sizeof(line)) < 0)) return 0;
+	return readfull(s->infd, buffer, s->framesize) == s->framesize;
+}
+
+#ifdef	__linux__
+static int splicefull(int fd, const unsigned char *buffer, size_t size) {
+	struct iovec iov;
+	ssize_t n;
+
+	iov.iov_base	= (void *)buffer;
+	iov.iov_len		= size;
+
+	while (iov.iov_len) {
+		n	= vmsplice(fd, &iov, 1, 0);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		iov.iov_base	= (char *)iov.iov_base + n;
+		iov.iov_len		-= (size_t)n;
+	}
+
+	return 0;
+}
+#endif
+
+static int writeframe(STREAM *s, const unsigned char *buffer) {
+	static const unsigned char frame[] = "FRAME\n";
+
+#ifdef	__linux__
+	if (s->splice) {
+		if ((s->y4m) && (splicefull(s->outfd, frame, 6) < 0)) return -1;
+		return splicefull(s->outfd, buffer, s->framesize);
+	}
+#endif
+
+	if ((s->y4m) && (writefull(s->outfd, frame, 6) < 0)) return -1;
+	return writefull(s->outfd, buffer, s->framesize);
+}
+
+// Maps the input to memory if it is a regular file, past
+// whatever we have already read of it (the YUV4MPEG2 header).
+static void mapinput(STREAM *s) {
+	struct stat st;
+	off_t offset;
+	void *map;
+
+	if ((fstat(s->infd, &st) < 0) || (!S_ISREG(st.st_mode)) || (st.st_size == 0) ||
+		((offset = lseek(s->infd, 0, SEEK_CUR)) < 0)) return;
+
+	if ((map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, s->infd, 0)) == MAP_FAILED) return;
+
+#ifdef	MADV_SEQUENTIAL
+	madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+#endif
+
+	s->map			= (const unsigned char *)map;
+	s->mapsize		= (size_t)st.st_size;
+	s->mapoffset	= (size_t)offset;
+}
+
+// Decides whether we can vmsplice the output, and if so, how
+// many frames the pipe may still hold after we have written a
+// frame. Until those are written, too, the frame's buffer must
+// stay as it is, since the pipe refers to it rather than copies it.
+static void spliceoutput(STREAM *s) {
+#ifdef	__linux__
+	struct stat st;
+	int size;
+
+	if ((fstat(s->outfd, &st) < 0) || (!S_ISFIFO(st.st_mode))) return;
+
+	fcntl(s->outfd, F_SETPIPE_SZ, (int)((s->framesize < 0x100000) ? s->framesize : 0x100000));
+	if ((size = fcntl(s->outfd, F_GETPIPE_SZ)) <= 0) return;
+
+	s->lag		= (unsigned int)((size_t)size / s->framesize) + 2;
+	s->splice	= 1;
+#endif
+}
+
+static int setparam(FRELIBA *fx, const char *name, const char *setting) {
+	if (FRELIBA_ParseParam(fx, setting) == 0) return 0;
+
+	fprintf(stderr, "freliba-apply: %s: Cannot make sense of %s\n", name, setting);
+	return -1;
+}
+
+// Every worker has its own instances of the effects.
+static FRELIBA ** createchain(void) {
+	FRELIBA **chain;
+	unsigned int e, p;
+
+	if ((chain = calloc(neffects, sizeof(FRELIBA *))) == NULL) fail("Out of memory");
+
+	for (e = 0; e < neffects; e++) {
+		if ((chain[e] = FRELIBA_CreateModel(effects[e].name, stream.model)) == NULL) {
+			fprintf(stderr, "freliba-apply: No effect called %s\n", effects[e].name);
+			exit(1);
+		}
+
+		for (p = 0; p < effects[e].nparams; p++)
+			if (setparam(chain[e], effects[e].name, effects[e].params[p]) < 0) exit(1);
+
+		FRELIBA_Prepare(chain[e]);
+	}
+
+	return chain;
+}
+
+// The number of the frame (or image) is its time, so the effects
+// that change from one frame to the next can tell them apart.
+static void settime(FRELIBA **chain, size_t frame) {
+	unsigned int e;
+
+	for (e = 0; e < neffects; e++) FRELIBA_SetTime(chain[e], (double)frame);
+}
+
+// Returns the name of the first effect that changes from one frame
+// to the next, or NULL if none does. Such an effect has to see all
+// the frames in order, so it cannot be shared among the workers.
+static const char * timedeffect(void) {
+	FRELIBA **chain = createchain();
+	const char *name = NULL;
+	unsigned int e;
+
+	for (e = 0; e < neffects; e++) {
+		if ((name == NULL) && (FRELIBA_Timed(chain[e]))) name = effects[e].name;
+		FRELIBA_Destroy(chain[e]);
+	}
+	free(chain);
+	return name;
+}
+
+// Applies the chain to the frame at source, leaving the result in
+// buffer. Unless the frame was mapped, they are one and the same.
+static void process(FRELIBA **chain, FRELIBA_STATS *stats, const unsigned char *source, unsigned char *buffer) {
+	const void *planes[3];
+	void *outplanes[3];
+	ptrdiff_t strides[3];
+
+	if (stream.y4m) {
+		planes[0]	= source;
+		planes[1]	= source + stream.planesize[0];
+		planes[2]	= source + stream.planesize[0] + stream.planesize[1];
+		outplanes[0]	= buffer;
+		outplanes[1]	= buffer + stream.planesize[0];
+		outplanes[2]	= buffer + stream.planesize[0] + stream.planesize[1];
+		strides[0]	= (ptrdiff_t)stream.width;
+		strides[1]	= strides[2] = (ptrdiff_t)((stream.width + (1 << stream.xshift) - 1) >> stream.xshift);
+
+		FRELIBA_ApplyYuvChain(chain, neffects, planes, strides, outplanes, strides, stream.width, stream.height, stream.matrix, (int)stream.xshift, (int)stream.yshift, stream.full);
+	}
+	else FRELIBA_ApplyChainStats(chain, neffects, stats, source, 0, buffer, 0, stream.width, stream.height);
+}
+
+static void * reader(void *unused) {
+	const unsigned char *source = NULL;
+	unsigned char *buffer;
+	size_t frame;
+	int got;
+
+	for (;;) {
+		pthread_mutex_lock(&ring.lock);
+		frame	= ring.nextread;
+		while ((ring.state[frame % ring.slots] != SLOT_FREE) && (!ring.failed))
+			pthread_cond_wait(&ring.changed, &ring.lock);
+		buffer	= ring.buffers[frame % ring.slots];
+		pthread_mutex_unlock(&ring.lock);
+
+		// Nobody else touches a free slot, so we can read
+		// into it without holding the lock.
+		got		= (ring.failed) ? 0 : readframe(&stream, buffer, &source);
+
+		pthread_mutex_lock(&ring.lock);
+		if (got) {
+			ring.sources[frame % ring.slots]	= source;
+			ring.state[frame % ring.slots]	= SLOT_READ;
+			ring.nextread++;
+		}
+		else {
+			ring.frames	= ring.nextread;
+			ring.eof	= 1;
+		}
+		pthread_cond_broadcast(&ring.changed);
+		pthread_mutex_unlock(&ring.lock);
+
+		if (!got) return NULL;
+	}
+}
+
+static void * worker(void *unused) {
+	FRELIBA **chain = createchain();
+	FRELIBA_STATS *stats = workerstats();
+	const unsigned char *source;
+	unsigned char *buffer;
+	size_t frame;
+	unsigned int e;
+
+	for (;;) {
+		pthread_mutex_lock(&ring.lock);
+		while ((!ring.failed) && (!(ring.eof && (ring.nextwork == ring.frames))) &&
+			((ring.nextwork == ring.nextread) || (ring.state[ring.nextwork % ring.slots] != SLOT_READ)))
+			pthread_cond_wait(&ring.changed, &ring.lock);
+
+		if ((ring.failed) || (ring.eof && (ring.nextwork == ring.frames))) {
+			pthread_mutex_unlock(&ring.lock);
+			break;
+		}
+
+		frame	= ring.nextwork++;
+		ring.state[frame % ring.slots]	= SLOT_BUSY;
+		buffer	= ring.buffers[frame % ring.slots];
+		source	= ring.sources[frame % ring.slots];
+		pthread_mutex_unlock(&ring.lock);
+
+		settime(chain, frame);
+		process(chain, stats, source, buffer);
+
+		pthread_mutex_lock(&ring.lock);
+		ring.state[frame % ring.slots]	= SLOT_DONE;
+		pthread_cond_broadcast(&ring.changed);
+		pthread_mutex_unlock(&ring.lock);
+	}
+
+	addstats(stats, &ring.lock);
+	for (e = 0; e < neffects; e++) FRELIBA_Destroy(chain[e]);
+	free(chain);
+	return NULL;
+}
+
+static void * writer(void *unused) {
+	unsigned char *buffer;
+	size_t frame;
+
+	for (;;) {
+		pthread_mutex_lock(&ring.lock);
+		frame	= ring.nextwrite;
+		while ((!ring.failed) && (!(ring.eof && (frame == ring.frames))) && (ring.state[frame % ring.slots] != SLOT_DONE))
+			pthread_cond_wait(&ring.changed, &ring.lock);
+
+		if ((ring.failed) || (ring.eof && (frame == ring.frames))) {
+			pthread_mutex_unlock(&ring.lock);
+			return NULL;
+		}
+
+		buffer	= ring.buffers[frame % ring.slots];
+		pthread_mutex_unlock(&ring.lock);
+
+		if (writeframe(&stream, buffer) < 0) {
+			fprintf(stderr, "freliba-apply: Write error: %s\n", strerror(errno));
+			pthread_mutex_lock(&ring.lock);
+			ring.failed	= 1;
+		}
+		else {
+			// A spliced frame is free once enough frames
+			// after it have been, too.
+			pthread_mutex_lock(&ring.lock);
+			if (!stream.splice) ring.state[frame % ring.slots] = SLOT_FREE;
+			else if (frame >= stream.lag) ring.state[(frame - stream.lag) % ring.slots] = SLOT_FREE;
+			ring.nextwrite++;
+		}
+		pthread_cond_broadcast(&ring.changed);
+		pthread_mutex_unlock(&ring.lock);
+	}
+}
+
+// The batch mode: instead of a stream, a directory (or a glob) of
+// still images, each graded by whichever worker gets to it first,
+// and written under the same name to another directory.
+#define	IMAGE_PPM	0
+#define	IMAGE_PAM	1
+#define	IMAGE_TGA	2
+
+typedef struct _IMAGE {
+	size_t	width;
+	size_t	height;
+	int		format;
+	int		alpha;
+} IMAGE;
+
+typedef struct _BATCH {
+	pthread_mutex_t	lock;
+	char			**files;
+	size_t			nfiles;
+	size_t			nextfile;
+	size_t			done;
+	size_t			bytes;
+	const char		*outdir;
+	int				failed;
+} BATCH;
+
+static BATCH batch;
+
+static int hasextension(const char *name, const char *ext) {
+	const char *dot = strrchr(name, '.');
+
+	return (dot != NULL) && (strcasecmp(dot, ext) == 0);
+}
+
+// Skips white space and comments in a PNM header, then reads a number.
+static size_t pnmnumber(const unsigned char *data, size_t size, size_t *pos) {
+	size_t n = 0;
+
+	while (*pos < size) {
+		if (data[*pos] == '#') while ((*pos < size) && (data[*pos] != '\n')) (*pos)++;
+		else if (isspace(data[*pos])) (*pos)++;
+		else break;
+	}
+
+	while ((*pos < size) && (isdigit(data[*pos]))) n = n * 10 + (data[(*pos)++] - '0');
+	return n;
+}
+
+// Decodes the image into a new RGBA buffer, or returns NULL.
+static unsigned char * decodeimage(const char *name, const unsigned char *data, size_t size, IMAGE *img) {
+	unsigned char *rgba, *p;
+	const unsigned char *end = data + size;
+	char key[16];
+	size_t pos = 2, depth = 0, maxval = 0, x, y, count, row;
+	int rle = 0, topdown = 0, repeat = 0;
+
+	memset(img, 0, sizeof(IMAGE));
+
+	if ((size > 2) && (data[0] == 'P') && (data[1] == '6')) {
+		img->format	= IMAGE_PPM;
+		img->width	= pnmnumber(data, size, &pos);
+		img->height	= pnmnumber(data, size, &pos);
+		maxval		= pnmnumber(data, size, &pos);
+		pos++;	// The single white space before the pixels
+		depth		= 3;
+	}
+	else if ((size > 2) && (data[0] == 'P') && (data[1] == '7')) {
+		img->format	= IMAGE_PAM;
+
+		while (pos < size) {
+			while ((pos < size) && (isspace(data[pos]))) pos++;
+			if (data[pos] == '#') {
+				while ((pos < size) && (data[pos] != '\n')) pos++;
+				continue;
+			}
+			for (x = 0; (pos < size) && (!isspace(data[pos])) && (x < sizeof(key) - 1); x++) key[x] = data[pos++];
+			key[x] = '\0';
+
+			if (strcmp(key, "ENDHDR") == 0) {
+				while ((pos < size) && (data[pos] != '\n')) pos++;
+				pos++;
+				break;
+			}
+			else if (strcmp(key, "WIDTH") == 0) img->width = pnmnumber(data, size, &pos);
+			else if (strcmp(key, "HEIGHT") == 0) img->height = pnmnumber(data, size, &pos);
+			else if (strcmp(key, "DEPTH") == 0) depth = pnmnumber(data, size, &pos);
+			else if (strcmp(key, "MAXVAL") == 0) maxval = pnmnumber(data, size, &pos);
+			else while ((pos < size) && (data[pos] != '\n')) pos++;	// TUPLTYPE and such
+		}
+
+		img->alpha	= (depth == 4);
+		if ((depth != 3) && (depth != 4)) maxval = 0;
+	}
+	else if ((size > 18) && (hasextension(name, ".tga")) && (data[1] == 0) && ((data[2] == 2) || (data[2] == 10)) &&
+		((data[16] == 24) || (data[16] == 32))) {
+		img->format	= IMAGE_TGA;
+		img->width	= data[12] | (data[13] << 8);
+		img->height	= data[14] | (data[15] << 8);
+		img->alpha	= (data[16] == 32);
+		depth		= data[16] / 8;
+		maxval		= 255;
+		pos			= 18 + data[0];
+		rle			= (data[2] == 10);
+		topdown		= (data[17] & 0x20) != 0;
+	}
+	else {
+		fprintf(stderr, "freliba-apply: %s: Not a PPM, PAM, or TGA file we can read\n", name);
+		return NULL;
+	}
+
+	if (maxval != 255) {
+		fprintf(stderr, "freliba-apply: %s: Only 8-bit RGB or RGBA is supported\n", name);
+		return NULL;
+	}
+
+	if ((img->width == 0) || (img->height == 0) || (pos > size) ||
+		((img->format != IMAGE_TGA) && ((size - pos) / depth / img->width < img->height))) {
+		fprintf(stderr, "freliba-apply: %s: Bad or truncated image\n", name);
+		return NULL;
+	}
+
+	if ((rgba = malloc(img->width * img->height * 4)) == NULL) {
+		fprintf(stderr, "freliba-apply: %s: Out of memory\n", name);
+		return NULL;
+	}
+
+	data	+= pos;
+
+	if (img->format != IMAGE_TGA) {
+		for (p = rgba, count = img->width * img->height; count; count--, p += 4, data += depth) {
+			p[0]	= data[0];
+			p[1]	= data[1];
+			p[2]	= data[2];
+			p[3]	= (depth == 4) ? data[3] : 255;
+		}
+		return rgba;
+	}
+
+	// A TGA is BGR(A), may be run-length encoded, and unless
+	// it says otherwise, starts at the bottom.
+	count	= 0;
+
+	for (y = 0; y < img->height; y++) {
+		row	= (topdown) ? y : img->height - 1 - y;
+		p	= rgba + row * img->width * 4;
+
+		for (x = 0; x < img->width; x++, p += 4) {
+			if (rle && (count == 0)) {
+				if (data >= end) break;
+				repeat	= *data & 0x80;
+				count	= (*data++ & 0x7F) + 1;
+			}
+
+			if (data + depth > end) break;
+
+			p[0]	= data[2];
+			p[1]	= data[1];
+			p[2]	= data[0];
+			p[3]	= (depth == 4) ? data[3] : 255;
+
+			// A repeated pixel stays put until its run is over.
+			if (!rle) data += depth;
+			else if ((--count == 0) || (!repeat)) data += depth;
+		}
+
+		if (x < img->width) {
+			fprintf(stderr, "freliba-apply: %s: Truncated image\n", name);
+			free(rgba);
+			return NULL;
+		}
+	}
+
+	return rgba;
+}
+
+// Encodes the RGBA pixels in the format (and with or without
+// the alpha) of the original, and writes them to fd.
+static int encodeimage(int fd, const unsigned char *rgba, const IMAGE *img) {
+	unsigned char *file, *p;
+	const unsigned char *q;
+	const size_t depth = (img->alpha) ? 4 : 3;
+	size_t header, x, y;
+	int result;
+
+	if ((file = malloc(128 + img->width * img->height * depth)) == NULL) return -1;
+
+	switch (img->format) {
+		case IMAGE_PPM:
+			header	= (size_t)sprintf((char *)file, "P6\n%zu %zu\n255\n", img->width, img->height);
+			break;
+		case IMAGE_PAM:
+			header	= (size_t)sprintf((char *)file, "P7\nWIDTH %zu\nHEIGHT %zu\nDEPTH %zu\nMAXVAL 255\nTUPLTYPE %s\nENDHDR\n",
+				img->width, img->height, depth, (img->alpha) ? "RGB_ALPHA" : "RGB");
+			break;
+		default:
+			// Uncompressed, top down.
+			memset(file, 0, 18);
+			file[2]		= 2;
+			file[12]	= (unsigned char)img->width;
+			file[13]	= (unsigned char)(img->width >> 8);
+			file[14]	= (unsigned char)img->height;
+			file[15]	= (unsigned char)(img->height >> 8);
+			file[16]	= (unsigned char)(depth * 8);
+			file[17]	= 0x20 | ((img->alpha) ? 8 : 0);
+			header		= 18;
+			break;
+	}
+
+	for (p = file + header, q = rgba, y = 0; y < img->height; y++) for (x = 0; x < img->width; x++, q += 4, p += depth) {
+		p[0]	= (img->format == IMAGE_TGA) ? q[2] : q[0];
+		p[1]	= q[1];
+		p[2]	= (img->format == IMAGE_TGA) ? q[0] : q[2];
+		if (img->alpha) p[3] = q[3];
+	}
+
+	result	= writefull(fd, file, (size_t)(p - file));
+	free(file);
+	return result;
+}
+
+// Grades one file. Returns its size, or -1 if it did not work out.
+static long long gradefile(FRELIBA **chain, FRELIBA_STATS *stats, const char *name) {
+	IMAGE img;
+	struct stat st;
+	char *outname;
+	const char *base;
+	unsigned char *rgba;
+	void *map;
+	int fd, result;
+
+	if ((fd = open(name, O_RDONLY)) < 0) {
+		fprintf(stderr, "freliba-apply: %s: %s\n", name, strerror(errno));
+		return -1;
+	}
+
+	if ((fstat(fd, &st) < 0) || (st.st_size == 0) ||
+		((map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)) {
+		fprintf(stderr, "freliba-apply: %s: Cannot map it\n", name);
+		close(fd);
+		return -1;
+	}
+
+	close(fd);
+
+#ifdef	MADV_SEQUENTIAL
+	madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+#endif
+
+	rgba	= decodeimage(name, (const unsigned char *)map, (size_t)st.st_size, &img);
+	munmap(map, (size_t)st.st_size);
+	if (rgba == NULL) return -1;
+
+	FRELIBA_ApplyChainStats(chain, neffects, stats, rgba, 0, rgba, 0, img.width, img.height);
+
+	base	= strrchr(name, '/');
+	base	= (base == NULL) ? name : base + 1;
+
+	if ((outname = malloc(strlen(batch.outdir) + strlen(base) + 2)) == NULL) {
+		free(rgba);
+		return -1;
+	}
+
+	sprintf(outname, "%s/%s", batch.outdir, base);
+
+	if ((fd = open(outname, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0) result = -1;
+	else {
+		result	= encodeimage(fd, rgba, &img);
+		if (close(fd) < 0) result = -1;
+	}
+
+	if (result < 0) fprintf(stderr, "freliba-apply: %s: %s\n", outname, strerror(errno));
+
+	free(outname);
+	free(rgba);
+	return (result < 0) ? -1 : (long long)st.st_size;
+}
+
+static void * batchworker(void *unused) {
+	FRELIBA **chain = createchain();
+	FRELIBA_STATS *stats = workerstats();
+	long long bytes;
+	size_t file;
+	unsigned int e;
+
+	for (;;) {
+		pthread_mutex_lock(&batch.lock);
+		file	= batch.nextfile++;
+		pthread_mutex_unlock(&batch.lock);
+
+		if (file >= batch.nfiles) break;
+
+		settime(chain, file);
+		bytes	= gradefile(chain, stats, batch.files[file]);
+
+		pthread_mutex_lock(&batch.lock);
+		if (bytes < 0) batch.failed++;
+		else {
+			batch.done++;
+			batch.bytes	+= (size_t)bytes;
+		}
+		pthread_mutex_unlock(&batch.lock);
+	}
+
+	addstats(stats, &batch.lock);
+	for (e = 0; e < neffects; e++) FRELIBA_Destroy(chain[e]);
+	free(chain);
+	return NULL;
+}
+
+// Grades every image the pattern matches (or, if it is a directory,
+// every PPM, PAM and TGA file in it) using the given number of workers.
+static int runbatch(const char *pattern, unsigned int workers, int quiet) {
+	pthread_t *threads;
+	glob_t found;
+	struct stat st;
+	char *dir;
+	double start, elapsed;
+	size_t i;
+	unsigned int w;
+	int isdir;
+
+	isdir	= (stat(pattern, &st) == 0) && (S_ISDIR(st.st_mode));
+
+	if (isdir) {
+		if ((dir = malloc(strlen(pattern) + 3)) == NULL) fail("Out of memory");
+		sprintf(dir, "%s/*", pattern);
+	}
+	else dir = (char *)pattern;
+
+	if (glob(dir, 0, NULL, &found) != 0) found.gl_pathc = 0;
+	if (isdir) free(dir);
+
+	if (((batch.files = calloc(found.gl_pathc + 1, sizeof(char *))) == NULL) ||
+		((threads = calloc(workers, sizeof(pthread_t))) == NULL))
+		fail("Out of memory");
+
+	for (i = 0; i < found.gl_pathc; i++) {
+		if ((stat(found.gl_pathv[i], &st) < 0) || (!S_ISREG(st.st_mode))) continue;
+		if ((isdir) && (!hasextension(found.gl_pathv[i], ".ppm")) && (!hasextension(found.gl_pathv[i], ".pnm")) &&
+			(!hasextension(found.gl_pathv[i], ".pam")) && (!hasextension(found.gl_pathv[i], ".tga"))) continue;
+		batch.files[batch.nfiles++]	= found.gl_pathv[i];
+	}
+
+	if (batch.nfiles == 0) fail("No images to grade");
+	if (workers > batch.nfiles) workers = (unsigned int)batch.nfiles;
+
+	pthread_mutex_init(&batch.lock, NULL);
+
+	start	= now();
+	for (w = 0; w < workers; w++) pthread_create(&threads[w], NULL, batchworker, NULL);
+	for (w = 0; w < workers; w++) pthread_join(threads[w], NULL);
+	elapsed	= now() - start;
+
+	if (!quiet) fprintf(stderr, "freliba-apply: %zu of %zu images in %.3f s, %.1f images/s, %.1f MB/s\n",
+		batch.done, batch.nfiles, elapsed, (double)batch.done / elapsed, (double)batch.bytes / elapsed / 1e6);
+
+	globfree(&found);
+	free(batch.files);
+	free(threads);
+	return batch.failed != 0;
+}
+
+static void usage(void) {
+	fprintf(stderr,
+		"Usage: freliba-apply [-i in] [-o out] [-s WxH | -y [-M 601|709|2020]] [-B] [-j workers] [-b frames] [-c] [-q] [-S file] effect[:param=value...] ...\n"
+		"       freliba-apply -g images -O dir [-j workers] [-q] [-S file] effect[:param=value...] ...\n"
+		"With an effect that changes over time (e.g., autobalance), -j is always 1.\n");
+	exit(2);
+}
+
+int main(int argc, char *argv[]) {
+	pthread_t readthread, writethread, *workthreads;
+	const char *input = NULL, *output = NULL, *images = NULL, *outdir = NULL, *statsfile = NULL, *timed;
+	unsigned int workers = 0, slots = 0, i;
+	int opt, quiet = 0, copy = 0;
+	char *arg, *colon;
+	double start, elapsed;
+	long cpus;
+
+	stream.model	= FRELIBA_MODEL_RGBA8888;
+	stream.matrix	= FRELIBA_YUV709;
+
+	while ((opt = getopt(argc, argv, "i:o:s:yM:Bj:b:cg:O:qS:")) != -1) switch (opt) {
+		case 'i':
+			input	= optarg;
+			break;
+		case 'o':
+			output	= optarg;
+			break;
+		case 's':
+			if (sscanf(optarg, "%zux%zu", &stream.width, &stream.height) != 2) usage();
+			break;
+		case 'y':
+			stream.y4m	= 1;
+			break;
+		case 'M':
+			if (strcmp(optarg, "601") == 0) stream.matrix = FRELIBA_YUV601;
+			else if (strcmp(optarg, "709") == 0) stream.matrix = FRELIBA_YUV709;
+			else if (strcmp(optarg, "2020") == 0) stream.matrix = FRELIBA_YUV2020;
+			else usage();
+			break;
+		case 'B':
+			stream.model	= FRELIBA_MODEL_BGRA8888;
+			break;
+		case 'j':
+			workers	= (unsigned int)atoi(optarg);
+			break;
+		case 'b':
+			slots	= (unsigned int)atoi(optarg);
+			break;
+		case 'c':
+			copy	= 1;
+			break;
+		case 'g':
+			images	= optarg;
+			break;
+		case 'O':
+			outdir	= optarg;
+			break;
+		case 'q':
+			quiet	= 1;
+			break;
+		case 'S':
+			statsfile	= optarg;
+			break;
+		default:
+			usage();
+	}
+
+	if (optind >= argc) usage();
+
+	// Split each effect into its name and its settings.
+	neffects	= (unsigned int)(argc - optind);
+	if ((effects = calloc(neffects, sizeof(EFFECT))) == NULL) fail("Out of memory");
+
+	for (i = 0; i < neffects; i++) {
+		arg	= argv[optind + i];
+		effects[i].name	= arg;
+		if ((effects[i].params = calloc(strlen(arg) + 1, sizeof(char *))) == NULL) fail("Out of memory");
+
+		for (colon = strchr(arg, ':'); colon != NULL; colon = strchr(colon + 1, ':')) {
+			*colon	= '\0';
+			effects[i].params[effects[i].nparams++]	= colon + 1;
+		}
+	}
+
+	if (statsfile != NULL) {
+		if ((stream.y4m) && (images == NULL)) fail("Statistics (-S) need RGBA frames, not YUV4MPEG2");
+		if ((totals = calloc(1, sizeof(FRELIBA_STATS))) == NULL) fail("Out of memory");
+	}
+
+	if (workers == 0) {
+		cpus	= sysconf(_SC_NPROCESSORS_ONLN);
+		workers	= (cpus > 0) ? (unsigned int)cpus : 1;
+	}
+
+	if ((workers > 1) && ((timed = timedeffect()) != NULL)) {
+		if (!quiet) fprintf(stderr, "freliba-apply: %s changes from frame to frame, so one worker grades them all, in order\n", timed);
+		workers	= 1;
+	}
+
+	if (images != NULL) {
+		if (outdir == NULL) fail("Where do the graded images go (-O dir)?");
+		batch.outdir	= outdir;
+		stream.model	= FRELIBA_MODEL_RGBA8888;
+		i	= (unsigned int)runbatch(images, workers, quiet);
+		return ((statsfile != NULL) && (writestats(statsfile) < 0)) ? 1 : (int)i;
+	}
+
+	if ((stream.infd = (input == NULL) ? 0 : open(input, O_RDONLY)) < 0) {
+		fprintf(stderr, "freliba-apply: %s: %s\n", input, strerror(errno));
+		return 1;
+	}
+
+	if ((stream.outfd = (output == NULL) ? 1 : open(output, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0) {
+		fprintf(stderr, "freliba-apply: %s: %s\n", output, strerror(errno));
+		return 1;
+	}
+
+	if (stream.y4m) {
+		parsey4m(&stream);
+		if ((writefull(stream.outfd, (const unsigned char *)stream.header, strlen(stream.header)) < 0) ||
+			(writefull(stream.outfd, (const unsigned char *)"\n", 1) < 0))
+			fail("Cannot write the YUV4MPEG2 header");
+	}
+	else {
+		if ((stream.width == 0) || (stream.height == 0)) fail("Raw frames need their size (-s WxH)");
+		stream.framesize	= stream.width * stream.height * 4;
+	}
+
+	// Find out if the effects make sense before starting any threads.
+	// Only the effects with a single FLUT can do YUV.
+	{
+		FRELIBA **chain = createchain();
+		unsigned char pixel[4] = {0};
+		const void *planes[3] = {pixel, pixel, pixel};
+		void *outplanes[3] = {pixel, pixel, pixel};
+		ptrdiff_t strides[3] = {1, 1, 1};
+
+		for (i = 0; i < neffects; i++) {
+			if ((stream.y4m) && (FRELIBA_ApplyYuv(chain[i], planes, strides, outplanes, strides, 0, 0, stream.matrix, 0, 0, 0) < 0)) {
+				fprintf(stderr, "freliba-apply: %s cannot work with YUV\n", effects[i].name);
+				return 1;
+			}
+			FRELIBA_Destroy(chain[i]);
+		}
+		free(chain);
+	}
+
+	if (!copy) {
+		mapinput(&stream);
+		spliceoutput(&stream);
+	}
+
+	if (slots < workers + 2) slots = (slots) ? workers + 2 : 2 * workers + 2;
+	slots	+= stream.lag;
+
+	ring.slots	= slots;
+	if (((ring.buffers = calloc(slots, sizeof(unsigned char *))) == NULL) ||
+		((ring.sources = calloc(slots, sizeof(const unsigned char *))) == NULL) ||
+		((ring.state = calloc(slots, 1)) == NULL) ||
+		((workthreads = calloc(workers, sizeof(pthread_t))) == NULL))
+		fail("Out of memory");
+
+	for (i = 0; i < slots; i++)
+		if (posix_memalign((void **)&ring.buffers[i], 4096, (stream.framesize + 4095) & ~(size_t)4095) != 0) fail("Out of memory");
+
+	pthread_mutex_init(&ring.lock, NULL);
+	pthread_cond_init(&ring.changed, NULL);
+
+	start	= now();
+
+	pthread_create(&readthread, NULL, reader, NULL);
+	pthread_create(&writethread, NULL, writer, NULL);
+	for (i = 0; i < workers; i++) pthread_create(&workthreads[i], NULL, worker, NULL);
+
+	pthread_join(readthread, NULL);
+	for (i = 0; i < workers; i++) pthread_join(workthreads[i], NULL);
+	pthread_join(writethread, NULL);
+
+	elapsed	= now() - start;
+
+	if (!quiet) fprintf(stderr, "freliba-apply: %zu frames in %.3f s, %.1f frames/s, %.1f MB/s (%s in, %s out)\n",
+		ring.nextwrite, elapsed, (double)ring.nextwrite / elapsed, (double)ring.nextwrite * stream.framesize / elapsed / 1e6,
+		(stream.map != NULL) ? "mmap" : "read", (stream.splice) ? "vmsplice" : "write");
+
+	// The pipe may still refer to the last frames we spliced, so
+	// we leave their buffers alone. Since the buffers are whole
+	// pages, nothing else shares those pages with them, either.
+	if (!stream.splice) for (i = 0; i < slots; i++) free(ring.buffers[i]);
+	free(ring.buffers);
+	free(ring.sources);
+	free(ring.state);
+	if (stream.map != NULL) munmap((void *)stream.map, stream.mapsize);
+	free(workthreads);
+
+	if ((statsfile != NULL) && (writestats(statsfile) < 0)) return 1;
+	return ring.failed;
+}
@@ -0,0 +1,517 @@
+/*
+	freliba-bench.c
+
+	Copyright 2021 G. Adam Stanislav.
+	All rights reserved.
+
+	http://www.pantarheon.org
+
+	Measures the frei0r plug-ins the way a host uses them. Each
+	plug-in is loaded with dlopen and driven only through its
+	f0r_* functions, so it is the very .so file that gets timed,
+	whichever way it was built, and it needs no libfreliba.
+
+	Usage:
+
+		freliba-bench [options] [plugin.so...]
+
+	Options:
+
+		-s sizes	Which frame sizes, separated by commas, out of
+				720p, 1080p, 4k and 8k, or WxH (default: all four).
+		-i image	Also time the plug-ins on a binary PPM image,
+				stretched to each size (up to 8 times).
+		-t seconds	How long to keep timing each case (default 0.25).
+		-l label	A label for the results, e.g., the commit.
+
+	Without any plug-ins, it times every ./koliba_*.so.
+
+	Each plug-in is timed at its default settings, and again with
+	all of its numeric parameters at 0.5 and all of its switches
+	on, on a synthetic frame (smooth ramps with some noise, always
+	the same on any machine), and on each image. We report how many
+	megapixels a second it gets through, and where the processor
+	has a time stamp counter, how many of its cycles each pixel
+	takes. We also time how long it takes the plug-in to get ready
+	for a frame after its parameters change (the rebuild), on a
+	frame too small for its pixels to matter.
+
+	The results go to the standard output as JSON, along with what
+	machine they came from, so they can be compared across commits
+	and machines.
+
+	Build it with "make freliba-bench", or run "make bench".
+*/
+
+#include	<stdio.h>
+#include	<stdlib.h>
+#include	<string.h>
+#include	<stdint.h>
+#include	<time.h>
+#include	<dlfcn.h>
+#include	<glob.h>
+#include	<unistd.h>
+
+#if	defined(__x86_64__) || defined(__i386__)
+#include	<x86intrin.h>
+#define	cycles()	__rdtsc()
+#define	HAVETSC		1
+#else
+#define	cycles()	0ULL
+#define	HAVETSC		0
+#endif
+
+/* From frei0r.h, which may or may not be on your system */
+typedef struct f0r_plugin_info
+{
+  const char* name;
+  const char* author;
+  int plugin_type;
+  int color_model;
+  int frei0r_version;
+  int major_version;
+  int minor_version;
+  int num_params;
+  const char* explanation;
+} f0r_plugin_info_t;
+
+typedef struct f0r_param_info
+{
+  const char* name;
+  int type;
+  const char* explanation;
+} f0r_param_info_t;
+
+#define F0R_PLUGIN_TYPE_FILTER 0
+#define F0R_COLOR_MODEL_BGRA8888 0
+#define F0R_COLOR_MODEL_RGBA8888 1
+#define F0R_PARAM_BOOL      0
+#define F0R_PARAM_DOUBLE    1
+/* End of frei0r.h extract */
+
+#define	MAXSIZES	8
+#define	MAXIMAGES	8
+
+// How many times we change the parameters to time the rebuild,
+// and how big the frame is then.
+#define	REBUILDS	64
+#define	TINY		8
+
+typedef struct _PLUGIN {
+	void	*so;
+	int		(*init)(void);
+	void	(*deinit)(void);
+	void	(*get_plugin_info)(f0r_plugin_info_t *info);
+	void	(*get_param_info)(f0r_param_info_t *info, int param_index);
+	void *	(*construct)(unsigned int width, unsigned int height);
+	void	(*destruct)(void *instance);
+	void	(*set_param_value)(void *instance, void *param, int param_index);
+	void	(*get_param_value)(void *instance, void *param, int param_index);
+	void	(*update)(void *instance, double time, const uint32_t *inframe, uint32_t *outframe);
+	f0r_plugin_info_t	info;
+} PLUGIN;
+
+typedef struct _SIZE {
+	char			name[32];
+	unsigned int	width;
+	unsigned int	height;
+} SIZE;
+
+typedef struct _IMAGE {
+	const char		*name;
+	unsigned char	*rgb;
+	unsigned int	width;
+	unsigned int	height;
+} IMAGE;
+
+// The parameter sets: as constructed, and everything in the middle.
+#define	SETDEFAULT	0
+#define	SETMID		1
+
+static const char *setnames[] = {"default", "mid"};
+
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void fail(const char *msg) {
+	fprintf(stderr, "freliba-bench: %s\n", msg);
+	exit(1);
+}
+
+// Writes a string as JSON does.
+static void jsonstring(const char *s) {
+	putchar('"');
+	for (; (s != NULL) && (*s != '\0'); s++) {
+		if ((*s == '"') || (*s == '\\')) printf("\\%c", *s);
+		else if ((unsigned char)*s < ' ') printf("\\u%04x", (unsigned char)*s);
+		else putchar(*s);
+	}
+	putchar('"');
+}
+
+#define	SYMBOL(field, name)	\
+	if ((*(void **)&p->field = dlsym(p->so, name)) == NULL) {	\
+		fprintf(stderr, "freliba-bench: %s: No %s\n", path, name);	\
+		dlclose(p->so);	\
+		return -1;	\
+	}
+
+static int loadplugin(PLUGIN *p, const char *path) {
+	if ((p->so = dlopen(path, RTLD_NOW | RTLD_LOCAL)) == NULL) {
+		fprintf(stderr, "freliba-bench: %s\n", dlerror());
+		return -1;
+	}
+
+	SYMBOL(init, "f0r_init")
+	SYMBOL(deinit, "f0r_deinit")
+	SYMBOL(get_plugin_info, "f0r_get_plugin_info")
+	SYMBOL(get_param_info, "f0r_get_param_info")
+	SYMBOL(construct, "f0r_construct")
+	SYMBOL(destruct, "f0r_destruct")
+	SYMBOL(set_param_value, "f0r_set_param_value")
+	SYMBOL(get_param_value, "f0r_get_param_value")
+	SYMBOL(update, "f0r_update")
+
+	p->init();
+	p->get_plugin_info(&p->info);
+	return 0;
+}
+
+static void unloadplugin(PLUGIN *p) {
+	p->deinit();
+	dlclose(p->so);
+}
+
+// Puts the parameters of an instance to one of the sets. The
+// default set is whatever they were when it was constructed,
+// which the caller saved in defaults.
+static void setparams(const PLUGIN *p, void *instance, int set, const double *defaults) {
+	f0r_param_info_t pinfo;
+	double d;
+	int i;
+
+	for (i = 0; i < p->info.num_params; i++) {
+		p->get_param_info(&pinfo, i);
+		if ((pinfo.type != F0R_PARAM_BOOL) && (pinfo.type != F0R_PARAM_DOUBLE)) continue;
+		d	= (set == SETDEFAULT) ? defaults[i] : (pinfo.type == F0R_PARAM_BOOL) ? 1.0 : 0.5;
+		p->set_param_value(instance, &d, i);
+	}
+}
+
+static void getdefaults(const PLUGIN *p, void *instance, double *defaults) {
+	f0r_param_info_t pinfo;
+	int i;
+
+	for (i = 0; i < p->info.num_params; i++) {
+		defaults[i]	= 0.0;
+		p->get_param_info(&pinfo, i);
+		if ((pinfo.type == F0R_PARAM_BOOL) || (pinfo.type == F0R_PARAM_DOUBLE)) p->get_param_value(instance, &defaults[i], i);
+	}
+}
+
+// A frame that is the same everywhere: ramps of red across, of
+// green down, and of blue diagonally, with a little noise from a
+// generator of our own, so the frame does not depend on the C library.
+static void synthetic(unsigned char *frame, unsigned int width, unsigned int height) {
+	uint32_t seed = 2463534242u;
+	unsigned int x, y;
+
+	for (y = 0; y < height; y++) for (x = 0; x < width; x++, frame += 4) {
+		seed	^= seed << 13;
+		seed	^= seed >> 17;
+		seed	^= seed << 5;
+		frame[0]	= (unsigned char)((x * 255u / width + (seed & 15)) & 0xFF);
+		frame[1]	= (unsigned char)((y * 255u / height + ((seed >> 4) & 15)) & 0xFF);
+		frame[2]	= (unsigned char)(((x + y) * 255u / (width + height) + ((seed >> 8) & 15)) & 0xFF);
+		frame[3]	= 255;
+	}
+}
+
+// Stretches an image to the frame, nearest pixel.
+static void stretch(unsigned char *frame, unsigned int width, unsigned int height, const IMAGE *img) {
+	const unsigned char *p;
+	unsigned int x, y;
+
+	for (y = 0; y < height; y++) for (x = 0; x < width; x++, frame += 4) {
+		p	= img->rgb + 3 * ((size_t)(y * (unsigned long long)img->height / height) * img->width + (size_t)(x * (unsigned long long)img->width / width));
+		frame[0]	= p[0];
+		frame[1]	= p[1];
+		frame[2]	= p[2];
+		frame[3]	= 255;
+	}
+}
+
+// Reads a number from a PPM header, skipping any comments.
+static int ppmnumber(FILE *f, unsigned int *n) {
+	int c;
+
+	while (((c = fgetc(f)) == '#') || (c == ' ') || (c == '\t') || (c == '\r') || (c == '\n'))
+		if (c == '#') while (((c = fgetc(f)) != '\n') && (c != EOF));
+
+	if (c == EOF) return -1;
+	ungetc(c, f);
+	return (fscanf(f, "%u", n) == 1) ? 0 : -1;
+}
+
+// Reads a binary PPM with 8 bits per sample.
+static int readppm(IMAGE *img, const char *path) {
+	FILE *f;
+	unsigned int maxval;
+	size_t size;
+
+	if ((f = fopen(path, "rb")) == NULL) return -1;
+
+	if ((fgetc(f) != 'P') || (fgetc(f) != '6') || (ppmnumber(f, &img->width) < 0) || (ppmnumber(f, &img->height) < 0) ||
+		(ppmnumber(f, &maxval) < 0) || (maxval != 255) || (img->width == 0) || (img->height == 0) || (fgetc(f) == EOF)) {
+		fclose(f);
+		return -1;
+	}
+
+	size	= (size_t)img->width * img->height * 3;
+	if (((img->rgb = malloc(size)) == NULL) || (fread(img->rgb, 1, size, f) != size)) {
+		free(img->rgb);
+		fclose(f);
+		return -1;
+	}
+
+	fclose(f);
+	img->name	= path;
+	return 0;
+}
+
+static int parsesizes(SIZE *sizes, char *list) {
+	static const SIZE known[] = {
+		{"720p", 1280, 720},
+		{"1080p", 1920, 1080},
+		{"4k", 3840, 2160},
+		{"8k", 7680, 4320}
+	};
+	char *s, *save;
+	int n = 0;
+	unsigned int i;
+
+	for (s = strtok_r(list, ",", &save); (s != NULL) && (n < MAXSIZES); s = strtok_r(NULL, ",", &save)) {
+		for (i = 0; (i < sizeof(known) / sizeof(SIZE)) && (strcasecmp(known[i].name, s) != 0); i++);
+		if (i < sizeof(known) / sizeof(SIZE)) sizes[n] = known[i];
+		else if ((sscanf(s, "%ux%u", &sizes[n].width, &sizes[n].height) != 2) || (sizes[n].width == 0) || (sizes[n].height == 0)) return -1;
+		else snprintf(sizes[n].name, sizeof(sizes[n].name), "%ux%u", sizes[n].width, sizes[n].height);
+		n++;
+	}
+
+	return n;
+}
+
+// Times the plug-in on one frame for as long as we were told to.
+static void timeframes(const PLUGIN *p, void *instance, const unsigned char *in, unsigned char *out, const SIZE *size, double seconds) {
+	const double pixels = (double)size->width * size->height;
+	unsigned long long c;
+	double t, best = 1e30, f;
+	unsigned int frames = 0;
+
+	// The first frame builds whatever tables the plug-in needs,
+	// and brings the frame into the cache, as far as it fits.
+	p->update(instance, 0.0, (const uint32_t *)in, (uint32_t *)out);
+
+	c	= cycles();
+	t	= now();
+	do {
+		f	= now();
+		p->update(instance, (double)(frames + 1), (const uint32_t *)in, (uint32_t *)out);
+		f	= now() - f;
+		if (f < best) best = f;
+		frames++;
+	} while ((now() - t < seconds) || (frames < 3));
+	t	= now() - t;
+	c	= cycles() - c;
+
+	printf(", \"size\": ");
+	jsonstring(size->name);
+	printf(", \"width\": %u, \"height\": %u, \"frames\": %u, \"seconds\": %.6f, \"mpixels_per_second\": %.3f, \"best_mpixels_per_second\": %.3f, \"cycles_per_pixel\": ",
+		size->width, size->height, frames, t, pixels * frames / t / 1e6, pixels / best / 1e6);
+	if (HAVETSC) printf("%.3f", (double)c / (pixels * frames));
+	else printf("null");
+}
+
+// Times the rebuild: switches between the parameter sets and
+// has the plug-in process a tiny frame after each switch. We
+// report the median, which the odd interruption does not sway.
+static double rebuild(const PLUGIN *p, const double *defaults) {
+	uint32_t in[TINY * TINY], out[TINY * TINY];
+	double times[REBUILDS], t, swap;
+	void *instance;
+	unsigned int i, j;
+
+	if ((instance = p->construct(TINY, TINY)) == NULL) return -1.0;
+
+	synthetic((unsigned char *)in, TINY, TINY);
+	p->update(instance, 0.0, in, out);
+
+	for (i = 0; i < REBUILDS; i++) {
+		t	= now();
+		setparams(p, instance, (i & 1) ? SETDEFAULT : SETMID, defaults);
+		p->update(instance, (double)(i + 1), in, out);
+		times[i]	= now() - t;
+	}
+
+	p->destruct(instance);
+
+	for (i = 1; i < REBUILDS; i++) for (j = i; (j > 0) && (times[j - 1] > times[j]); j--) {
+		swap		= times[j];
+		times[j]	= times[j - 1];
+		times[j - 1]	= swap;
+	}
+
+	return times[REBUILDS / 2] * 1e6;
+}
+
+static void benchplugin(const char *path, const SIZE *sizes, int nsizes, const IMAGE *images, int nimages, double seconds, unsigned char *in, unsigned char *out, int first) {
+	PLUGIN p;
+	void *instance;
+	double *defaults;
+	int s, set, img, runs = 0;
+
+	if (loadplugin(&p, path) < 0) return;
+
+	if ((p.info.plugin_type != F0R_PLUGIN_TYPE_FILTER) ||
+		((p.info.color_model != F0R_COLOR_MODEL_RGBA8888) && (p.info.color_model != F0R_COLOR_MODEL_BGRA8888))) {
+		fprintf(stderr, "freliba-bench: %s: Not an 8-bit filter, skipped\n", path);
+		unloadplugin(&p);
+		return;
+	}
+
+	if ((defaults = calloc((size_t)p.info.num_params + 1, sizeof(double))) == NULL) fail("Out of memory");
+
+	printf("%s\n\t\t{\"plugin\": ", (first) ? "" : ",");
+	jsonstring(path);
+	printf(", \"name\": ");
+	jsonstring(p.info.name);
+	printf(", \"version\": \"%d.%d\", \"runs\": [", p.info.major_version, p.info.minor_version);
+
+	for (s = 0; s < nsizes; s++) {
+		if ((instance = p.construct(sizes[s].width, sizes[s].height)) == NULL) continue;
+		getdefaults(&p, instance, defaults);
+
+		for (img = -1; img < nimages; img++) {
+			if (img < 0) synthetic(in, sizes[s].width, sizes[s].height);
+			else stretch(in, sizes[s].width, sizes[s].height, images + img);
+
+			for (set = SETDEFAULT; set <= SETMID; set++) {
+				setparams(&p, instance, set, defaults);
+				fprintf(stderr, "freliba-bench: %s %s %s %s\n", path, sizes[s].name, (img < 0) ? "synthetic" : images[img].name, setnames[set]);
+
+				printf("%s\n\t\t\t{\"image\": ", (runs) ? "," : "");
+				jsonstring((img < 0) ? "synthetic" : images[img].name);
+				printf(", \"params\": ");
+				jsonstring(setnames[set]);
+				timeframes(&p, instance, in, out, sizes + s, seconds);
+				putchar('}');
+				runs++;
+			}
+		}
+
+		p.destruct(instance);
+	}
+
+	printf("\n\t\t], \"rebuild_microseconds\": %.3f}", rebuild(&p, defaults));
+
+	free(defaults);
+	unloadplugin(&p);
+}
+
+// What the processor calls itself, if we can find out.
+static void cpuname(char *name, size_t size) {
+	char line[256], *colon;
+	FILE *f;
+
+	snprintf(name, size, "unknown");
+	if ((f = fopen("/proc/cpuinfo", "r")) == NULL) return;
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if ((strncmp(line, "model name", 10) == 0) && ((colon = strchr(line, ':')) != NULL)) {
+			for (colon++; *colon == ' '; colon++);
+			colon[strcspn(colon, "\n")]	= '\0';
+			snprintf(name, size, "%s", colon);
+			break;
+		}
+	}
+
+	fclose(f);
+}
+
+static void usage(void) {
+	fprintf(stderr, "Usage: freliba-bench [-s 720p,1080p,4k,8k,WxH] [-i image.ppm] [-t seconds] [-l label] [plugin.so...]\n");
+	exit(2);
+}
+
+int main(int argc, char *argv[]) {
+	SIZE sizes[MAXSIZES];
+	IMAGE images[MAXIMAGES];
+	glob_t found;
+	char defsizes[] = "720p,1080p,4k,8k", cpu[256];
+	const char *label = "";
+	unsigned char *in, *out;
+	size_t biggest = 0;
+	double seconds = 0.25;
+	int opt, nsizes = 0, nimages = 0, i;
+	char **plugins;
+	int nplugins;
+
+	while ((opt = getopt(argc, argv, "s:i:t:l:")) != -1) switch (opt) {
+		case 's':
+			if ((nsizes = parsesizes(sizes, optarg)) <= 0) usage();
+			break;
+		case 'i':
+			if (nimages == MAXIMAGES) usage();
+			if (readppm(images + nimages, optarg) < 0) {
+				fprintf(stderr, "freliba-bench: %s: Not a binary PPM with 8 bits per sample\n", optarg);
+				return 1;
+			}
+			nimages++;
+			break;
+		case 't':
+			if ((seconds = atof(optarg)) <= 0.0) usage();
+			break;
+		case 'l':
+			label	= optarg;
+			break;
+		default:
+			usage();
+	}
+
+	if (nsizes == 0) nsizes = parsesizes(sizes, defsizes);
+
+	if (optind < argc) {
+		plugins		= argv + optind;
+		nplugins	= argc - optind;
+	}
+	else {
+		if ((glob("./koliba_*.so", 0, NULL, &found) != 0) || (found.gl_pathc == 0)) fail("No plug-ins to time");
+		plugins		= found.gl_pathv;
+		nplugins	= (int)found.gl_pathc;
+	}
+
+	for (i = 0; i < nsizes; i++) if ((size_t)sizes[i].width * sizes[i].height > biggest) biggest = (size_t)sizes[i].width * sizes[i].height;
+
+	if (((in = malloc(biggest * 4)) == NULL) || ((out = malloc(biggest * 4)) == NULL)) fail("Out of memory");
+
+	cpuname(cpu, sizeof(cpu));
+
+	printf("{\n\t\"label\": ");
+	jsonstring(label);
+	printf(",\n\t\"machine\": {\"cpu\": ");
+	jsonstring(cpu);
+	printf(", \"cpus\": %ld, \"tsc\": %s},\n\t\"seconds_per_case\": %g,\n\t\"plugins\": [", sysconf(_SC_NPROCESSORS_ONLN), (HAVETSC) ? "true" : "false", seconds);
+
+	for (i = 0; i < nplugins; i++) benchplugin(plugins[i], sizes, nsizes, images, nimages, seconds, in, out, i == 0);
+
+	printf("\n\t]\n}\n");
+
+	for (i = 0; i < nimages; i++) free(images[i].rgb);
+	free(in);
+	free(out);
+	return 0;
+}
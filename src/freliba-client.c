@@ -0,0 +1,220 @@
+/*
+	freliba-client.c
+
+	Copyright 2021 G. Adam Stanislav.
+	All rights reserved.
+
+	http://www.pantarheon.org
+
+	The client side of freliba-server, as part of libfreliba.
+	See libfreliba.h for how to use it, and freliba-server.h
+	for how it works.
+*/
+
+#ifdef	__linux__
+#define	_GNU_SOURCE
+#endif
+
+#include	"libfreliba.h"
+#include	"freliba-server.h"
+#include	<string.h>
+
+#ifdef	__linux__
+#include	<sys/mman.h>
+#include	<sys/socket.h>
+#include	<sys/un.h>
+
+struct _FRELIBA_REMOTE {
+	int				sock;
+	FRELIBA_SHM		*shm;
+	size_t			mapsize;
+	size_t			width;
+	size_t			height;
+	unsigned int	next;	// The slot FRELIBA_RemoteApply uses next
+};
+
+static int receivefd(int sock, unsigned char *status) {
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	union {
+		char			buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr	align;
+	} control;
+	int fd = -1;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base		= status;
+	iov.iov_len			= 1;
+	msg.msg_iov			= &iov;
+	msg.msg_iovlen		= 1;
+	msg.msg_control		= control.buf;
+	msg.msg_controllen	= sizeof(control.buf);
+
+	if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != 1) return -1;
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+		if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS))
+			memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+
+	return fd;
+}
+
+FRELIBA_REMOTE * FRELIBA_Connect(const char *socketpath, const char *grade, size_t width, size_t height, int model) {
+	FRELIBA_REMOTE *remote;
+	struct sockaddr_un addr;
+	char *request;
+	size_t size;
+	unsigned char status = 1;
+	int fd;
+
+	if ((grade == NULL) || (width == 0) || (height == 0) ||
+		((remote = calloc(1, sizeof(FRELIBA_REMOTE))) == NULL)) return NULL;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family	= AF_UNIX;
+	if (socketpath == NULL) FRELIBA_SocketPath(addr.sun_path, sizeof(addr.sun_path));
+	else snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", socketpath);
+
+	if ((request = malloc(strlen(grade) + 64)) == NULL) {
+		free(remote);
+		return NULL;
+	}
+
+	size	= (size_t)sprintf(request, "FRELIBA 1 %zu %zu %d %s\n", width, height, model, grade);
+
+	if (((remote->sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) ||
+		(connect(remote->sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) ||
+		(send(remote->sock, request, size, MSG_NOSIGNAL) != (ssize_t)size) ||
+		((fd = receivefd(remote->sock, &status)) < 0) || (status != 0)) {
+		if (remote->sock >= 0) close(remote->sock);
+		free(request);
+		free(remote);
+		return NULL;
+	}
+
+	free(request);
+
+	// We do not know how big it is until we see its header.
+	remote->shm	= mmap(NULL, FRELIBA_SHMALIGN, PROT_READ, MAP_SHARED, fd, 0);
+	if ((remote->shm == MAP_FAILED) || (remote->shm->magic != FRELIBA_SHMMAGIC) || (remote->shm->slots != FRELIBA_SHMSLOTS)) {
+		if (remote->shm != MAP_FAILED) munmap(remote->shm, FRELIBA_SHMALIGN);
+		close(fd);
+		close(remote->sock);
+		free(remote);
+		return NULL;
+	}
+
+	remote->mapsize	= remote->shm->offset + remote->shm->slots * remote->shm->stride;
+	munmap(remote->shm, FRELIBA_SHMALIGN);
+
+	remote->shm	= mmap(NULL, remote->mapsize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (remote->shm == MAP_FAILED) {
+		close(remote->sock);
+		free(remote);
+		return NULL;
+	}
+
+	remote->width	= width;
+	remote->height	= height;
+	return remote;
+}
+
+void FRELIBA_Disconnect(FRELIBA_REMOTE *remote) {
+	if (remote != NULL) {
+		munmap(remote->shm, remote->mapsize);
+		close(remote->sock);
+		free(remote);
+	}
+}
+
+unsigned int FRELIBA_RemoteSlots(const FRELIBA_REMOTE *remote) {
+	return (remote != NULL) ? remote->shm->slots : 0;
+}
+
+void * FRELIBA_RemoteFrame(FRELIBA_REMOTE *remote, unsigned int slot) {
+	if ((remote == NULL) || (slot >= remote->shm->slots)) return NULL;
+	return (unsigned char *)remote->shm + remote->shm->offset + slot * remote->shm->stride;
+}
+
+int FRELIBA_RemoteSubmit(FRELIBA_REMOTE *remote, unsigned int slot) {
+	if ((remote == NULL) || (slot >= remote->shm->slots) ||
+		(__atomic_load_n(&remote->shm->state[slot], __ATOMIC_ACQUIRE) != FRELIBA_SLOTFREE)) return -1;
+
+	__atomic_store_n(&remote->shm->state[slot], FRELIBA_SLOTSUBMITTED, __ATOMIC_RELEASE);
+	FRELIBA_FutexWake(&remote->shm->state[slot]);
+	return 0;
+}
+
+int FRELIBA_RemoteWait(FRELIBA_REMOTE *remote, unsigned int slot) {
+	uint32_t state;
+
+	if ((remote == NULL) || (slot >= remote->shm->slots)) return -1;
+
+	while ((state = __atomic_load_n(&remote->shm->state[slot], __ATOMIC_ACQUIRE)) == FRELIBA_SLOTSUBMITTED) {
+		// Now and then we make sure the server is still there.
+		FRELIBA_FutexWait(&remote->shm->state[slot], state, 1000);
+		if ((__atomic_load_n(&remote->shm->state[slot], __ATOMIC_ACQUIRE) == FRELIBA_SLOTSUBMITTED) &&
+			(recv(remote->sock, &state, 1, MSG_PEEK | MSG_DONTWAIT) == 0)) return -1;
+	}
+
+	if (state != FRELIBA_SLOTDONE) return -1;
+	__atomic_store_n(&remote->shm->state[slot], FRELIBA_SLOTFREE, __ATOMIC_RELEASE);
+	return 0;
+}
+
+int FRELIBA_RemoteApply(FRELIBA_REMOTE *remote, const void *src, ptrdiff_t srcstride, void *dst, ptrdiff_t dststride, size_t width, size_t height) {
+	unsigned char *frame;
+	const ptrdiff_t packed = (ptrdiff_t)(width * 4);
+	size_t y;
+
+	if ((remote == NULL) || (width != remote->width) || (height != remote->height) ||
+		((frame = FRELIBA_RemoteFrame(remote, remote->next)) == NULL)) return -1;
+
+	if (srcstride == 0) srcstride = packed;
+	if (dststride == 0) dststride = packed;
+
+	for (y = 0; y < height; y++) memcpy(frame + y * packed, (const unsigned char *)src + y * srcstride, packed);
+
+	if ((FRELIBA_RemoteSubmit(remote, remote->next) < 0) || (FRELIBA_RemoteWait(remote, remote->next) < 0)) return -1;
+
+	for (y = 0; y < height; y++) memcpy((unsigned char *)dst + y * dststride, frame + y * packed, packed);
+
+	// The server takes the slots in order, so we must, too.
+	remote->next	= (remote->next + 1) % remote->shm->slots;
+	return 0;
+}
+
+#else
+
+// Elsewhere there is no server to connect to.
+FRELIBA_REMOTE * FRELIBA_Connect(const char *socketpath, const char *grade, size_t width, size_t height, int model) {
+	return NULL;
+}
+
+void FRELIBA_Disconnect(FRELIBA_REMOTE *remote) {
+}
+
+unsigned int FRELIBA_RemoteSlots(const FRELIBA_REMOTE *remote) {
+	return 0;
+}
+
+void * FRELIBA_RemoteFrame(FRELIBA_REMOTE *remote, unsigned int slot) {
+	return NULL;
+}
+
+int FRELIBA_RemoteSubmit(FRELIBA_REMOTE *remote, unsigned int slot) {
+	return -1;
+}
+
+int FRELIBA_RemoteWait(FRELIBA_REMOTE *remote, unsigned int slot) {
+	return -1;
+}
+
+int FRELIBA_RemoteApply(FRELIBA_REMOTE *remote, const void *src, ptrdiff_t srcstride, void *dst, ptrdiff_t dststride, size_t width, size_t height) {
+	return -1;
+}
+
+#endif
@@ -0,0 +1,605 @@
+/*
+	freliba-conform.c
+
+	Copyright 2021 G. Adam Stanislav.
+	All rights reserved.
+
+	http://www.pantarheon.org
+
+	Checks that the shortcuts the effects take get the same
+	pixels as Koliba's own per-pixel kernels would. Every
+	effect in libfreliba goes through a sweep of its settings,
+	and for each of them, each fast path it can take is fed
+	all 2^24 RGB colors and compared with the reference:
+
+		frame	What FRELIBA_Apply does (with the identity,
+			constant and separable FLUTs skipped, filled,
+			or looked up), against KOLIBA_Rgba8Pixel with
+			the effect's FLUT.
+		bgra	The effect created for BGRA pixels, against the
+			same effect in RGBA (which is how the Lumidux,
+			Scaled and Poly effects get checked).
+		chain	Its FLUT and that of the next setting folded
+			into fewer links by FRELIBA_CollapseFlutChain
+			(as the chained effects do), against both links
+			through KOLIBA_PolyRgba8Pixel.
+		lattice	FRELIBA_LatticeRgba8Frame, with a lattice sampled
+			from its FLUT, against a plain trilinear lookup
+			of the same points in double precision.
+		rgba16	FRELIBA_FastRgba16Frame, rounded to 8 bits,
+			against KOLIBA_Rgba8Pixel.
+		rgbaf	FRELIBA_FastRgbafFrame, rounded to 8 bits,
+			against KOLIBA_Rgba8Pixel (without sRGB, which
+			the float path does not do).
+
+	Only the effects that boil down to a FLUT have the last four.
+
+	Usage:
+
+		freliba-conform [options]
+
+	Options:
+
+		-e effect	Only check this effect (up to 64 times).
+		-j n		Use n threads (default: one per CPU).
+		-s step	Only every step-th value of each channel
+				(and 255), for a quick look (default 1: all).
+		-q		Do not report the progress on stderr (which
+				we only do when it is a terminal anyway).
+
+	The settings are the defaults, all numeric parameters at 0.25,
+	0.5, 0.75 and 1, and then each numeric parameter on its own at
+	those values with the rest at their defaults, each with all
+	switches (e.g., sRGB) as they are by default and then the other
+	way around.
+
+	The results go to the standard output as JSON: the largest and
+	the mean difference of each check in least significant bits
+	(of the red, green and blue values), and how many values were
+	off by how much. Any check exceeding its tolerance (see below)
+	is also reported on stderr, and makes us exit with 1.
+
+	Build it with "make freliba-conform", or run "make conform".
+*/
+
+#include	"freliba.h"
+#include	"libfreliba.h"
+#include	<stdio.h>
+#include	<stdlib.h>
+#include	<string.h>
+#include	<math.h>
+#include	<unistd.h>
+#include	<pthread.h>
+
+#define	CHKFRAME	0
+#define	CHKBGRA		1
+#define	CHKCHAIN	2
+#define	CHKLATTICE	3
+#define	CHKRGBA16	4
+#define	CHKRGBAF	5
+#define	CHECKS		6
+
+// How far each path may be off, in least significant bits, at
+// most and on average. The frame paths have Koliba itself make
+// their constant and separable tables, and only skip a FLUT that
+// moves no channel by more than half a bit, so only a value right
+// on half a bit can round the other way: they must all but always
+// agree. The chains fold and prune, too, and everything else
+// differs in how doubles and floats round, which also only
+// matters to a value right between two bytes. Those are not as
+// rare as they sound: a simple gain (e.g., 1.5) puts every other
+// byte there.
+static const struct {
+	const char		*name;
+	unsigned int	max;
+	double			mean;
+} checks[CHECKS] = {
+	{"frame", 1, 0.01},
+	{"bgra", 1, 0.25},
+	{"chain", 1, 0.5},
+	{"lattice", 1, 0.25},
+	{"rgba16", 1, 0.25},
+	{"rgbaf", 1, 0.25}
+};
+
+// The points along each axis of the lattice in the lattice check.
+#define	LATTICESIZE	33
+
+#define	MAXEFFECTS	64
+
+// The numeric parameters are set to each of these in turn, first
+// all of them together, then each on its own.
+static const double sweep[] = {0.25, 0.5, 0.75, 1.0};
+#define	SWEEPS	((int)(sizeof(sweep) / sizeof(double)))
+
+// One setting of one effect.
+typedef struct _CASE {
+	unsigned int		effect;
+	char				label[64];
+	double				*values;	// Per parameter, numbers and switches only
+	int					params;
+	int					hasfast;
+	FRELIBA_FASTFLUT	fast;
+	int					partner;	// Whose FLUT follows ours in the chain check
+} CASE;
+
+// One check of one case.
+typedef struct _JOB {
+	unsigned int		c;
+	unsigned int		check;
+	int					skipped;
+	unsigned long long	values;
+	unsigned long long	hist[256];
+} JOB;
+
+static CASE *cases;
+static JOB *jobs;
+static unsigned int njobs, next, done;
+static unsigned char channel[256];
+static unsigned int nchannel;
+static int quiet = 0;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void fail(const char *msg) {
+	fprintf(stderr, "freliba-conform: %s\n", msg);
+	exit(2);
+}
+
+// Creates an instance of the effect of the case, set up for it.
+static FRELIBA * createcase(const CASE *c, int model) {
+	FRELIBA *fx;
+	int p, type;
+
+	if ((fx = FRELIBA_CreateEffectModel(c->effect, model)) == NULL) return NULL;
+
+	for (p = 0; p < c->params; p++) {
+		type	= FRELIBA_ParamType(fx, p);
+		if ((type == FRELIBA_PARAM_BOOL) || (type == FRELIBA_PARAM_DOUBLE)) FRELIBA_SetParam(fx, p, c->values + p);
+	}
+
+	FRELIBA_Prepare(fx);
+	return fx;
+}
+
+// A plane of the RGB cube: every red and green value we check,
+// with the same blue. Returns the number of pixels.
+static size_t plane(KOLIBA_RGBA8PIXEL *pixels, unsigned char b) {
+	unsigned int r, g;
+
+	for (g = 0; g < nchannel; g++) for (r = 0; r < nchannel; r++, pixels++) {
+		pixels->r	= channel[r];
+		pixels->g	= channel[g];
+		pixels->b	= b;
+		pixels->a	= 255;
+	}
+
+	return (size_t)nchannel * nchannel;
+}
+
+static void compare(JOB *job, const KOLIBA_RGBA8PIXEL *a, const KOLIBA_RGBA8PIXEL *b, size_t count) {
+	job->values	+= (unsigned long long)count * 3;
+
+	for (; count; count--, a++, b++) {
+		job->hist[abs((int)a->r - (int)b->r)]++;
+		job->hist[abs((int)a->g - (int)b->g)]++;
+		job->hist[abs((int)a->b - (int)b->b)]++;
+	}
+}
+
+// What Koliba makes of the pixels with the FLUT of a FASTFLUT.
+// One that was never prepared stands for a skipped FLUT.
+static void reference(const FRELIBA_FASTFLUT *fast, KOLIBA_RGBA8PIXEL *outframe, const KOLIBA_RGBA8PIXEL *inframe, size_t count) {
+	const double *iconv = (fast->srgb) ? KOLIBA_SrgbByteToLinear : NULL;
+	const unsigned char *oconv = (fast->srgb) ? KOLIBA_LinearByteToSrgb : NULL;
+
+	if ((fast->kind == FRELIBA_FLUTIDENTITY) && (!fast->prepared)) memcpy(outframe, inframe, count * sizeof(KOLIBA_RGBA8PIXEL));
+	else for (; count; count--, inframe++, outframe++)
+		KOLIBA_Rgba8Pixel(outframe, inframe, &fast->fLut, fast->flags, iconv, oconv)->a = inframe->a;
+}
+
+static unsigned char encode(double v, unsigned char srgb) {
+	if (!(v > 0.0)) return 0;
+	if (v >= 1.0) return 255;
+	if (srgb) v = (v <= 0.0031308) ? v * 12.92 : 1.055 * pow(v, 1.0 / 2.4) - 0.055;
+	return (unsigned char)(v * 255.0 + 0.5);
+}
+
+// The trilinear lookup of a pixel in size x size x size points, the
+// long way, which is what FRELIBA_LATTICE does with its cell FLUTs.
+static void trilinear(KOLIBA_RGBA8PIXEL *out, const KOLIBA_RGBA8PIXEL *in, const float *points, unsigned int size, unsigned char srgb) {
+	const unsigned int cells = size - 1;
+	const unsigned char bytes[3] = {in->r, in->g, in->b};
+	unsigned int i[3], c, corner;
+	double f[3], x, w, o[3] = {0.0, 0.0, 0.0};
+	const float *p;
+
+	for (c = 0; c < 3; c++) {
+		x	= ((srgb) ? KOLIBA_SrgbByteToLinear[bytes[c]] : (double)bytes[c] / 255.0) * (double)cells;
+		x	= (x <= 0.0) ? 0.0 : (x >= (double)cells) ? (double)cells : x;
+		i[c]	= (unsigned int)x;
+		if (i[c] == cells) i[c]--;
+		f[c]	= x - (double)i[c];
+	}
+
+	for (corner = 0; corner < 8; corner++) {
+		w	= ((corner & 1) ? f[0] : 1.0 - f[0]) * ((corner & 2) ? f[1] : 1.0 - f[1]) * ((corner & 4) ? f[2] : 1.0 - f[2]);
+		p	= points + 3 * (((size_t)(i[2] + ((corner >> 2) & 1)) * size + (i[1] + ((corner >> 1) & 1))) * size + (i[0] + (corner & 1)));
+		for (c = 0; c < 3; c++) o[c] += w * (double)p[c];
+	}
+
+	out->r	= encode(o[0], srgb);
+	out->g	= encode(o[1], srgb);
+	out->b	= encode(o[2], srgb);
+	out->a	= in->a;
+}
+
+static void runjob(JOB *job, KOLIBA_RGBA8PIXEL *in, KOLIBA_RGBA8PIXEL *out, KOLIBA_RGBA8PIXEL *ref, void *wide, void *wideout) {
+	const CASE *c = cases + job->c;
+	const FRELIBA_FASTFLUT *fast = &c->fast;
+	FRELIBA *fx = NULL, *bgra = NULL;
+	FRELIBA_LATTICE *lattice = NULL;
+	FRELIBA_FASTFLUT folded;
+	KOLIBA_FLUT fLuts[2];
+	KOLIBA_FFLUT chain[2], links[2];
+	float *points = NULL;
+	const double *iconv = (fast->srgb) ? KOLIBA_SrgbByteToLinear : NULL;
+	const unsigned char *oconv = (fast->srgb) ? KOLIBA_LinearByteToSrgb : NULL;
+	unsigned int b, n = 0;
+	size_t count, i;
+
+	switch (job->check) {
+		case CHKFRAME:
+			if ((fx = createcase(c, FRELIBA_MODEL_RGBA8888)) == NULL) job->skipped = 1;
+			break;
+		case CHKBGRA:
+			if (((fx = createcase(c, FRELIBA_MODEL_RGBA8888)) == NULL) || ((bgra = createcase(c, FRELIBA_MODEL_BGRA8888)) == NULL)) job->skipped = 1;
+			break;
+		case CHKCHAIN:
+			chain[0].fLut	= (KOLIBA_FLUT *)&fast->fLut;
+			chain[0].flags	= fast->flags;
+			chain[1].fLut	= (KOLIBA_FLUT *)&cases[c->partner].fast.fLut;
+			chain[1].flags	= cases[c->partner].fast.flags;
+			n	= FRELIBA_CollapseFlutChain(fLuts, links, chain, 2, fast->srgb);
+			FRELIBA_InitFastFlutModel(&folded, FRELIBA_MODEL_RGBA8888);
+			break;
+		case CHKLATTICE:
+			if (((points = malloc((size_t)LATTICESIZE * LATTICESIZE * LATTICESIZE * 3 * sizeof(float))) == NULL) ||
+				(FRELIBA_SampleFastFluts(points, LATTICESIZE, &fast, 1) == NULL) ||
+				((lattice = FRELIBA_CreateLattice(points, LATTICESIZE, NULL, NULL)) == NULL)) job->skipped = 1;
+			break;
+	}
+
+	for (b = 0; (b < nchannel) && (!job->skipped); b++) {
+		count	= plane(in, channel[b]);
+
+		switch (job->check) {
+			case CHKFRAME:
+				FRELIBA_Apply(fx, in, 0, out, 0, count, 1);
+				reference(fast, ref, in, count);
+				break;
+			case CHKBGRA:
+				FRELIBA_Apply(fx, in, 0, ref, 0, count, 1);
+				FRELIBA_SwapRgba8RedBlue(in, in, count);
+				FRELIBA_Apply(bgra, in, 0, out, 0, count, 1);
+				FRELIBA_SwapRgba8RedBlue(out, out, count);
+				break;
+			case CHKCHAIN:
+				if (n == 0) memcpy(out, in, count * sizeof(KOLIBA_RGBA8PIXEL));
+				else if (n == 1) FRELIBA_FlutRgba8Frame(&folded, out, in, count, links[0].fLut, links[0].flags, fast->srgb);
+				else for (i = 0; i < count; i++) KOLIBA_PolyRgba8Pixel(out + i, in + i, links, n, iconv, oconv)->a = in[i].a;
+				for (i = 0; i < count; i++) KOLIBA_PolyRgba8Pixel(ref + i, in + i, chain, 2, iconv, oconv)->a = in[i].a;
+				break;
+			case CHKLATTICE:
+				FRELIBA_LatticeRgba8Frame(lattice, out, in, count, fast->srgb, 0);
+				for (i = 0; i < count; i++) trilinear(ref + i, in + i, points, LATTICESIZE, fast->srgb);
+				break;
+			case CHKRGBA16:
+				{
+					FRELIBA_RGBA16PIXEL *in16 = (FRELIBA_RGBA16PIXEL *)wide, *out16 = (FRELIBA_RGBA16PIXEL *)wideout;
+
+					for (i = 0; i < count; i++) {
+						in16[i].r	= (unsigned short)(in[i].r * 257);
+						in16[i].g	= (unsigned short)(in[i].g * 257);
+						in16[i].b	= (unsigned short)(in[i].b * 257);
+						in16[i].a	= 65535;
+					}
+					FRELIBA_FastRgba16Frame(fast, out16, in16, count);
+					for (i = 0; i < count; i++) {
+						out[i].r	= (unsigned char)((out16[i].r * 255u + 32767u) / 65535u);
+						out[i].g	= (unsigned char)((out16[i].g * 255u + 32767u) / 65535u);
+						out[i].b	= (unsigned char)((out16[i].b * 255u + 32767u) / 65535u);
+					}
+				}
+				reference(fast, ref, in, count);
+				break;
+			case CHKRGBAF:
+				{
+					FRELIBA_RGBAFPIXEL *inf = (FRELIBA_RGBAFPIXEL *)wide, *outf = (FRELIBA_RGBAFPIXEL *)wideout;
+
+					for (i = 0; i < count; i++) {
+						inf[i].r	= (float)in[i].r / 255.0f;
+						inf[i].g	= (float)in[i].g / 255.0f;
+						inf[i].b	= (float)in[i].b / 255.0f;
+						inf[i].a	= 1.0f;
+					}
+					FRELIBA_FastRgbafFrame(fast, outf, inf, count);
+					for (i = 0; i < count; i++) {
+						out[i].r	= encode(outf[i].r, 0);
+						out[i].g	= encode(outf[i].g, 0);
+						out[i].b	= encode(outf[i].b, 0);
+					}
+				}
+				reference(fast, ref, in, count);
+				break;
+		}
+
+		compare(job, out, ref, count);
+	}
+
+	if (fx != NULL) FRELIBA_Destroy(fx);
+	if (bgra != NULL) FRELIBA_Destroy(bgra);
+	if (lattice != NULL) FRELIBA_DestroyLattice(lattice);
+	free(points);
+}
+
+static void * worker(void *arg) {
+	const size_t count = (size_t)nchannel * nchannel;
+	KOLIBA_RGBA8PIXEL *in, *out, *ref;
+	void *wide, *wideout;
+	unsigned int j;
+
+	(void)arg;
+
+	if (((in = malloc(count * sizeof(KOLIBA_RGBA8PIXEL))) == NULL) ||
+		((out = malloc(count * sizeof(KOLIBA_RGBA8PIXEL))) == NULL) ||
+		((ref = malloc(count * sizeof(KOLIBA_RGBA8PIXEL))) == NULL) ||
+		((wide = malloc(count * sizeof(FRELIBA_RGBAFPIXEL))) == NULL) ||
+		((wideout = malloc(count * sizeof(FRELIBA_RGBAFPIXEL))) == NULL)) fail("Out of memory");
+
+	for (;;) {
+		pthread_mutex_lock(&lock);
+		j	= next++;
+		pthread_mutex_unlock(&lock);
+		if (j >= njobs) break;
+
+		runjob(jobs + j, in, out, ref, wide, wideout);
+
+		pthread_mutex_lock(&lock);
+		done++;
+		if (!quiet) fprintf(stderr, "\rfreliba-conform: %u of %u checks done", done, njobs);
+		pthread_mutex_unlock(&lock);
+	}
+
+	free(in);
+	free(out);
+	free(ref);
+	free(wide);
+	free(wideout);
+	return NULL;
+}
+
+// Sets up every case of the effect, the defaults first. Returns
+// how many there are, or would be if cases were NULL.
+static unsigned int effectcases(CASE *c, unsigned int effect) {
+	FRELIBA *fx, *info;
+	const FRELIBA_FASTFLUT *fast;
+	double *defaults;
+	int *types, *numeric;
+	int params, p, s, only, flip, switches = 0, numbers = 0;
+	unsigned int n = 0;
+
+	if ((info = FRELIBA_CreateEffect(effect)) == NULL) return 0;
+
+	params	= FRELIBA_Params(info);
+	if (((defaults = calloc((size_t)params + 1, sizeof(double))) == NULL) ||
+		((types = calloc((size_t)params + 1, sizeof(int))) == NULL) ||
+		((numeric = calloc((size_t)params + 1, sizeof(int))) == NULL)) fail("Out of memory");
+
+	for (p = 0; p < params; p++) {
+		types[p]	= FRELIBA_ParamType(info, p);
+		if ((types[p] == FRELIBA_PARAM_BOOL) || (types[p] == FRELIBA_PARAM_DOUBLE)) FRELIBA_GetParam(info, p, defaults + p);
+		if (types[p] == FRELIBA_PARAM_BOOL) switches++;
+		if (types[p] == FRELIBA_PARAM_DOUBLE) numeric[numbers++] = p;
+	}
+
+	// With s at -1 everything is at its default. The first SWEEPS
+	// set all the numbers at once, the rest one number at a time
+	// (only), so the effects that do to red what they should do
+	// to blue (e.g., in BGRA) cannot hide behind equal settings.
+	// With just one number, that would be the same all over again.
+	if (numbers < 2) numbers = 0;
+
+	for (flip = 0; flip <= (switches > 0); flip++) for (s = -1; s < SWEEPS * (numbers + 1); s++, n++) {
+		if (c == NULL) continue;
+
+		only	= (s < SWEEPS) ? -1 : numeric[s / SWEEPS - 1];
+
+		c[n].effect		= effect;
+		c[n].params		= params;
+		c[n].partner	= -1;
+		if ((c[n].values = malloc(((size_t)params + 1) * sizeof(double))) == NULL) fail("Out of memory");
+
+		if (s < 0) snprintf(c[n].label, sizeof(c[n].label), "%s", (flip) ? "switched" : "default");
+		else if (only < 0) snprintf(c[n].label, sizeof(c[n].label), "%g%s", sweep[s % SWEEPS], (flip) ? " switched" : "");
+		else snprintf(c[n].label, sizeof(c[n].label), "%s=%g%s", FRELIBA_ParamName(info, only), sweep[s % SWEEPS], (flip) ? " switched" : "");
+
+		for (p = 0; p < params; p++) {
+			c[n].values[p]	= defaults[p];
+			if ((types[p] == FRELIBA_PARAM_DOUBLE) && (s >= 0) && ((only < 0) || (only == p))) c[n].values[p] = sweep[s % SWEEPS];
+			else if ((types[p] == FRELIBA_PARAM_BOOL) && (flip)) c[n].values[p] = (defaults[p] != 0.0) ? 0.0 : 1.0;
+		}
+
+		if (((fx = createcase(c + n, FRELIBA_MODEL_RGBA8888)) != NULL) && ((fast = FRELIBA_EffectFastFlut(fx)) != NULL)) {
+			c[n].hasfast	= 1;
+			memcpy(&c[n].fast, fast, sizeof(FRELIBA_FASTFLUT));
+		}
+		if (fx != NULL) FRELIBA_Destroy(fx);
+	}
+
+	FRELIBA_Destroy(info);
+	free(defaults);
+	free(types);
+	free(numeric);
+	return n;
+}
+
+static void jsonstring(const char *s) {
+	putchar('"');
+	for (; (s != NULL) && (*s != '\0'); s++) {
+		if ((*s == '"') || (*s == '\\')) printf("\\%c", *s);
+		else if ((unsigned char)*s < ' ') printf("\\u%04x", (unsigned char)*s);
+		else putchar(*s);
+	}
+	putchar('"');
+}
+
+// Writes the result of a job, and returns 1 if it failed.
+static int report(const JOB *job) {
+	const CASE *c = cases + job->c;
+	unsigned long long sum = 0;
+	unsigned int max = 0, i;
+	double mean;
+	int failed, first = 1;
+
+	for (i = 0; i < 256; i++) if (job->hist[i]) {
+		max	= i;
+		sum	+= job->hist[i] * i;
+	}
+	mean	= (job->values) ? (double)sum / (double)job->values : 0.0;
+	failed	= (!job->skipped) && ((max > checks[job->check].max) || (mean > checks[job->check].mean));
+
+	printf("\t\t{\"effect\": ");
+	jsonstring(FRELIBA_EffectName(c->effect));
+	printf(", \"params\": ");
+	jsonstring(c->label);
+	printf(", \"check\": \"%s\"", checks[job->check].name);
+	if (job->check == CHKCHAIN) {
+		printf(", \"followed_by\": {\"effect\": ");
+		jsonstring(FRELIBA_EffectName(cases[c->partner].effect));
+		printf(", \"params\": ");
+		jsonstring(cases[c->partner].label);
+		putchar('}');
+	}
+
+	if (job->skipped) printf(", \"skipped\": true}");
+	else {
+		printf(", \"values\": %llu, \"max\": %u, \"mean\": %.6f, \"histogram\": {", job->values, max, mean);
+		for (i = 0; i < 256; i++) if (job->hist[i]) {
+			printf("%s\"%u\": %llu", (first) ? "" : ", ", i, job->hist[i]);
+			first	= 0;
+		}
+		printf("}, \"pass\": %s}", (failed) ? "false" : "true");
+	}
+
+	if (failed) fprintf(stderr, "freliba-conform: %s (%s): %s: off by up to %u, %.6f on average (tolerance %u, %g)\n",
+		FRELIBA_EffectName(c->effect), c->label, checks[job->check].name, max, mean, checks[job->check].max, checks[job->check].mean);
+
+	return failed;
+}
+
+static void usage(void) {
+	fprintf(stderr, "Usage: freliba-conform [-e effect]... [-j threads] [-s step] [-q]\n");
+	exit(2);
+}
+
+int main(int argc, char *argv[]) {
+	const char *only[MAXEFFECTS];
+	pthread_t *threads;
+	long cpus;
+	unsigned int nonly = 0, ncases = 0, nthreads = 0, step = 1, effect, e, c, k, t, failed = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "e:j:s:q")) != -1) switch (opt) {
+		case 'e':
+			if (nonly == MAXEFFECTS) usage();
+			if (FRELIBA_FindEffect(optarg) < 0) {
+				fprintf(stderr, "freliba-conform: %s: No such effect\n", optarg);
+				return 2;
+			}
+			only[nonly++]	= optarg;
+			break;
+		case 'j':
+			if ((nthreads = (unsigned int)atoi(optarg)) == 0) usage();
+			break;
+		case 's':
+			if (((step = (unsigned int)atoi(optarg)) == 0) || (step > 255)) usage();
+			break;
+		case 'q':
+			quiet	= 1;
+			break;
+		default:
+			usage();
+	}
+
+	if (optind < argc) usage();
+
+	if (!isatty(2)) quiet = 1;
+	if (nthreads == 0) nthreads = ((cpus = sysconf(_SC_NPROCESSORS_ONLN)) > 0) ? (unsigned int)cpus : 1;
+
+	for (k = 0; k < 255; k += step) channel[nchannel++] = (unsigned char)k;
+	channel[nchannel++]	= 255;
+
+	// Count the cases first, then set them up.
+	for (effect = 0; effect < FRELIBA_Effects(); effect++) {
+		for (e = 0; (e < nonly) && (FRELIBA_FindEffect(only[e]) != (int)effect); e++);
+		if ((nonly == 0) || (e < nonly)) ncases += effectcases(NULL, effect);
+	}
+
+	if ((ncases == 0) || ((cases = calloc(ncases, sizeof(CASE))) == NULL) ||
+		((jobs = calloc((size_t)ncases * CHECKS, sizeof(JOB))) == NULL)) fail("Nothing to check");
+
+	for (effect = 0, c = 0; effect < FRELIBA_Effects(); effect++) {
+		for (e = 0; (e < nonly) && (FRELIBA_FindEffect(only[e]) != (int)effect); e++);
+		if ((nonly == 0) || (e < nonly)) c += effectcases(cases + c, effect);
+	}
+
+	// Each FLUT is chained with the next one that is really there,
+	// preferably of another effect.
+	for (c = 0; c < ncases; c++) if (cases[c].hasfast) {
+		for (k = 1; k < ncases; k++) {
+			e	= (c + k) % ncases;
+			if ((cases[e].hasfast) && ((cases[e].fast.prepared) || (cases[e].fast.kind != FRELIBA_FLUTIDENTITY)) &&
+				((cases[e].effect != cases[c].effect) || (cases[c].partner < 0))) {
+				cases[c].partner	= (int)e;
+				if (cases[e].effect != cases[c].effect) break;
+			}
+		}
+	}
+
+	for (c = 0; c < ncases; c++) for (k = 0; k < CHECKS; k++) {
+		if ((k != CHKBGRA) && (!cases[c].hasfast)) continue;
+		if ((k == CHKCHAIN) && (cases[c].partner < 0)) continue;
+		if ((k == CHKRGBAF) && (cases[c].fast.srgb)) continue;
+		// The library keeps these off the wide paths, so we do too.
+		if ((k >= CHKLATTICE) && (!FRELIBA_FastFlutAllTerms(&cases[c].fast))) continue;
+		jobs[njobs].c		= c;
+		jobs[njobs].check	= k;
+		njobs++;
+	}
+
+	if (nthreads > njobs) nthreads = njobs;
+	if ((threads = calloc(nthreads, sizeof(pthread_t))) == NULL) fail("Out of memory");
+
+	for (t = 0; t < nthreads; t++) if (pthread_create(threads + t, NULL, worker, NULL) != 0) fail("Cannot start a thread");
+	for (t = 0; t < nthreads; t++) pthread_join(threads[t], NULL);
+	if (!quiet) fputc('\n', stderr);
+
+	printf("{\n\t\"step\": %u,\n\t\"colors\": %u,\n\t\"tolerances\": {", step, nchannel * nchannel * nchannel);
+	for (k = 0; k < CHECKS; k++) printf("%s\"%s\": {\"max\": %u, \"mean\": %g}", (k) ? ", " : "", checks[k].name, checks[k].max, checks[k].mean);
+	printf("},\n\t\"checks\": [\n");
+
+	for (k = 0; k < njobs; k++) {
+		failed	+= report(jobs + k);
+		printf("%s\n", (k + 1 < njobs) ? "," : "");
+	}
+
+	printf("\t],\n\t\"failed\": %u\n}\n", failed);
+
+	for (c = 0; c < ncases; c++) free(cases[c].values);
+	free(cases);
+	free(jobs);
+	free(threads);
+
+	if (failed) fprintf(stderr, "freliba-conform: %u of %u checks failed\n", failed, njobs);
+	return (failed) ? 1 : 0;
+}
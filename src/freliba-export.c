@@ -0,0 +1,140 @@
+/*
+	freliba-export.c
+
+	Copyright 2021 G. Adam Stanislav.
+	All rights reserved.
+
+	http://www.pantarheon.org
+
+	Turns a chain of freliba effects into a 3D LUT, for the
+	software that knows nothing of Koliba but can read LUTs.
+
+	Usage:
+
+		freliba-export [options] -o file effect[:param=value...] ...
+
+	Options:
+
+		-o file		Where to write the LUT (required).
+		-f format	cube, hald, or raw (default: by the extension
+				of the file, .cube, .ppm, or anything else).
+		-s size		Points along each axis (default 33, or 64
+				for a Hald CLUT, whose size must be a square).
+		-q		Do not report how long it took on stderr.
+
+	The effects and their parameters are given just as they are
+	to freliba-apply, e.g.,
+
+		freliba-export -o grade.cube "palette:sRGB=1:Efficacy=0.5" tint
+
+	The LUT maps the colors the effects see in a frame, sRGB or
+	not, according to each effect's own sRGB parameter, to what
+	they turn them into. A raw LUT is size * size * size red, green
+	and blue floats, red changing fastest, in our own byte order.
+
+	Build it with "make freliba-export".
+*/
+
+#include	"libfreliba.h"
+#include	<stdio.h>
+#include	<stdlib.h>
+#include	<string.h>
+#include	<unistd.h>
+#include	<time.h>
+
+static void fail(const char *msg) {
+	fprintf(stderr, "freliba-export: %s\n", msg);
+	exit(1);
+}
+
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int hasextension(const char *name, const char *ext) {
+	size_t n = strlen(name), e = strlen(ext);
+
+	return (n > e) && (strcmp(name + n - e, ext) == 0);
+}
+
+static void usage(void) {
+	fprintf(stderr, "Usage: freliba-export [-f cube|hald|raw] [-s size] [-q] -o file effect[:param=value...] ...\n");
+	exit(2);
+}
+
+int main(int argc, char *argv[]) {
+	FRELIBA **chain;
+	const char *output = NULL;
+	char *arg, *colon, *setting;
+	unsigned int size = 0, n, e;
+	int opt, format = -1, quiet = 0;
+	double start;
+
+	while ((opt = getopt(argc, argv, "o:f:s:q")) != -1) switch (opt) {
+		case 'o':
+			output	= optarg;
+			break;
+		case 'f':
+			if (strcmp(optarg, "cube") == 0) format = FRELIBA_LUTCUBE;
+			else if (strcmp(optarg, "hald") == 0) format = FRELIBA_LUTHALD;
+			else if (strcmp(optarg, "raw") == 0) format = FRELIBA_LUTRAW;
+			else usage();
+			break;
+		case 's':
+			size	= (unsigned int)atoi(optarg);
+			break;
+		case 'q':
+			quiet	= 1;
+			break;
+		default:
+			usage();
+	}
+
+	if ((output == NULL) || (optind >= argc)) usage();
+
+	if (format < 0) format = (hasextension(output, ".cube")) ? FRELIBA_LUTCUBE : (hasextension(output, ".ppm")) ? FRELIBA_LUTHALD : FRELIBA_LUTRAW;
+	if (size == 0) size = (format == FRELIBA_LUTHALD) ? 64 : 33;
+	if (size < 2) fail("A LUT needs at least 2 points along each axis");
+
+	if (format == FRELIBA_LUTHALD) {
+		for (e = 1; e * e < size; e++);
+		if (e * e != size) fail("A Hald CLUT needs a square size (e.g., 64 for level 8)");
+	}
+
+	n	= (unsigned int)(argc - optind);
+	if ((chain = calloc(n, sizeof(FRELIBA *))) == NULL) fail("Out of memory");
+
+	for (e = 0; e < n; e++) {
+		arg		= argv[optind + e];
+		if ((colon = strchr(arg, ':')) != NULL) *colon = '\0';
+
+		if ((chain[e] = FRELIBA_CreateModel(arg, FRELIBA_MODEL_RGBA8888)) == NULL) {
+			fprintf(stderr, "freliba-export: No effect called %s\n", arg);
+			return 1;
+		}
+
+		for (setting = (colon != NULL) ? colon + 1 : NULL; setting != NULL; setting = (colon != NULL) ? colon + 1 : NULL) {
+			if ((colon = strchr(setting, ':')) != NULL) *colon = '\0';
+			if (FRELIBA_ParseParam(chain[e], setting) < 0) {
+				fprintf(stderr, "freliba-export: %s: Cannot make sense of %s\n", arg, setting);
+				return 1;
+			}
+		}
+	}
+
+	start	= now();
+
+	if (FRELIBA_ExportLut(chain, n, size, format, output) < 0) {
+		fprintf(stderr, "freliba-export: Cannot write %s\n", output);
+		return 1;
+	}
+
+	if (!quiet) fprintf(stderr, "freliba-export: %u^3 points in %.1f ms\n", size, (now() - start) * 1000.0);
+
+	for (e = 0; e < n; e++) FRELIBA_Destroy(chain[e]);
+	free(chain);
+	return 0;
+}
@@ -0,0 +1,454 @@
+/*
+	freliba-server.c
+
+	Copyright 2021 G. Adam Stanislav.
+	All rights reserved.
+
+	http://www.pantarheon.org
+
+	A local frame server for the freliba effects. Processes that
+	apply the same grade (the same effects with the same parameters)
+	can have it done here instead, sharing one set of the effects,
+	with their baked tables, and one pool of worker threads, rather
+	than each building its own. They hand over their frames through
+	shared memory, and we tell each other about them with futexes,
+	so there is no copying and no system call beyond the wake-ups.
+	See freliba-server.h for the protocol, and FRELIBA_Connect in
+	libfreliba.h for the client side of it.
+
+	Usage: freliba-server [-s socket] [-j workers] [-q]
+
+	The socket defaults to $XDG_RUNTIME_DIR/freliba.sock (or to
+	/tmp/freliba-<uid>.sock), and only its owner can connect to it.
+
+	Effects that change from one frame to the next (autobalance)
+	need all the frames, whole and in order, which a shared grade
+	split among the workers cannot give them, so grades with such
+	an effect are refused. Apply them in the client instead.
+
+	Linux only. Build it with "make freliba-server".
+*/
+
+#define	_GNU_SOURCE
+
+#include	"libfreliba.h"
+#include	"freliba-server.h"
+#include	<string.h>
+#include	<errno.h>
+#include	<fcntl.h>
+#include	<signal.h>
+#include	<poll.h>
+#include	<pthread.h>
+#include	<sys/types.h>
+#include	<sys/stat.h>
+#include	<sys/mman.h>
+#include	<sys/socket.h>
+#include	<sys/un.h>
+
+// The effects of a grade, once for each worker, so the workers
+// never have to wait for one another. The grades are shared by
+// all clients asking for the same one.
+typedef struct _GRADE {
+	struct _GRADE	*next;
+	char			*key;		// The model and the grade, as text
+	FRELIBA			***chains;	// [worker][effect]
+	unsigned int	neffects;
+	unsigned int	refs;
+} GRADE;
+
+// A band of rows of a frame for one of the workers.
+typedef struct _JOB {
+	struct _JOB		*next;
+	GRADE			*grade;
+	unsigned char	*rows;
+	size_t			width;
+	size_t			height;
+	unsigned int	*pending;	// Jobs of the frame not done yet
+} JOB;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t finished = PTHREAD_COND_INITIALIZER;
+static GRADE *grades;
+static JOB *queue, **queuetail = &queue;
+static unsigned int workers;
+static int quiet;
+
+static void report(const char *fmt, const char *what) {
+	if (!quiet) {
+		fprintf(stderr, "freliba-server: ");
+		fprintf(stderr, fmt, what);
+		fputc('\n', stderr);
+	}
+}
+
+static void destroychains(FRELIBA ***chains, unsigned int neffects) {
+	unsigned int w, e;
+
+	for (w = 0; w < workers; w++) if (chains[w] != NULL) {
+		for (e = 0; e < neffects; e++) FRELIBA_Destroy(chains[w][e]);
+		free(chains[w]);
+	}
+	free(chains);
+}
+
+// Creates one worker's instances of the effects in the grade. We
+// split each frame into bands among the workers, and share the
+// grade among the clients, so no instance ever sees whole frames
+// in order: an effect that changes from one frame to the next
+// (see FRELIBA_Timed) makes no sense here, and we refuse it.
+static FRELIBA ** createchain(const char *spec, int model, unsigned int neffects) {
+	FRELIBA **chain;
+	char *copy, *effect, *setting, *savefx, *saveset;
+	unsigned int e = 0;
+	int failed = 0;
+
+	if (((chain = calloc(neffects, sizeof(FRELIBA *))) == NULL) || ((copy = strdup(spec)) == NULL)) {
+		free(chain);
+		return NULL;
+	}
+
+	for (effect = strtok_r(copy, " ", &savefx); (effect != NULL) && (!failed) && (e < neffects); effect = strtok_r(NULL, " ", &savefx)) {
+		setting	= strtok_r(effect, ":", &saveset);
+		if ((chain[e] = FRELIBA_CreateModel(setting, model)) == NULL) break;
+		if (FRELIBA_Timed(chain[e])) failed = 1;
+
+		while ((setting = strtok_r(NULL, ":", &saveset)) != NULL)
+			if (FRELIBA_ParseParam(chain[e], setting) < 0) failed = 1;
+
+		FRELIBA_Prepare(chain[e++]);
+	}
+
+	free(copy);
+
+	if ((failed) || (e < neffects)) {
+		while (e) FRELIBA_Destroy(chain[--e]);
+		free(chain);
+		return NULL;
+	}
+
+	return chain;
+}
+
+// Finds the grade, or creates it. Returns NULL if it makes no sense.
+// The effects are created without holding the lock, which the
+// workers need for every band of every frame: a grade with a big
+// LUT can take a while to set up, and the other clients' frames
+// should not wait for it. If someone else creates the same grade
+// in the meantime, we use theirs and throw ours away.
+static GRADE * acquiregrade(const char *spec, int model) {
+	GRADE *grade, *g;
+	char *key, *p;
+	unsigned int neffects = 0, w;
+
+	if ((key = malloc(strlen(spec) + 16)) == NULL) return NULL;
+	sprintf(key, "%d %s", model, spec);
+
+	pthread_mutex_lock(&lock);
+
+	for (grade = grades; grade != NULL; grade = grade->next) if (strcmp(grade->key, key) == 0) {
+		grade->refs++;
+		pthread_mutex_unlock(&lock);
+		free(key);
+		return grade;
+	}
+
+	pthread_mutex_unlock(&lock);
+
+	for (p = (char *)spec; *p != '\0'; neffects++) {
+		while (*p == ' ') p++;
+		if (*p == '\0') break;
+		while ((*p != ' ') && (*p != '\0')) p++;
+	}
+
+	if ((neffects == 0) || ((grade = calloc(1, sizeof(GRADE))) == NULL) ||
+		((grade->chains = calloc(workers, sizeof(FRELIBA **))) == NULL)) {
+		if (neffects) free(grade);
+		free(key);
+		return NULL;
+	}
+
+	for (w = 0; w < workers; w++) if ((grade->chains[w] = createchain(spec, model, neffects)) == NULL) {
+		destroychains(grade->chains, neffects);
+		free(grade);
+		free(key);
+		return NULL;
+	}
+
+	grade->key		= key;
+	grade->neffects	= neffects;
+	grade->refs		= 1;
+
+	pthread_mutex_lock(&lock);
+
+	for (g = grades; g != NULL; g = g->next) if (strcmp(g->key, key) == 0) {
+		g->refs++;
+		pthread_mutex_unlock(&lock);
+		destroychains(grade->chains, neffects);
+		free(grade);
+		free(key);
+		return g;
+	}
+
+	grade->next		= grades;
+	grades			= grade;
+
+	pthread_mutex_unlock(&lock);
+	report("New grade: %s", spec);
+	return grade;
+}
+
+static void releasegrade(GRADE *grade) {
+	GRADE **g;
+
+	pthread_mutex_lock(&lock);
+
+	if (--grade->refs == 0) {
+		for (g = &grades; *g != grade; g = &(*g)->next);
+		*g	= grade->next;
+		destroychains(grade->chains, grade->neffects);
+		free(grade->key);
+		free(grade);
+	}
+
+	pthread_mutex_unlock(&lock);
+}
+
+static void * worker(void *arg) {
+	const unsigned int w = (unsigned int)(uintptr_t)arg;
+	JOB *job;
+
+	for (;;) {
+		pthread_mutex_lock(&lock);
+		while (queue == NULL) pthread_cond_wait(&queued, &lock);
+		job		= queue;
+		if ((queue = job->next) == NULL) queuetail = &queue;
+		pthread_mutex_unlock(&lock);
+
+		FRELIBA_ApplyChain(job->grade->chains[w], job->grade->neffects, job->rows, 0, job->rows, 0, job->width, job->height);
+
+		pthread_mutex_lock(&lock);
+		if (--*job->pending == 0) pthread_cond_broadcast(&finished);
+		pthread_mutex_unlock(&lock);
+	}
+
+	return NULL;
+}
+
+// Splits the frame into one band per worker and waits for all of them.
+static void process(GRADE *grade, unsigned char *frame, size_t width, size_t height, JOB *jobs) {
+	size_t rows = (height + workers - 1) / workers, y;
+	unsigned int pending = 0, n = 0;
+
+	pthread_mutex_lock(&lock);
+
+	for (y = 0; y < height; y += rows, n++) {
+		jobs[n].grade	= grade;
+		jobs[n].rows	= frame + y * width * 4;
+		jobs[n].width	= width;
+		jobs[n].height	= (height - y < rows) ? height - y : rows;
+		jobs[n].pending	= &pending;
+		jobs[n].next	= NULL;
+		*queuetail		= &jobs[n];
+		queuetail		= &jobs[n].next;
+		pending++;
+	}
+
+	pthread_cond_broadcast(&queued);
+	while (pending) pthread_cond_wait(&finished, &lock);
+	pthread_mutex_unlock(&lock);
+}
+
+static int sendfd(int sock, unsigned char status, int fd) {
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	union {
+		char			buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr	align;
+	} control;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base	= &status;
+	iov.iov_len		= 1;
+	msg.msg_iov		= &iov;
+	msg.msg_iovlen	= 1;
+
+	if (fd >= 0) {
+		msg.msg_control		= control.buf;
+		msg.msg_controllen	= sizeof(control.buf);
+		cmsg				= CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level	= SOL_SOCKET;
+		cmsg->cmsg_type		= SCM_RIGHTS;
+		cmsg->cmsg_len		= CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	}
+
+	return (sendmsg(sock, &msg, MSG_NOSIGNAL) == 1) ? 0 : -1;
+}
+
+// Is the client still there?
+static int connected(int sock) {
+	struct pollfd pfd;
+	char c;
+
+	pfd.fd		= sock;
+	pfd.events	= POLLIN;
+
+	if (poll(&pfd, 1, 0) <= 0) return 1;
+	if (pfd.revents & (POLLHUP | POLLERR)) return 0;
+	return recv(sock, &c, 1, MSG_PEEK | MSG_DONTWAIT) != 0;
+}
+
+static void * client(void *arg) {
+	const int sock = (int)(intptr_t)arg;
+	char request[65536], *spec;
+	size_t got = 0, width, height, size = 0;
+	ssize_t n;
+	int model, fd = -1, offset;
+	unsigned int slot;
+	uint32_t state;
+	GRADE *grade = NULL;
+	FRELIBA_SHM *shm = MAP_FAILED;
+	unsigned char *frames;
+	JOB *jobs = NULL;
+
+	// The request is a single line.
+	while ((got < sizeof(request) - 1) && ((n = recv(sock, request + got, sizeof(request) - 1 - got, 0)) > 0)) {
+		got	+= (size_t)n;
+		if (memchr(request, '\n', got) != NULL) break;
+	}
+	request[got]	= '\0';
+	if ((spec = strchr(request, '\n')) != NULL) *spec = '\0';
+
+	if ((sscanf(request, "FRELIBA 1 %zu %zu %d %n", &width, &height, &model, &offset) != 3) ||
+		(width == 0) || (height == 0) || (width > 65536) || (height > 65536)) {
+		report("Bad request: %s", request);
+		goto done;
+	}
+
+	spec	= request + offset;
+
+	if ((grade = acquiregrade(spec, model)) == NULL) {
+		report("Bad grade: %s", spec);
+		goto done;
+	}
+
+	size	= width * height * 4;
+	size	= (size + FRELIBA_SHMALIGN - 1) & ~(size_t)(FRELIBA_SHMALIGN - 1);
+
+	if (((jobs = calloc(workers, sizeof(JOB))) == NULL) ||
+		((fd = memfd_create("freliba", MFD_CLOEXEC)) < 0) ||
+		(ftruncate(fd, FRELIBA_SHMALIGN + FRELIBA_SHMSLOTS * size) < 0) ||
+		((shm = mmap(NULL, FRELIBA_SHMALIGN + FRELIBA_SHMSLOTS * size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)) {
+		report("Cannot create the shared memory: %s", strerror(errno));
+		goto done;
+	}
+
+	shm->magic		= FRELIBA_SHMMAGIC;
+	shm->slots		= FRELIBA_SHMSLOTS;
+	shm->framesize	= width * height * 4;
+	shm->offset		= FRELIBA_SHMALIGN;
+	shm->stride		= size;
+
+	// The client can write to the header, so from now on we only
+	// go by what we know ourselves of where the frames are.
+	frames	= (unsigned char *)shm + FRELIBA_SHMALIGN;
+
+	if (sendfd(sock, 0, fd) < 0) goto done;
+	close(fd);
+	fd	= -1;
+
+	// We take the slots in order, same as the client hands them
+	// to us, and look up now and then to see if it is still there.
+	for (slot = 0; connected(sock); ) {
+		if ((state = __atomic_load_n(&shm->state[slot], __ATOMIC_ACQUIRE)) != FRELIBA_SLOTSUBMITTED) {
+			FRELIBA_FutexWait(&shm->state[slot], state, 250);
+			continue;
+		}
+
+		process(grade, frames + slot * size, width, height, jobs);
+
+		__atomic_store_n(&shm->state[slot], FRELIBA_SLOTDONE, __ATOMIC_RELEASE);
+		FRELIBA_FutexWake(&shm->state[slot]);
+		slot	= (slot + 1) % FRELIBA_SHMSLOTS;
+	}
+
+done:
+	if (shm == MAP_FAILED) sendfd(sock, 1, -1);
+	else munmap(shm, FRELIBA_SHMALIGN + FRELIBA_SHMSLOTS * size);
+	if (fd >= 0) close(fd);
+	if (grade != NULL) releasegrade(grade);
+	free(jobs);
+	close(sock);
+	return NULL;
+}
+
+int main(int argc, char *argv[]) {
+	struct sockaddr_un addr;
+	struct stat st;
+	pthread_t thread;
+	pthread_attr_t detached;
+	char path[sizeof(addr.sun_path)];
+	unsigned int w;
+	int opt, listener, sock;
+	long cpus;
+
+	FRELIBA_SocketPath(path, sizeof(path));
+
+	while ((opt = getopt(argc, argv, "s:j:q")) != -1) switch (opt) {
+		case 's':
+			snprintf(path, sizeof(path), "%s", optarg);
+			break;
+		case 'j':
+			workers	= (unsigned int)atoi(optarg);
+			break;
+		case 'q':
+			quiet	= 1;
+			break;
+		default:
+			fprintf(stderr, "Usage: freliba-server [-s socket] [-j workers] [-q]\n");
+			return 2;
+	}
+
+	if (workers == 0) {
+		cpus	= sysconf(_SC_NPROCESSORS_ONLN);
+		workers	= (cpus > 0) ? (unsigned int)cpus : 1;
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family	= AF_UNIX;
+	memcpy(addr.sun_path, path, strlen(path) + 1);
+
+	// Nobody but us gets to connect. A socket left behind by an
+	// earlier run is in the way, but anything else is not ours to
+	// delete, so bind will fail on it instead.
+	umask(077);
+	if ((lstat(path, &st) == 0) && (S_ISSOCK(st.st_mode))) unlink(path);
+
+	if (((listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) ||
+		(bind(listener, (struct sockaddr *)&addr, sizeof(addr)) < 0) ||
+		(listen(listener, 16) < 0)) {
+		fprintf(stderr, "freliba-server: %s: %s\n", path, strerror(errno));
+		return 1;
+	}
+
+	for (w = 0; w < workers; w++) pthread_create(&thread, NULL, worker, (void *)(uintptr_t)w);
+
+	pthread_attr_init(&detached);
+	pthread_attr_setdetachstate(&detached, PTHREAD_CREATE_DETACHED);
+
+	report("Listening on %s", path);
+
+	for (;;) {
+		if ((sock = accept4(listener, NULL, NULL, SOCK_CLOEXEC)) < 0) {
+			if (errno == EINTR) continue;
+			fprintf(stderr, "freliba-server: %s\n", strerror(errno));
+			return 1;
+		}
+
+		if (pthread_create(&thread, &detached, client, (void *)(intptr_t)sock) != 0) close(sock);
+	}
+}
@@ -0,0 +1,95 @@
+/*
+	freliba-server.h
+
+	Copyright 2021 G. Adam Stanislav.
+	All rights reserved.
+
+	http://www.pantarheon.org
+
+	What freliba-server and its clients (FRELIBA_Connect and
+	friends in libfreliba) agree on. Nothing here is public.
+
+	A client connects to the server's Unix socket and sends one
+	line:
+
+		FRELIBA 1 <width> <height> <model> <grade>
+
+	where the grade is a list of effects separated by spaces, each
+	followed by its parameters, as in freliba-apply, e.g.,
+
+		palette:sRGB=1:Efficacy=0.5 tint
+
+	The server answers with a single byte, 0 if all is well, along
+	with a memfd (sent as SCM_RIGHTS) holding a FRELIBA_SHM header
+	followed by FRELIBA_SHMSLOTS frames. Otherwise the byte is not 0
+	and there is no memfd. Clients using the same grade share the
+	same instances of its effects in the server.
+
+	Each frame has a state, which is also a futex. The client writes
+	a frame into a FRELIBA_SLOTFREE slot, sets it to FRELIBA_SLOTSUBMITTED
+	and wakes the server, which processes the slots in order, sets
+	them to FRELIBA_SLOTDONE, and wakes the client. The client then
+	reads the frame and sets the slot back to FRELIBA_SLOTFREE. The
+	connection stays open for as long as the client wants the slots.
+
+	All of this is Linux only.
+*/
+
+#ifndef	_FRELIBA_SERVER_H_
+#define	_FRELIBA_SERVER_H_
+
+#include	<stdint.h>
+#include	<stdlib.h>
+#include	<stdio.h>
+#include	<unistd.h>
+
+#ifdef	__linux__
+#include	<linux/futex.h>
+#include	<sys/syscall.h>
+#include	<time.h>
+#endif
+
+#define	FRELIBA_SHMMAGIC		0x464C4942	// "FLIB"
+#define	FRELIBA_SHMSLOTS		4
+#define	FRELIBA_SHMALIGN		4096
+
+#define	FRELIBA_SLOTFREE		0
+#define	FRELIBA_SLOTSUBMITTED	1
+#define	FRELIBA_SLOTDONE		2
+
+typedef struct _FRELIBA_SHM {
+	uint32_t			magic;
+	uint32_t			slots;
+	uint64_t			framesize;	// In bytes
+	uint64_t			offset;		// Where the first frame starts
+	uint64_t			stride;		// And how far apart they are
+	volatile uint32_t	state[FRELIBA_SHMSLOTS];
+} FRELIBA_SHM;
+
+// Where the server listens unless told otherwise: in the user's
+// runtime directory, or failing that, in /tmp, with the user ID
+// in its name.
+static inline void FRELIBA_SocketPath(char *path, size_t size) {
+	const char *dir = getenv("XDG_RUNTIME_DIR");
+
+	if ((dir != NULL) && (*dir != '\0')) snprintf(path, size, "%s/freliba.sock", dir);
+	else snprintf(path, size, "/tmp/freliba-%u.sock", (unsigned int)getuid());
+}
+
+#ifdef	__linux__
+// Waits for as long as *word is value, or until the timeout
+// (in milliseconds, or forever if it is negative) runs out.
+static inline void FRELIBA_FutexWait(volatile uint32_t *word, uint32_t value, int timeout) {
+	struct timespec ts;
+
+	ts.tv_sec	= timeout / 1000;
+	ts.tv_nsec	= (long)(timeout % 1000) * 1000000;
+	syscall(SYS_futex, (uint32_t *)word, FUTEX_WAIT, value, (timeout < 0) ? NULL : &ts, NULL, 0);
+}
+
+static inline void FRELIBA_FutexWake(volatile uint32_t *word) {
+	syscall(SYS_futex, (uint32_t *)word, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+#endif
+
+#endif	// _FRELIBA_SERVER_H_
@@ -0,0 +1,1290 @@
+/*
+	freliba.c
+
+	Copyright 2021 G. Adam Stanislav.
+	All rights reserved.
+
+	http://www.pantarheon.org
+
+	Helper routines shared by the freliba plug-ins.
+	See freliba.h for the details.
+*/
+
+#include	"freliba.h"
+#include	<stdlib.h>
+#include	<stdio.h>
+#include	<string.h>
+#include	<math.h>
+
+#ifdef	_WIN32
+#include	<windows.h>
+#include	<sys/types.h>
+#include	<sys/stat.h>
+#else
+#include	<pthread.h>
+#include	<unistd.h>
+#include	<fcntl.h>
+#include	<sys/mman.h>
+#include	<sys/stat.h>
+#endif
+
+// The constant and the products of two or three channels
+// should be zero, the linear terms should form the identity
+// matrix multiplied by the unit (1.0 for regular FLUTs, 255.0
+// for the scaled ones). Whatever is left over is the deviation.
+static double deviation(const KOLIBA_FLUT *fLut, double unit) {
+	double r, g, b;
+
+	r	= fabs(fLut->Black.r) + fabs(fLut->Red.r - unit) + fabs(fLut->Green.r) + fabs(fLut->Blue.r)
+		+ fabs(fLut->Yellow.r) + fabs(fLut->Magenta.r) + fabs(fLut->Cyan.r) + fabs(fLut->White.r);
+	g	= fabs(fLut->Black.g) + fabs(fLut->Red.g) + fabs(fLut->Green.g - unit) + fabs(fLut->Blue.g)
+		+ fabs(fLut->Yellow.g) + fabs(fLut->Magenta.g) + fabs(fLut->Cyan.g) + fabs(fLut->White.g);
+	b	= fabs(fLut->Black.b) + fabs(fLut->Red.b) + fabs(fLut->Green.b) + fabs(fLut->Blue.b - unit)
+		+ fabs(fLut->Yellow.b) + fabs(fLut->Magenta.b) + fabs(fLut->Cyan.b) + fabs(fLut->White.b);
+
+	return ((r > g) ? ((r > b) ? r : b) : ((g > b) ? g : b)) / unit;
+}
+
+static int nearidentity(const KOLIBA_FLUT *fLut, double unit, unsigned char srgb) {
+	return (fLut != NULL) &&
+		(deviation(fLut, unit) <= ((srgb) ? FRELIBA_HALFLSB / FRELIBA_SRGBSLOPE : FRELIBA_HALFLSB));
+}
+
+double FRELIBA_FlutDeviation(const KOLIBA_FLUT *fLut) {
+	return deviation(fLut, 1.0);
+}
+
+int FRELIBA_IsNearIdentityFlut(const KOLIBA_FLUT *fLut, unsigned char srgb) {
+	return nearidentity(fLut, 1.0, srgb);
+}
+
+int FRELIBA_IsNearIdentityScaledFlut(const KOLIBA_FLUT *fLut, unsigned char srgb) {
+	return nearidentity(fLut, 255.0, srgb);
+}
+
+// Returns non-zero if the flags make Koliba use every term of
+// the FLUT. Otherwise it does something other than its terms
+// say, so we cannot fold it into another FLUT.
+static int allterms(const KOLIBA_FFLUT *ffLut) {
+	return (ffLut->flags == KOLIBA_AllFlutFlags) || (ffLut->flags == KOLIBA_FlutFlags(ffLut->fLut)) ||
+		((ffLut->flags == KOLIBA_MatrixFlutFlags) && (FRELIBA_IsMatrixFlut(ffLut->fLut)));
+}
+
+int FRELIBA_FastFlutAllTerms(const FRELIBA_FASTFLUT *fast) {
+	KOLIBA_FFLUT ffLut;
+
+	ffLut.fLut	= (KOLIBA_FLUT *)&fast->fLut;
+	ffLut.flags	= fast->flags;
+	return allterms(&ffLut);
+}
+
+// An upper bound of how much the FLUT can stretch the distance
+// between two pixels within the unit cube, channel by channel:
+// the partial derivative of each output channel by r is Red +
+// Yellow*g + Magenta*b + White*g*b (and so on for g and b), none
+// of which can be more than the sum of its coefficients.
+static double gain(const KOLIBA_FLUT *fLut) {
+	double r, g, b;
+
+	r	= fabs(fLut->Red.r) + fabs(fLut->Green.r) + fabs(fLut->Blue.r)
+		+ 2.0 * (fabs(fLut->Yellow.r) + fabs(fLut->Magenta.r) + fabs(fLut->Cyan.r)) + 3.0 * fabs(fLut->White.r);
+	g	= fabs(fLut->Red.g) + fabs(fLut->Green.g) + fabs(fLut->Blue.g)
+		+ 2.0 * (fabs(fLut->Yellow.g) + fabs(fLut->Magenta.g) + fabs(fLut->Cyan.g)) + 3.0 * fabs(fLut->White.g);
+	b	= fabs(fLut->Red.b) + fabs(fLut->Green.b) + fabs(fLut->Blue.b)
+		+ 2.0 * (fabs(fLut->Yellow.b) + fabs(fLut->Magenta.b) + fabs(fLut->Cyan.b)) + 3.0 * fabs(fLut->White.b);
+
+	return (r > g) ? ((r > b) ? r : b) : ((g > b) ? g : b);
+}
+
+// Dropping a link moves what goes into the links after it by no
+// more than its deviation, and they can stretch that by no more
+// than the product of their gains. So we go from the last link
+// to the first, and only drop a link while the sum of all those
+// errors stays within half of the least significant bit. Only
+// links whose flags let Koliba use all of their terms do what
+// their deviation says. The links we keep end up at the end of
+// the output, which may be the input itself, and we move them to
+// its start once we know how many there are.
+static unsigned int prune(KOLIBA_FFLUT *output, const KOLIBA_FFLUT *input, unsigned int n, unsigned char srgb) {
+	double budget = (srgb) ? FRELIBA_HALFLSB / FRELIBA_SRGBSLOPE : FRELIBA_HALFLSB;
+	double stretch = 1.0, error;
+	unsigned int i = n, first = n;
+
+	while (i--) {
+		error	= FRELIBA_FlutDeviation(input[i].fLut) * stretch;
+
+		if ((allterms(input + i)) && (error <= budget)) budget -= error;
+		else {
+			output[--first]	= input[i];
+			stretch	*= gain(input[i].fLut);
+		}
+	}
+
+	if (first) memmove(output, output + first, (n - first) * sizeof(KOLIBA_FFLUT));
+	return n - first;
+}
+
+unsigned int FRELIBA_PruneFlutChain(KOLIBA_FFLUT *output, const KOLIBA_FFLUT *input, unsigned int n, unsigned char srgb) {
+	return ((output != NULL) && (input != NULL)) ? prune(output, input, n, srgb) : 0;
+}
+
+KOLIBA_RGBA8PIXEL * FRELIBA_CopyRgba8Frame(KOLIBA_RGBA8PIXEL *outframe, const KOLIBA_RGBA8PIXEL *inframe, size_t count) {
+	if (outframe != inframe) memcpy(outframe, inframe, count * sizeof(KOLIBA_RGBA8PIXEL));
+	return outframe;
+}
+
+unsigned int FRELIBA_ClassifyFlut(const KOLIBA_FLUT *fLut, unsigned char srgb) {
+	if (FRELIBA_IsNearIdentityFlut(fLut, srgb)) return FRELIBA_FLUTIDENTITY;
+
+	// Anything beyond the constant and the diagonal of the
+	// linear terms mixes the channels.
+	if ((fLut->Red.g != 0.0) || (fLut->Red.b != 0.0) ||
+		(fLut->Green.r != 0.0) || (fLut->Green.b != 0.0) ||
+		(fLut->Blue.r != 0.0) || (fLut->Blue.g != 0.0) ||
+		(fLut->Yellow.r != 0.0) || (fLut->Yellow.g != 0.0) || (fLut->Yellow.b != 0.0) ||
+		(fLut->Magenta.r != 0.0) || (fLut->Magenta.g != 0.0) || (fLut->Magenta.b != 0.0) ||
+		(fLut->Cyan.r != 0.0) || (fLut->Cyan.g != 0.0) || (fLut->Cyan.b != 0.0) ||
+		(fLut->White.r != 0.0) || (fLut->White.g != 0.0) || (fLut->White.b != 0.0))
+		return FRELIBA_FLUTGENERAL;
+
+	return ((fLut->Red.r == 0.0) && (fLut->Green.g == 0.0) && (fLut->Blue.b == 0.0)) ?
+		FRELIBA_FLUTCONSTANT : FRELIBA_FLUTSEPARABLE;
+}
+
+FRELIBA_FASTFLUT * FRELIBA_InitFastFlutModel(FRELIBA_FASTFLUT *fast, unsigned int model) {
+	if (fast != NULL) {
+		fast->prepared	= 0;
+		fast->kind		= FRELIBA_FLUTIDENTITY;
+		fast->bgra		= (model == FRELIBA_MODEL_BGRA8888);
+	}
+	return fast;
+}
+
+int FRELIBA_IsMatrixFlut(const KOLIBA_FLUT *fLut) {
+	return (fLut->Yellow.r == 0.0) && (fLut->Yellow.g == 0.0) && (fLut->Yellow.b == 0.0) &&
+		(fLut->Magenta.r == 0.0) && (fLut->Magenta.g == 0.0) && (fLut->Magenta.b == 0.0) &&
+		(fLut->Cyan.r == 0.0) && (fLut->Cyan.g == 0.0) && (fLut->Cyan.b == 0.0) &&
+		(fLut->White.r == 0.0) && (fLut->White.g == 0.0) && (fLut->White.b == 0.0);
+}
+
+// What the linear part of the matrix m does to the vertex v.
+#define	matrixvertex(o, m, v)	\
+	(o).r	= (m)->Red.r * (v).r + (m)->Green.r * (v).g + (m)->Blue.r * (v).b;	\
+	(o).g	= (m)->Red.g * (v).r + (m)->Green.g * (v).g + (m)->Blue.g * (v).b;	\
+	(o).b	= (m)->Red.b * (v).r + (m)->Green.b * (v).g + (m)->Blue.b * (v).b
+
+int FRELIBA_IsSeparableFlut(const KOLIBA_FLUT *fLut) {
+	return FRELIBA_IsMatrixFlut(fLut) &&
+		(fLut->Red.g == 0.0) && (fLut->Red.b == 0.0) &&
+		(fLut->Green.r == 0.0) && (fLut->Green.b == 0.0) &&
+		(fLut->Blue.r == 0.0) && (fLut->Blue.g == 0.0);
+}
+
+// Multiplies the vertex v by s.
+#define	scalevertex(o, v, s)	\
+	(o).r	= (v).r * (s);	\
+	(o).g	= (v).g * (s);	\
+	(o).b	= (v).b * (s)
+
+// Adds the vertex v multiplied by s to o.
+#define	addvertex(o, v, s)	\
+	(o).r	+= (v).r * (s);	\
+	(o).g	+= (v).g * (s);	\
+	(o).b	+= (v).b * (s)
+
+KOLIBA_FLUT * FRELIBA_ComposeFluts(KOLIBA_FLUT *output, const KOLIBA_FLUT *inner, const KOLIBA_FLUT *outer) {
+	KOLIBA_FLUT f;
+	double r, g, b, R, G, B;
+
+	if ((output == NULL) || (inner == NULL) || (outer == NULL)) return NULL;
+
+	if (FRELIBA_IsMatrixFlut(outer)) {
+		// Every term of the inner FLUT goes through the matrix, and
+		// then the constant of the matrix is added to its own.
+		matrixvertex(f.Black, outer, inner->Black);
+		matrixvertex(f.Red, outer, inner->Red);
+		matrixvertex(f.Green, outer, inner->Green);
+		matrixvertex(f.Blue, outer, inner->Blue);
+		matrixvertex(f.Yellow, outer, inner->Yellow);
+		matrixvertex(f.Magenta, outer, inner->Magenta);
+		matrixvertex(f.Cyan, outer, inner->Cyan);
+		matrixvertex(f.White, outer, inner->White);
+
+		f.Black.r	+= outer->Black.r;
+		f.Black.g	+= outer->Black.g;
+		f.Black.b	+= outer->Black.b;
+	}
+	else if (FRELIBA_IsSeparableFlut(inner)) {
+		// Each channel going into the outer FLUT is R*r+r (and so
+		// on), so we plug that into its polynomial and sort out
+		// what ends up with which product of r, g and b.
+		R	= inner->Red.r;
+		G	= inner->Green.g;
+		B	= inner->Blue.b;
+		r	= inner->Black.r;
+		g	= inner->Black.g;
+		b	= inner->Black.b;
+
+		scalevertex(f.White, outer->White, R * G * B);
+
+		scalevertex(f.Yellow, outer->Yellow, R * G);
+		addvertex(f.Yellow, outer->White, R * G * b);
+		scalevertex(f.Magenta, outer->Magenta, R * B);
+		addvertex(f.Magenta, outer->White, R * g * B);
+		scalevertex(f.Cyan, outer->Cyan, G * B);
+		addvertex(f.Cyan, outer->White, r * G * B);
+
+		scalevertex(f.Red, outer->Red, R);
+		addvertex(f.Red, outer->Yellow, R * g);
+		addvertex(f.Red, outer->Magenta, R * b);
+		addvertex(f.Red, outer->White, R * g * b);
+		scalevertex(f.Green, outer->Green, G);
+		addvertex(f.Green, outer->Yellow, r * G);
+		addvertex(f.Green, outer->Cyan, G * b);
+		addvertex(f.Green, outer->White, r * G * b);
+		scalevertex(f.Blue, outer->Blue, B);
+		addvertex(f.Blue, outer->Magenta, r * B);
+		addvertex(f.Blue, outer->Cyan, g * B);
+		addvertex(f.Blue, outer->White, r * g * B);
+
+		f.Black	= outer->Black;
+		addvertex(f.Black, outer->Red, r);
+		addvertex(f.Black, outer->Green, g);
+		addvertex(f.Black, outer->Blue, b);
+		addvertex(f.Black, outer->Yellow, r * g);
+		addvertex(f.Black, outer->Magenta, r * b);
+		addvertex(f.Black, outer->Cyan, g * b);
+		addvertex(f.Black, outer->White, r * g * b);
+	}
+	else return NULL;
+
+	*output	= f;
+	return output;
+}
+
+unsigned int FRELIBA_CollapseFlutChain(KOLIBA_FLUT *fLuts, KOLIBA_FFLUT *output, const KOLIBA_FFLUT *input, unsigned int n, unsigned char srgb) {
+	unsigned int links = 0;
+
+	if ((fLuts == NULL) || (output == NULL) || (input == NULL)) return 0;
+
+	// Folding changes nothing, so only the exact identities go
+	// on the way in. Whatever merely comes close is left to
+	// prune, which knows how much the whole chain can afford.
+	for (; n; n--, input++) {
+		if ((allterms(input)) && (KOLIBA_IsIdentityFlut(input->fLut))) continue;
+
+		output[links++]	= *input;
+
+		// Folding two links together may let the result fold
+		// into the one before it, so we keep going back.
+		while ((links > 1) && (allterms(output + links - 2)) && (allterms(output + links - 1)) &&
+			(FRELIBA_ComposeFluts(fLuts + links - 2, output[links-2].fLut, output[links-1].fLut) != NULL)) {
+			links--;
+			output[links-1].fLut	= fLuts + links - 1;
+			output[links-1].flags	= KOLIBA_FlutFlags(fLuts + links - 1);
+
+			if (KOLIBA_IsIdentityFlut(fLuts + links - 1)) links--;
+		}
+	}
+
+	return prune(output, output, links, srgb);
+}
+
+KOLIBA_RGBA8PIXEL * FRELIBA_FastCopyRgba8Frame(FRELIBA_FASTFLUT *fast, KOLIBA_RGBA8PIXEL *outframe, const KOLIBA_RGBA8PIXEL *inframe, size_t count) {
+	// Not prepared, so the next FRELIBA_PrepareFastFlut
+	// will not mistake this for its cached FLUT.
+	fast->prepared	= 0;
+	fast->kind		= FRELIBA_FLUTIDENTITY;
+	return FRELIBA_CopyRgba8Frame(outframe, inframe, count);
+}
+
+unsigned int FRELIBA_PrepareFastFlut(FRELIBA_FASTFLUT *fast, const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags, unsigned char srgb) {
+	KOLIBA_RGBA8PIXEL in, out;
+	KOLIBA_FLUT swapped;
+	const double *iconv;
+	const unsigned char *oconv;
+	unsigned int i;
+
+	// Flags calculated from the FLUT itself have to be calculated
+	// anew from the swapped FLUT. Any other flags are one of Koliba's
+	// own constants (e.g., KOLIBA_MatrixFlutFlags), all of which treat
+	// red and blue alike, so they work for the swapped FLUT as is.
+	if (fast->bgra) {
+		if (flags == KOLIBA_FlutFlags(fLut)) flags = KOLIBA_FlutFlags(FRELIBA_SwapFlutRedBlue(&swapped, fLut));
+		else FRELIBA_SwapFlutRedBlue(&swapped, fLut);
+		fLut	= &swapped;
+	}
+
+	if ((fast->prepared) && (fast->srgb == srgb) && (fast->flags == flags) &&
+		(memcmp(&fast->fLut, fLut, sizeof(KOLIBA_FLUT)) == 0))
+		return fast->kind;
+
+	memcpy(&fast->fLut, fLut, sizeof(KOLIBA_FLUT));
+	fast->flags		= flags;
+	fast->srgb		= srgb;
+	fast->kind		= FRELIBA_ClassifyFlut(fLut, srgb);
+	fast->prepared	= 1;
+
+	if (srgb) {
+		iconv = KOLIBA_SrgbByteToLinear;
+		oconv = KOLIBA_LinearByteToSrgb;
+	}
+	else {
+		iconv = NULL;
+		oconv = NULL;
+	}
+
+	// We let Koliba itself calculate the output bytes, so the
+	// fast paths produce exactly what the per-pixel path would.
+	switch (fast->kind) {
+		case FRELIBA_FLUTCONSTANT:
+			in.r	= 0;
+			in.g	= 0;
+			in.b	= 0;
+			in.a	= 255;
+			KOLIBA_Rgba8Pixel(&fast->pixel, &in, &fast->fLut, flags, iconv, oconv);
+			break;
+		case FRELIBA_FLUTSEPARABLE:
+			// Since each channel only depends on itself,
+			// a ramp of grays gives us all three tables.
+			for (i = 0; i < 256; i++) {
+				in.r	= (unsigned char)i;
+				in.g	= (unsigned char)i;
+				in.b	= (unsigned char)i;
+				in.a	= 255;
+				KOLIBA_Rgba8Pixel(&out, &in, &fast->fLut, flags, iconv, oconv);
+				fast->lut[0][i]	= out.r;
+				fast->lut[1][i]	= out.g;
+				fast->lut[2][i]	= out.b;
+			}
+			break;
+	}
+
+	return fast->kind;
+}
+
+KOLIBA_RGBA8PIXEL * FRELIBA_FastRgba8Frame(const FRELIBA_FASTFLUT *fast, KOLIBA_RGBA8PIXEL *outframe, const KOLIBA_RGBA8PIXEL *inframe, size_t count) {
+	KOLIBA_RGBA8PIXEL *output = outframe;
+	const double *iconv;
+	const unsigned char *oconv;
+
+	switch (fast->kind) {
+		case FRELIBA_FLUTIDENTITY:
+			FRELIBA_CopyRgba8Frame(outframe, inframe, count);
+			break;
+		case FRELIBA_FLUTCONSTANT:
+			{
+				// A memset that leaves the alpha channel alone.
+				// These loops are simple enough for the compiler
+				// to vectorize.
+				const unsigned char r = fast->pixel.r, g = fast->pixel.g, b = fast->pixel.b;
+
+				if (outframe == inframe) for (; count; count--, outframe++) {
+					outframe->r	= r;
+					outframe->g	= g;
+					outframe->b	= b;
+				}
+				else for (; count; count--, inframe++, outframe++) {
+					outframe->r	= r;
+					outframe->g	= g;
+					outframe->b	= b;
+					outframe->a	= inframe->a;
+				}
+			}
+			break;
+		case FRELIBA_FLUTSEPARABLE:
+			{
+				const unsigned char *r = fast->lut[0], *g = fast->lut[1], *b = fast->lut[2];
+
+				for (; count; count--, inframe++, outframe++) {
+					outframe->r	= r[inframe->r];
+					outframe->g	= g[inframe->g];
+					outframe->b	= b[inframe->b];
+					outframe->a	= inframe->a;
+				}
+			}
+			break;
+		default:
+			if (fast->srgb) {
+				iconv = KOLIBA_SrgbByteToLinear;
+				oconv = KOLIBA_LinearByteToSrgb;
+			}
+			else {
+				iconv = NULL;
+				oconv = NULL;
+			}
+
+			for (; count; count--, inframe++, outframe++) {
+				KOLIBA_Rgba8Pixel(outframe, inframe, &fast->fLut, fast->flags, iconv, oconv)->a = inframe->a;
+			}
+			break;
+	}
+
+	return output;
+}
+
+KOLIBA_RGBA8PIXEL * FRELIBA_FlutRgba8Frame(FRELIBA_FASTFLUT *fast, KOLIBA_RGBA8PIXEL *outframe, const KOLIBA_RGBA8PIXEL *inframe, size_t count, const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags, unsigned char srgb) {
+	FRELIBA_PrepareFastFlut(fast, fLut, flags, srgb);
+	return FRELIBA_FastRgba8Frame(fast, outframe, inframe, count);
+}
+
+void FRELIBA_Rgba8Rows(FRELIBA_ROWS rows, void *instance, const KOLIBA_RGBA8PIXEL *inframe, ptrdiff_t instride, KOLIBA_RGBA8PIXEL *outframe, ptrdiff_t outstride, size_t width, size_t height) {
+	const ptrdiff_t packed = (ptrdiff_t)(width * sizeof(KOLIBA_RGBA8PIXEL));
+
+	if ((rows == NULL) || (inframe == NULL) || (outframe == NULL)) return;
+
+	if (instride == 0) instride = packed;
+	if (outstride == 0) outstride = packed;
+
+	if ((instride == packed) && (outstride == packed)) rows(instance, inframe, outframe, width * height);
+	else for (; height; height--) {
+		rows(instance, inframe, outframe, width);
+		inframe		= (const KOLIBA_RGBA8PIXEL *)((const char *)inframe + instride);
+		outframe	= (KOLIBA_RGBA8PIXEL *)((char *)outframe + outstride);
+	}
+}
+
+// Fills in count pixels, a chunk at a time, for FRELIBA_Bgra8Rows.
+#define	FRELIBA_CHUNK	1024
+
+static void bgra8run(FRELIBA_ROWS rows, void *instance, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe, size_t count) {
+	size_t n;
+
+	// Let the plug-in prepare itself even if there are no pixels.
+	if (count == 0) rows(instance, inframe, outframe, 0);
+	else for (; count; count -= n, inframe += n, outframe += n) {
+		n	= (count < FRELIBA_CHUNK) ? count : FRELIBA_CHUNK;
+		FRELIBA_SwapRgba8RedBlue(outframe, inframe, n);
+		rows(instance, outframe, outframe, n);
+		FRELIBA_SwapRgba8RedBlue(outframe, outframe, n);
+	}
+}
+
+void FRELIBA_Bgra8Rows(FRELIBA_ROWS rows, void *instance, const KOLIBA_RGBA8PIXEL *inframe, ptrdiff_t instride, KOLIBA_RGBA8PIXEL *outframe, ptrdiff_t outstride, size_t width, size_t height) {
+	const ptrdiff_t packed = (ptrdiff_t)(width * sizeof(KOLIBA_RGBA8PIXEL));
+
+	if ((rows == NULL) || (inframe == NULL) || (outframe == NULL)) return;
+
+	if (instride == 0) instride = packed;
+	if (outstride == 0) outstride = packed;
+
+	if ((instride == packed) && (outstride == packed)) bgra8run(rows, instance, inframe, outframe, width * height);
+	else for (; height; height--) {
+		bgra8run(rows, instance, inframe, outframe, width);
+		inframe		= (const KOLIBA_RGBA8PIXEL *)((const char *)inframe + instride);
+		outframe	= (KOLIBA_RGBA8PIXEL *)((char *)outframe + outstride);
+	}
+}
+
+// How many translucent pixels we process before mixing them.
+#define	MIXPIXELS	1024
+
+// Copies count pixels, unless they are already where they belong.
+static void keeppixels(KOLIBA_RGBA8PIXEL *outframe, const KOLIBA_RGBA8PIXEL *inframe, size_t count) {
+	if ((count) && (outframe != inframe)) memmove(outframe, inframe, count * sizeof(KOLIBA_RGBA8PIXEL));
+}
+
+// Goes through a row of a masked region, run by run.
+static void maskedrow(FRELIBA_ROWS rows, void *instance, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe, size_t count) {
+	KOLIBA_RGBA8PIXEL mixed[MIXPIXELS];
+	size_t n, i;
+	unsigned int a;
+
+	while (count) {
+		a	= inframe->a;
+
+		if ((a == 0) || (a == 255)) {
+			for (n = 1; (n < count) && (inframe[n].a == a); n++);
+			if (a) rows(instance, inframe, outframe, n);
+			else keeppixels(outframe, inframe, n);
+		}
+		else {
+			for (n = 1; (n < count) && (n < MIXPIXELS) && (inframe[n].a != 0) && (inframe[n].a != 255); n++);
+			rows(instance, inframe, mixed, n);
+
+			for (i = 0; i < n; i++) {
+				a	= inframe[i].a;
+				outframe[i].r	= (unsigned char)((inframe[i].r * (255 - a) + mixed[i].r * a + 127) / 255);
+				outframe[i].g	= (unsigned char)((inframe[i].g * (255 - a) + mixed[i].g * a + 127) / 255);
+				outframe[i].b	= (unsigned char)((inframe[i].b * (255 - a) + mixed[i].b * a + 127) / 255);
+				outframe[i].a	= (unsigned char)a;
+			}
+		}
+
+		inframe		+= n;
+		outframe	+= n;
+		count		-= n;
+	}
+}
+
+void FRELIBA_RegionRgba8Rows(FRELIBA_ROWS rows, void *instance, const FRELIBA_REGION *region, const KOLIBA_RGBA8PIXEL *inframe, ptrdiff_t instride, KOLIBA_RGBA8PIXEL *outframe, ptrdiff_t outstride, size_t width, size_t height) {
+	const ptrdiff_t packed = (ptrdiff_t)(width * sizeof(KOLIBA_RGBA8PIXEL));
+	size_t left, right, top, bottom, y;
+
+	if ((rows == NULL) || (inframe == NULL) || (outframe == NULL)) return;
+
+	if ((region == NULL) || (width == 0) || (height == 0)) {
+		FRELIBA_Rgba8Rows(rows, instance, inframe, instride, outframe, outstride, width, height);
+		return;
+	}
+
+	if (instride == 0) instride = packed;
+	if (outstride == 0) outstride = packed;
+
+	left	= (region->x < width) ? region->x : width;
+	right	= ((region->width) && (region->width < width - left)) ? left + region->width : width;
+	top		= (region->y < height) ? region->y : height;
+	bottom	= ((region->height) && (region->height < height - top)) ? top + region->height : height;
+
+	// Whole rows of the region can go in one call.
+	if ((!region->mask) && (left == 0) && (right == width) && (instride == packed) && (outstride == packed)) {
+		keeppixels(outframe, inframe, top * width);
+		rows(instance, inframe + top * width, outframe + top * width, (bottom - top) * width);
+		keeppixels(outframe + bottom * width, inframe + bottom * width, (height - bottom) * width);
+		return;
+	}
+
+	for (y = 0; y < height; y++) {
+		if ((y < top) || (y >= bottom)) keeppixels(outframe, inframe, width);
+		else {
+			keeppixels(outframe, inframe, left);
+			if (region->mask) maskedrow(rows, instance, inframe + left, outframe + left, right - left);
+			else if (right > left) rows(instance, inframe + left, outframe + left, right - left);
+			keeppixels(outframe + right, inframe + right, width - right);
+		}
+
+		inframe		= (const KOLIBA_RGBA8PIXEL *)((const char *)inframe + instride);
+		outframe	= (KOLIBA_RGBA8PIXEL *)((char *)outframe + outstride);
+	}
+}
+
+// The FLUT is a polynomial in r, g, and b. Swapping r and b
+// swaps the Red and Blue terms, as well as the Yellow (rg) and
+// Cyan (gb) terms, while Black, Magenta (rb) and White (rgb) stay
+// where they are. Then we also swap the red and blue outputs.
+#define	swapvertex(o, i)	{ (o).r = (i).b; (o).g = (i).g; (o).b = (i).r; }
+
+KOLIBA_FLUT * FRELIBA_SwapFlutRedBlue(KOLIBA_FLUT *output, const KOLIBA_FLUT *input) {
+	KOLIBA_FLUT f;
+
+	if ((output == NULL) || (input == NULL)) return NULL;
+
+	memcpy(&f, input, sizeof(KOLIBA_FLUT));
+
+	swapvertex(output->Black, f.Black);
+	swapvertex(output->Red, f.Blue);
+	swapvertex(output->Green, f.Green);
+	swapvertex(output->Blue, f.Red);
+	swapvertex(output->Yellow, f.Cyan);
+	swapvertex(output->Magenta, f.Magenta);
+	swapvertex(output->Cyan, f.Yellow);
+	swapvertex(output->White, f.White);
+
+	return output;
+}
+
+KOLIBA_RGBA8PIXEL * FRELIBA_SwapRgba8RedBlue(KOLIBA_RGBA8PIXEL *outframe, const KOLIBA_RGBA8PIXEL *inframe, size_t count) {
+	KOLIBA_RGBA8PIXEL *output = outframe;
+	unsigned char r;
+
+	for (; count; count--, inframe++, outframe++) {
+		r			= inframe->r;
+		outframe->r	= inframe->b;
+		outframe->g	= inframe->g;
+		outframe->b	= r;
+		outframe->a	= inframe->a;
+	}
+
+	return output;
+}
+
+// The sRGB tables for the RGBA64 paths. They are the same for
+// everyone, so they are built once, by whoever needs them first.
+static double srgbtolinear[65536];
+static float lineartosrgb[65537];
+
+static void buildsrgbtables(void) {
+	double v;
+	unsigned int i;
+
+	for (i = 0; i < 65536; i++) {
+		v	= (double)i / 65535.0;
+		srgbtolinear[i]	= (v <= 0.04045) ? v / 12.92 : pow((v + 0.055) / 1.055, 2.4);
+	}
+
+	// One extra entry so the interpolation never reads past the end.
+	for (i = 0; i < 65537; i++) {
+		v	= (double)i / 65535.0;
+		lineartosrgb[i]	= (float)(65535.0 * ((v <= 0.0031308) ? v * 12.92 : 1.055 * pow(v, 1.0/2.4) - 0.055));
+	}
+}
+
+#ifdef	_WIN32
+static INIT_ONCE srgbonce = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK srgbinit(PINIT_ONCE once, PVOID param, PVOID *context) {
+	buildsrgbtables();
+	return TRUE;
+}
+
+#define	srgbtables()	InitOnceExecuteOnce(&srgbonce, srgbinit, NULL, NULL)
+#else
+static pthread_once_t srgbonce = PTHREAD_ONCE_INIT;
+#define	srgbtables()	pthread_once(&srgbonce, buildsrgbtables)
+#endif
+
+static double decode16(unsigned short v, unsigned char srgb) {
+	return (srgb) ? srgbtolinear[v] : (double)v / 65535.0;
+}
+
+static unsigned short encode16(double v, unsigned char srgb) {
+	double i;
+
+	if (!(v > 0.0)) return 0;	// Also catches NaN.
+	if (v >= 1.0) return 65535;
+
+	if (srgb) {
+		v	*= 65535.0;
+		i	= floor(v);
+		v	= lineartosrgb[(unsigned int)i] + (v - i) * (lineartosrgb[(unsigned int)i + 1] - lineartosrgb[(unsigned int)i]);
+		return (unsigned short)(v + 0.5);
+	}
+
+	return (unsigned short)(v * 65535.0 + 0.5);
+}
+
+// What the FLUT does to one linear r, g, b triple. It is inline,
+// so the loops below can keep everything in registers (and the
+// compiler is free to vectorize them).
+static inline void flutxyz(double *out, const double *in, const KOLIBA_FLUT *fLut) {
+	const double r = in[0], g = in[1], b = in[2];
+	const double rg = r * g, rb = r * b, gb = g * b, rgb = rg * b;
+
+	out[0]	= fLut->Black.r + fLut->Red.r * r + fLut->Green.r * g + fLut->Blue.r * b
+			+ fLut->Yellow.r * rg + fLut->Magenta.r * rb + fLut->Cyan.r * gb + fLut->White.r * rgb;
+	out[1]	= fLut->Black.g + fLut->Red.g * r + fLut->Green.g * g + fLut->Blue.g * b
+			+ fLut->Yellow.g * rg + fLut->Magenta.g * rb + fLut->Cyan.g * gb + fLut->White.g * rgb;
+	out[2]	= fLut->Black.b + fLut->Red.b * r + fLut->Green.b * g + fLut->Blue.b * b
+			+ fLut->Yellow.b * rg + fLut->Magenta.b * rb + fLut->Cyan.b * gb + fLut->White.b * rgb;
+}
+
+FRELIBA_RGBA16PIXEL * FRELIBA_FlutRgba16Frame(FRELIBA_RGBA16PIXEL *outframe, const FRELIBA_RGBA16PIXEL *inframe, size_t count, const KOLIBA_FLUT *fLut, unsigned char srgb) {
+	FRELIBA_RGBA16PIXEL *output = outframe;
+	double xyz[2][3];
+
+	srgbtables();
+
+	for (; count; count--, inframe++, outframe++) {
+		xyz[0][0]	= decode16(inframe->r, srgb);
+		xyz[0][1]	= decode16(inframe->g, srgb);
+		xyz[0][2]	= decode16(inframe->b, srgb);
+
+		flutxyz(xyz[1], xyz[0], fLut);
+
+		outframe->r	= encode16(xyz[1][0], srgb);
+		outframe->g	= encode16(xyz[1][1], srgb);
+		outframe->b	= encode16(xyz[1][2], srgb);
+		outframe->a	= inframe->a;
+	}
+
+	return output;
+}
+
+FRELIBA_RGBA16PIXEL * FRELIBA_FastRgba16Frame(const FRELIBA_FASTFLUT *fast, FRELIBA_RGBA16PIXEL *outframe, const FRELIBA_RGBA16PIXEL *inframe, size_t count) {
+	FRELIBA_RGBA16PIXEL *output = outframe;
+	unsigned short r, g, b;
+
+	switch (fast->kind) {
+		case FRELIBA_FLUTIDENTITY:
+			// Near enough to the identity for 8 bits is not
+			// necessarily near enough for 16.
+			if ((!fast->prepared) || (FRELIBA_FlutDeviation(&fast->fLut) == 0.0)) {
+				if (outframe != inframe) memcpy(outframe, inframe, count * sizeof(FRELIBA_RGBA16PIXEL));
+			}
+			else FRELIBA_FlutRgba16Frame(outframe, inframe, count, &fast->fLut, fast->srgb);
+			break;
+		case FRELIBA_FLUTCONSTANT:
+			srgbtables();
+			r	= encode16(fast->fLut.Black.r, fast->srgb);
+			g	= encode16(fast->fLut.Black.g, fast->srgb);
+			b	= encode16(fast->fLut.Black.b, fast->srgb);
+
+			for (; count; count--, inframe++, outframe++) {
+				outframe->r	= r;
+				outframe->g	= g;
+				outframe->b	= b;
+				outframe->a	= inframe->a;
+			}
+			break;
+		default:
+			// The 8-bit tables of FRELIBA_FLUTSEPARABLE are too
+			// coarse for 16 bits, so it gets the full treatment.
+			FRELIBA_FlutRgba16Frame(outframe, inframe, count, &fast->fLut, fast->srgb);
+			break;
+	}
+
+	return output;
+}
+
+FRELIBA_RGBAFPIXEL * FRELIBA_FlutRgbafFrame(FRELIBA_RGBAFPIXEL *outframe, const FRELIBA_RGBAFPIXEL *inframe, size_t count, const KOLIBA_FLUT *fLut) {
+	FRELIBA_RGBAFPIXEL *output = outframe;
+	double xyz[2][3];
+
+	for (; count; count--, inframe++, outframe++) {
+		xyz[0][0]	= inframe->r;
+		xyz[0][1]	= inframe->g;
+		xyz[0][2]	= inframe->b;
+
+		flutxyz(xyz[1], xyz[0], fLut);
+
+		outframe->r	= (float)xyz[1][0];
+		outframe->g	= (float)xyz[1][1];
+		outframe->b	= (float)xyz[1][2];
+		outframe->a	= inframe->a;
+	}
+
+	return output;
+}
+
+FRELIBA_RGBAFPIXEL * FRELIBA_FastRgbafFrame(const FRELIBA_FASTFLUT *fast, FRELIBA_RGBAFPIXEL *outframe, const FRELIBA_RGBAFPIXEL *inframe, size_t count) {
+	FRELIBA_RGBAFPIXEL *output = outframe;
+	float r, g, b;
+
+	switch (fast->kind) {
+		case FRELIBA_FLUTIDENTITY:
+			// Near the identity in 8 bits is anything but
+			// near it in float.
+			if ((!fast->prepared) || (FRELIBA_FlutDeviation(&fast->fLut) == 0.0)) {
+				if (outframe != inframe) memcpy(outframe, inframe, count * sizeof(FRELIBA_RGBAFPIXEL));
+			}
+			else FRELIBA_FlutRgbafFrame(outframe, inframe, count, &fast->fLut);
+			break;
+		case FRELIBA_FLUTCONSTANT:
+			r	= (float)fast->fLut.Black.r;
+			g	= (float)fast->fLut.Black.g;
+			b	= (float)fast->fLut.Black.b;
+
+			for (; count; count--, inframe++, outframe++) {
+				outframe->r	= r;
+				outframe->g	= g;
+				outframe->b	= b;
+				outframe->a	= inframe->a;
+			}
+			break;
+		default:
+			FRELIBA_FlutRgbafFrame(outframe, inframe, count, &fast->fLut);
+			break;
+	}
+
+	return output;
+}
+
+// The luma weights of red and blue in each of the Y'CbCr matrices.
+static const double yuvkr[3] = {0.299, 0.2126, 0.2627};
+static const double yuvkb[3] = {0.114, 0.0722, 0.0593};
+
+static unsigned char yuvbyte(double v) {
+	return (v <= 0.0) ? 0 : (v >= 255.0) ? 255 : (unsigned char)(v + 0.5);
+}
+
+void FRELIBA_FastYuv8Frame(const FRELIBA_FASTFLUT *fast, unsigned char *const outplanes[3], const ptrdiff_t outstrides[3], const unsigned char *const inplanes[3], const ptrdiff_t instrides[3], size_t width, size_t height, unsigned int matrix, unsigned int xshift, unsigned int yshift, unsigned char full) {
+	KOLIBA_FLUT fLut;
+	const double kr = yuvkr[(matrix > FRELIBA_YUV2020) ? FRELIBA_YUV601 : matrix];
+	const double kb = yuvkb[(matrix > FRELIBA_YUV2020) ? FRELIBA_YUV601 : matrix];
+	const double kg = 1.0 - kr - kb;
+	const double yoff = (full) ? 0.0 : 16.0;
+	const double yscale = (full) ? 255.0 : 219.0;
+	const double cscale = (full) ? 255.0 : 224.0;
+	const size_t cwidth = (width + (((size_t)1 << xshift) - 1)) >> xshift;
+	const size_t cheight = (height + (((size_t)1 << yshift) - 1)) >> yshift;
+	const unsigned char *yin, *cbin, *crin;
+	unsigned char *yout, *cbout, *crout;
+	double rgb[2][3], y, cb, cr, cbsum, crsum;
+	size_t cx, cy, x, y0, y1, x0, x1, yy, n;
+	unsigned int i;
+
+	if (fast->kind == FRELIBA_FLUTIDENTITY) {
+		// Near enough for 8 bits, so nothing to do but copy
+		// what is not already there.
+		for (i = 0; i < 3; i++) {
+			n	= (i) ? cwidth : width;
+			for (yy = 0; yy < ((i) ? cheight : height); yy++)
+				if (outplanes[i] + yy * outstrides[i] != inplanes[i] + yy * instrides[i])
+					memcpy(outplanes[i] + yy * outstrides[i], inplanes[i] + yy * instrides[i], n);
+		}
+		return;
+	}
+
+	// The FASTFLUT is in the order the plug-in works in, but the
+	// matrices give us red first whatever that order is.
+	if (fast->bgra) FRELIBA_SwapFlutRedBlue(&fLut, &fast->fLut);
+	else fLut = fast->fLut;
+
+	srgbtables();
+
+	for (cy = 0; cy < cheight; cy++) {
+		y0		= cy << yshift;
+		y1		= y0 + ((size_t)1 << yshift);
+		if (y1 > height) y1 = height;
+		cbin	= inplanes[1] + cy * instrides[1];
+		crin	= inplanes[2] + cy * instrides[2];
+		cbout	= outplanes[1] + cy * outstrides[1];
+		crout	= outplanes[2] + cy * outstrides[2];
+
+		for (cx = 0; cx < cwidth; cx++) {
+			x0		= cx << xshift;
+			x1		= x0 + ((size_t)1 << xshift);
+			if (x1 > width) x1 = width;
+			cb		= ((double)cbin[cx] - 128.0) / cscale;
+			cr		= ((double)crin[cx] - 128.0) / cscale;
+			cbsum	= 0.0;
+			crsum	= 0.0;
+			n		= 0;
+
+			for (yy = y0; yy < y1; yy++) {
+				yin		= inplanes[0] + yy * instrides[0];
+				yout	= outplanes[0] + yy * outstrides[0];
+
+				for (x = x0; x < x1; x++, n++) {
+					y	= ((double)yin[x] - yoff) / yscale;
+
+					rgb[0][0]	= y + 2.0 * (1.0 - kr) * cr;
+					rgb[0][2]	= y + 2.0 * (1.0 - kb) * cb;
+					rgb[0][1]	= (y - kr * rgb[0][0] - kb * rgb[0][2]) / kg;
+
+					// Whatever the RGBA path would have
+					// made of these, in or out of sRGB.
+					for (i = 0; i < 3; i++) {
+						rgb[0][i]	= (rgb[0][i] <= 0.0) ? 0.0 : (rgb[0][i] >= 1.0) ? 1.0 : rgb[0][i];
+						if (fast->srgb) rgb[0][i] = decode16((unsigned short)(rgb[0][i] * 65535.0 + 0.5), 1);
+					}
+
+					flutxyz(rgb[1], rgb[0], &fLut);
+
+					for (i = 0; i < 3; i++)
+						rgb[1][i]	= (double)encode16(rgb[1][i], fast->srgb) / 65535.0;
+
+					y		= kr * rgb[1][0] + kg * rgb[1][1] + kb * rgb[1][2];
+					cbsum	+= (rgb[1][2] - y) / (2.0 * (1.0 - kb));
+					crsum	+= (rgb[1][0] - y) / (2.0 * (1.0 - kr));
+					yout[x]	= yuvbyte(yoff + y * yscale);
+				}
+			}
+
+			cbout[cx]	= yuvbyte(128.0 + cscale * cbsum / (double)n);
+			crout[cx]	= yuvbyte(128.0 + cscale * crsum / (double)n);
+		}
+	}
+}
+
+// Runs fn over planes 0 to planes, split into as many shares
+// as we have processors. Each call gets a share from k to end.
+typedef void (*PLANESFN)(void *data, unsigned int k, unsigned int end);
+
+typedef struct _PLANESJOB {
+	PLANESFN		fn;
+	void			*data;
+	unsigned int	k;
+	unsigned int	end;
+} PLANESJOB;
+
+#ifdef	_WIN32
+static DWORD WINAPI planesthread(LPVOID arg) {
+#else
+static void * planesthread(void *arg) {
+#endif
+	const PLANESJOB *job = (const PLANESJOB *)arg;
+
+	job->fn(job->data, job->k, job->end);
+	return 0;
+}
+
+static void inparallel(PLANESFN fn, void *data, unsigned int planes) {
+	PLANESJOB jobs[64];
+	unsigned int threads, t;
+#ifdef	_WIN32
+	HANDLE handles[64];
+	SYSTEM_INFO info;
+
+	GetSystemInfo(&info);
+	threads	= (unsigned int)info.dwNumberOfProcessors;
+#else
+	pthread_t handles[64];
+	long cpus;
+
+	cpus	= sysconf(_SC_NPROCESSORS_ONLN);
+	threads	= (cpus > 0) ? (unsigned int)cpus : 1;
+#endif
+	if (threads > 64) threads = 64;
+	if (threads > planes) threads = planes;
+	if (threads == 0) return;
+
+	for (t = 0; t < threads; t++) {
+		jobs[t].fn		= fn;
+		jobs[t].data	= data;
+		jobs[t].k		= planes * t / threads;
+		jobs[t].end		= planes * (t + 1) / threads;
+	}
+
+	// We do the first share ourselves, and whatever share
+	// we could not get a thread for.
+#ifdef	_WIN32
+	for (t = 1; t < threads; t++) if ((handles[t] = CreateThread(NULL, 0, planesthread, jobs + t, 0, NULL)) == NULL) planesthread(jobs + t);
+	planesthread(jobs);
+	for (t = 1; t < threads; t++) if (handles[t] != NULL) {
+		WaitForSingleObject(handles[t], INFINITE);
+		CloseHandle(handles[t]);
+	}
+#else
+	for (t = 1; t < threads; t++) if (pthread_create(handles + t, NULL, planesthread, jobs + t) != 0) {
+		planesthread(jobs + t);
+		jobs[t].fn	= NULL;
+	}
+	planesthread(jobs);
+	for (t = 1; t < threads; t++) if (jobs[t].fn != NULL) pthread_join(handles[t], NULL);
+#endif
+}
+
+typedef struct _LATTICEJOB {
+	FRELIBA_LATTICE	*lattice;
+	const float		*points;
+} LATTICEJOB;
+
+#define	latticevertex(o, p, q, s, t, u, v, w, x)	\
+	(o).r	= (double)(p)[0] - (double)(q)[0] - (double)(s)[0] + (double)(t)[0] - (double)(u)[0] + (double)(v)[0] + (double)(w)[0] - (double)(x)[0];	\
+	(o).g	= (double)(p)[1] - (double)(q)[1] - (double)(s)[1] + (double)(t)[1] - (double)(u)[1] + (double)(v)[1] + (double)(w)[1] - (double)(x)[1];	\
+	(o).b	= (double)(p)[2] - (double)(q)[2] - (double)(s)[2] + (double)(t)[2] - (double)(u)[2] + (double)(v)[2] + (double)(w)[2] - (double)(x)[2]
+
+static const float zeroes[3] = {0.0f, 0.0f, 0.0f};
+
+// Does the cells of the lattice from k to end (in the blue direction).
+static void latticecells(void *data, unsigned int k, unsigned int end) {
+	const LATTICEJOB *job = (const LATTICEJOB *)data;
+	const unsigned int size = job->lattice->size, cells = size - 1;
+	const size_t dg = (size_t)size * 3, db = (size_t)size * size * 3;
+	const float *p000, *p100, *p010, *p110, *p001, *p101, *p011, *p111, *z = zeroes;
+	KOLIBA_FLUT *f;
+	unsigned int i, j;
+
+	for (; k < end; k++) for (j = 0; j < cells; j++) {
+		f		= job->lattice->fLuts + ((size_t)k * cells + j) * cells;
+		p000	= job->points + (size_t)k * db + (size_t)j * dg;
+
+		for (i = 0; i < cells; i++, f++, p000 += 3) {
+			p100	= p000 + 3;
+			p010	= p000 + dg;
+			p110	= p010 + 3;
+			p001	= p000 + db;
+			p101	= p001 + 3;
+			p011	= p001 + dg;
+			p111	= p011 + 3;
+
+			// The usual trilinear interpolation, sorted
+			// out by the products of x, y and z.
+			latticevertex(f->Black, p000, z, z, z, z, z, z, z);
+			latticevertex(f->Red, p100, p000, z, z, z, z, z, z);
+			latticevertex(f->Green, p010, p000, z, z, z, z, z, z);
+			latticevertex(f->Blue, p001, p000, z, z, z, z, z, z);
+			latticevertex(f->Yellow, p110, p100, p010, p000, z, z, z, z);
+			latticevertex(f->Magenta, p101, p100, p001, p000, z, z, z, z);
+			latticevertex(f->Cyan, p011, p010, p001, p000, z, z, z, z);
+			latticevertex(f->White, p111, p110, p101, p100, p011, p010, p001, p000);
+		}
+	}
+}
+
+FRELIBA_LATTICE * FRELIBA_CreateLattice(const float *points, unsigned int size, const double *domainmin, const double *domainmax) {
+	FRELIBA_LATTICE *lattice;
+	LATTICEJOB job;
+	unsigned int cells, c, s, v, i;
+	double x, lo, hi;
+
+	if ((points == NULL) || (size < 2) || (size > FRELIBA_MAXLATTICE) || ((lattice = calloc(1, sizeof(FRELIBA_LATTICE))) == NULL)) return NULL;
+
+	cells			= size - 1;
+	lattice->size	= size;
+
+	if ((lattice->fLuts = malloc((size_t)cells * cells * cells * sizeof(KOLIBA_FLUT))) == NULL) {
+		free(lattice);
+		return NULL;
+	}
+
+	// Where each byte falls, clamped to the domain. The last
+	// point is in the last cell at 1, not in the next one at 0.
+	for (s = 0; s < 2; s++) for (c = 0; c < 3; c++) {
+		lo	= (domainmin != NULL) ? domainmin[c] : 0.0;
+		hi	= (domainmax != NULL) ? domainmax[c] : 1.0;
+		if (!(hi > lo)) {
+			lo	= 0.0;
+			hi	= 1.0;
+		}
+
+		for (v = 0; v < 256; v++) {
+			x	= (s) ? KOLIBA_SrgbByteToLinear[v] : (double)v / 255.0;
+			x	= (x - lo) / (hi - lo) * (double)cells;
+			x	= (x <= 0.0) ? 0.0 : (x >= (double)cells) ? (double)cells : x;
+			i	= (unsigned int)x;
+			if (i == cells) i--;
+			lattice->frac[s][c][v]		= x - (double)i;
+			lattice->offset[s][c][v]	= (c == 0) ? i : (c == 1) ? i * cells : i * cells * cells;
+		}
+	}
+
+	job.lattice	= lattice;
+	job.points	= points;
+	inparallel(latticecells, &job, cells);
+
+	return lattice;
+}
+
+void FRELIBA_DestroyLattice(FRELIBA_LATTICE *lattice) {
+	if (lattice != NULL) {
+		free(lattice->fLuts);
+		free(lattice);
+	}
+}
+
+KOLIBA_RGBA8PIXEL * FRELIBA_LatticeRgba8Frame(const FRELIBA_LATTICE *lattice, KOLIBA_RGBA8PIXEL *outframe, const KOLIBA_RGBA8PIXEL *inframe, size_t count, unsigned char srgb, unsigned char bgra) {
+	const unsigned int (*offset)[256] = lattice->offset[srgb != 0];
+	const double (*frac)[256] = lattice->frac[srgb != 0];
+	KOLIBA_RGBA8PIXEL *out = outframe;
+	unsigned char r, g, b, o[3];
+	double xyz[3], rgb[3];
+	unsigned int i;
+
+	for (; count; count--, inframe++, out++) {
+		if (bgra) {
+			r	= inframe->b;
+			b	= inframe->r;
+		}
+		else {
+			r	= inframe->r;
+			b	= inframe->b;
+		}
+		g	= inframe->g;
+
+		xyz[0]	= frac[0][r];
+		xyz[1]	= frac[1][g];
+		xyz[2]	= frac[2][b];
+		flutxyz(rgb, xyz, lattice->fLuts + offset[0][r] + offset[1][g] + offset[2][b]);
+
+		for (i = 0; i < 3; i++) {
+			if (!(rgb[i] > 0.0)) o[i] = 0;
+			else if (rgb[i] >= 1.0) o[i] = 255;
+			else o[i] = (srgb) ? KOLIBA_LinearByteToSrgb[(unsigned int)(rgb[i] * 65535.0 + 0.5)] : (unsigned char)(rgb[i] * 255.0 + 0.5);
+		}
+
+		out->r	= o[(bgra) ? 2 : 0];
+		out->g	= o[1];
+		out->b	= o[(bgra) ? 0 : 2];
+		out->a	= inframe->a;
+	}
+
+	return outframe;
+}
+
+// The lattices we have loaded, so instances asking for the same
+// file (or a copy of it) share one.
+static FRELIBA_LATTICE *lattices = NULL;
+
+#ifdef	_WIN32
+static SRWLOCK latticelock = SRWLOCK_INIT;
+#define	lockl()		AcquireSRWLockExclusive(&latticelock)
+#define	unlockl()	ReleaseSRWLockExclusive(&latticelock)
+#else
+static pthread_mutex_t latticelock = PTHREAD_MUTEX_INITIALIZER;
+#define	lockl()		pthread_mutex_lock(&latticelock)
+#define	unlockl()	pthread_mutex_unlock(&latticelock)
+#endif
+
+// FNV-1a, which is plenty to tell files apart.
+static uint64_t hashdata(const unsigned char *data, size_t size) {
+	uint64_t hash = 0xCBF29CE484222325ULL;
+
+	for (; size; size--, data++) hash	= (hash ^ *data) * 0x100000001B3ULL;
+	return hash;
+}
+
+FRELIBA_LATTICE * FRELIBA_LoadLattice(const char *path, FRELIBA_LATTICEPARSER parser) {
+	FRELIBA_LATTICE *lattice;
+	char *data;
+	size_t size;
+	uint64_t hash;
+#ifdef	_WIN32
+	FILE *f;
+	long len;
+
+	if ((path == NULL) || (parser == NULL) || ((f = fopen(path, "rb")) == NULL)) return NULL;
+	if ((fseek(f, 0, SEEK_END) != 0) || ((len = ftell(f)) <= 0) || (fseek(f, 0, SEEK_SET) != 0) ||
+		((data = malloc((size_t)len)) == NULL)) {
+		fclose(f);
+		return NULL;
+	}
+	size	= fread(data, 1, (size_t)len, f);
+	fclose(f);
+#else
+	struct stat st;
+	int fd;
+
+	if ((path == NULL) || (parser == NULL) || ((fd = open(path, O_RDONLY)) < 0)) return NULL;
+	if ((fstat(fd, &st) != 0) || (st.st_size <= 0) ||
+		((data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)) {
+		close(fd);
+		return NULL;
+	}
+	close(fd);
+	size	= (size_t)st.st_size;
+#endif
+
+	hash	= hashdata((const unsigned char *)data, size);
+
+	lockl();
+	for (lattice = lattices; lattice != NULL; lattice = lattice->next)
+		if ((lattice->hash == hash) && (lattice->parser == (const void *)parser)) break;
+	if (lattice != NULL) lattice->refs++;
+	unlockl();
+
+	// We parse without holding the lock, as it may take a while.
+	// If someone else loads the same file meanwhile, we end up
+	// with two copies, which is wasteful but harmless.
+	if ((lattice == NULL) && ((lattice = parser(data, size)) != NULL)) {
+		lattice->parser	= (const void *)parser;
+		lattice->hash	= hash;
+		lattice->refs	= 1;
+		lockl();
+		lattice->next	= lattices;
+		lattices		= lattice;
+		unlockl();
+	}
+
+#ifdef	_WIN32
+	free(data);
+#else
+	munmap(data, size);
+#endif
+
+	return lattice;
+}
+
+void FRELIBA_ReleaseLattice(FRELIBA_LATTICE *lattice) {
+	FRELIBA_LATTICE **l;
+
+	if (lattice == NULL) return;
+
+	lockl();
+	if (--lattice->refs == 0) {
+		for (l = &lattices; (*l != NULL) && (*l != lattice); l = &(*l)->next);
+		if (*l != NULL) *l = lattice->next;
+	}
+	else lattice = NULL;
+	unlockl();
+
+	FRELIBA_DestroyLattice(lattice);
+}
+
+int FRELIBA_FileStamp(const char *path, FRELIBA_FILESTAMP *stamp) {
+#ifdef	_WIN32
+	struct __stat64 st;
+
+	if ((path == NULL) || (_stat64(path, &st) != 0)) {
+#else
+	struct stat st;
+
+	if ((path == NULL) || (stat(path, &st) != 0)) {
+#endif
+		stamp->mtime	= 0;
+		stamp->size		= 0;
+		return -1;
+	}
+
+#ifdef	__linux__
+	stamp->mtime	= (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+#else
+	stamp->mtime	= (long long)st.st_mtime * 1000000000LL;
+#endif
+	stamp->size		= (long long)st.st_size;
+	return 0;
+}
+
+int FRELIBA_FileChanged(const char *path, const FRELIBA_FILESTAMP *stamp) {
+	FRELIBA_FILESTAMP now;
+
+	FRELIBA_FileStamp(path, &now);
+	return (now.mtime != stamp->mtime) || (now.size != stamp->size);
+}
+
+typedef struct _SAMPLEJOB {
+	float						*points;
+	const FRELIBA_FASTFLUT		*const *fasts;
+	unsigned int				n;
+	unsigned int				size;
+} SAMPLEJOB;
+
+static double srgbdecode(double v) {
+	return (v <= 0.04045) ? v / FRELIBA_SRGBSLOPE : pow((v + 0.055) / 1.055, 2.4);
+}
+
+static double srgbencode(double v) {
+	return (v <= 0.0031308) ? v * FRELIBA_SRGBSLOPE : 1.055 * pow(v, 1.0/2.4) - 0.055;
+}
+
+// Samples the planes of the grid from k to end (in the blue direction).
+static void samplepoints(void *data, unsigned int k, unsigned int end) {
+	const SAMPLEJOB *job = (const SAMPLEJOB *)data;
+	const FRELIBA_FASTFLUT *fast;
+	const double last = (double)(job->size - 1);
+	float *p = job->points + (size_t)k * job->size * job->size * 3;
+	double xyz[3], rgb[3], t;
+	unsigned int i, j, e, c;
+
+	for (; k < end; k++) for (j = 0; j < job->size; j++) for (i = 0; i < job->size; i++, p += 3) {
+		xyz[0]	= (double)i / last;
+		xyz[1]	= (double)j / last;
+		xyz[2]	= (double)k / last;
+
+		// Each effect sees what it would see in a frame: its
+		// own channel order, sRGB if it says so, and nothing
+		// outside the 0-1 range.
+		for (e = 0; e < job->n; e++) {
+			fast	= job->fasts[e];
+			if (fast->kind == FRELIBA_FLUTIDENTITY) continue;
+
+			if (fast->bgra) {
+				t		= xyz[0];
+				xyz[0]	= xyz[2];
+				xyz[2]	= t;
+			}
+			if (fast->srgb) for (c = 0; c < 3; c++) xyz[c] = srgbdecode(xyz[c]);
+
+			flutxyz(rgb, xyz, &fast->fLut);
+
+			for (c = 0; c < 3; c++) {
+				xyz[c]	= (!(rgb[c] > 0.0)) ? 0.0 : (rgb[c] >= 1.0) ? 1.0 : rgb[c];
+				if (fast->srgb) xyz[c] = srgbencode(xyz[c]);
+			}
+			if (fast->bgra) {
+				t		= xyz[0];
+				xyz[0]	= xyz[2];
+				xyz[2]	= t;
+			}
+		}
+
+		p[0]	= (float)xyz[0];
+		p[1]	= (float)xyz[1];
+		p[2]	= (float)xyz[2];
+	}
+}
+
+float * FRELIBA_SampleFastFluts(float *points, unsigned int size, const FRELIBA_FASTFLUT *const *fasts, unsigned int n) {
+	SAMPLEJOB job;
+
+	if ((points == NULL) || (size < 2) || ((n) && (fasts == NULL))) return NULL;
+
+	job.points	= points;
+	job.fasts	= fasts;
+	job.n		= n;
+	job.size	= size;
+	inparallel(samplepoints, &job, size);
+
+	return points;
+}
@@ -0,0 +1,400 @@
+/*
+	freliba.h
+
+	Copyright 2021 G. Adam Stanislav.
+	All rights reserved.
+
+	http://www.pantarheon.org
+
+	Helper routines shared by the freliba plug-ins. Each
+	plug-in is still a complete example of how to use
+	Koliba, but some of the bookkeeping around the Koliba
+	calls (deciding whether an effect does anything at all,
+	copying frames) is the same everywhere, so it lives
+	here and is linked into every plug-in as freliba.o.
+*/
+
+#ifndef	_FRELIBA_H_
+#define	_FRELIBA_H_
+
+#include	<koliba.h>
+#include	<stddef.h>
+#include	<stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Half of the least significant bit of an 8-bit channel,
+// expressed in the 0-1 range Koliba works in.
+#define	FRELIBA_HALFLSB		(0.5/255.0)
+
+// The steepest slope of the linear-to-sRGB conversion
+// (its linear segment near black). In an sRGB environment
+// a linear error gets multiplied by up to this much before
+// it reaches the output byte.
+#define	FRELIBA_SRGBSLOPE	12.92
+
+// The frei0r color model the plug-in is built for. Koliba
+// itself only knows the RGBA order. When the plug-ins are
+// compiled with FRELIBA_BGRA defined, they work on BGRA
+// pixels instead. Most of them do it for free, by swapping
+// the roles of red and blue in their FLUTs, so the very same
+// Koliba kernels produce BGRA output from BGRA input.
+#define	FRELIBA_MODEL_BGRA8888	0
+#define	FRELIBA_MODEL_RGBA8888	1
+#define	FRELIBA_MODEL_PACKED32	2
+
+#ifdef	FRELIBA_BGRA
+#define	FRELIBA_COLOR_MODEL		FRELIBA_MODEL_BGRA8888
+#define	FRELIBA_NAME_SUFFIX		" (BGRA)"
+#else
+#define	FRELIBA_COLOR_MODEL		FRELIBA_MODEL_RGBA8888
+#define	FRELIBA_NAME_SUFFIX		""
+#endif
+
+// What a FLUT reduces to. FRELIBA_FLUTGENERAL needs the full
+// per-pixel Koliba treatment. FRELIBA_FLUTCONSTANT ignores its
+// input altogether (other than alpha), so the whole frame gets
+// filled with one color. FRELIBA_FLUTSEPARABLE has no products
+// of channels and no cross-channel terms, so each output channel
+// only depends on the same input channel, and can be looked up
+// in a 256-byte table, no matter whether we are in sRGB or not.
+#define	FRELIBA_FLUTGENERAL		0
+#define	FRELIBA_FLUTIDENTITY	1
+#define	FRELIBA_FLUTCONSTANT	2
+#define	FRELIBA_FLUTSEPARABLE	3
+
+// A FLUT prepared for the fast paths. It keeps its own copy
+// of the FLUT, its flags and the sRGB setting, so it knows
+// on its own when it needs to be prepared again.
+typedef struct _FRELIBA_FASTFLUT {
+	KOLIBA_FLUT			fLut;
+	KOLIBA_FLAGS		flags;
+	unsigned int		kind;
+	KOLIBA_RGBA8PIXEL	pixel;		// FRELIBA_FLUTCONSTANT
+	unsigned char		lut[3][256];	// FRELIBA_FLUTSEPARABLE
+	unsigned char		srgb;
+	unsigned char		prepared;
+	unsigned char		bgra;
+} FRELIBA_FASTFLUT;
+
+// A pixel with 16 bits per channel (RGBA64), in the same order
+// as KOLIBA_RGBA8PIXEL (or BGRA in BGRA builds).
+typedef struct _FRELIBA_RGBA16PIXEL {
+	unsigned short	r;
+	unsigned short	g;
+	unsigned short	b;
+	unsigned short	a;
+} FRELIBA_RGBA16PIXEL;
+
+// A pixel of 32-bit floats, linear, in the same order as the above.
+typedef struct _FRELIBA_RGBAFPIXEL {
+	float	r;
+	float	g;
+	float	b;
+	float	a;
+} FRELIBA_RGBAFPIXEL;
+
+// Returns an upper bound of how far the output of the FLUT
+// can be from its input anywhere within the unit cube.
+// Since every FLUT term is a product of r, g, and b, each
+// of which lies in the 0-1 range, no term can contribute
+// more than its own coefficient does.
+double FRELIBA_FlutDeviation(const KOLIBA_FLUT *fLut);
+
+// Returns non-zero if the FLUT cannot change any channel of
+// any pixel by more than half of the least significant bit.
+// That includes the exact identity FLUT. The srgb argument
+// tells us whether the output will be converted to sRGB.
+int FRELIBA_IsNearIdentityFlut(const KOLIBA_FLUT *fLut, unsigned char srgb);
+
+// The same for a FLUT that has been scaled by KOLIBA_ScaleFlut
+// to 255.0 for use with KOLIBA_ScaledRgba8Pixel and friends.
+int FRELIBA_IsNearIdentityScaledFlut(const KOLIBA_FLUT *fLut, unsigned char srgb);
+
+// Copies the chain of FLUTs from input to output, leaving
+// out the links that are near-identity FLUTs, as long as all
+// of them together cannot change the output of the chain by
+// more than half of the least significant bit (each one's
+// deviation stretched by the links kept after it). Returns
+// the number of links left in the output, which can be 0, in
+// which case the whole chain does nothing. The output must
+// have room for n links and must not overlap the input. The
+// bound only holds if nothing but the conversion to sRGB comes
+// after the chain: a chain followed by any other nonlinear
+// stage should only drop exact identities.
+unsigned int FRELIBA_PruneFlutChain(KOLIBA_FFLUT *output, const KOLIBA_FFLUT *input, unsigned int n, unsigned char srgb);
+
+// Tells us which of the FRELIBA_FLUT* kinds the FLUT is.
+unsigned int FRELIBA_ClassifyFlut(const KOLIBA_FLUT *fLut, unsigned char srgb);
+
+// Marks the FRELIBA_FASTFLUT as not prepared yet, and tells it
+// which color model it works in. FRELIBA_InitFastFlut picks the
+// model the plug-in is built for. Call it once when constructing
+// an instance.
+FRELIBA_FASTFLUT * FRELIBA_InitFastFlutModel(FRELIBA_FASTFLUT *fast, unsigned int model);
+#define	FRELIBA_InitFastFlut(fast)	FRELIBA_InitFastFlutModel(fast, FRELIBA_COLOR_MODEL)
+
+// Classifies the FLUT and builds whatever tables its kind needs,
+// unless it has already been done for this very FLUT, flags and
+// sRGB setting. Returns the kind. In the BGRA model, the FLUT is
+// given in the usual RGBA terms and converted here.
+unsigned int FRELIBA_PrepareFastFlut(FRELIBA_FASTFLUT *fast, const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags, unsigned char srgb);
+
+// Applies a prepared FRELIBA_FASTFLUT to count pixels, using
+// the cheapest method its kind allows. Alpha is passed through.
+KOLIBA_RGBA8PIXEL * FRELIBA_FastRgba8Frame(const FRELIBA_FASTFLUT *fast, KOLIBA_RGBA8PIXEL *outframe, const KOLIBA_RGBA8PIXEL *inframe, size_t count);
+
+// Returns non-zero if the FLUT is affine, i.e., a matrix: its
+// Yellow, Magenta, Cyan and White terms are all 0.
+int FRELIBA_IsMatrixFlut(const KOLIBA_FLUT *fLut);
+
+// Returns non-zero if the FLUT is a matrix that treats each
+// channel on its own, i.e., it only scales and offsets them.
+int FRELIBA_IsSeparableFlut(const KOLIBA_FLUT *fLut);
+
+// Sets output to the FLUT that does what inner followed by outer
+// does. That is only one FLUT when outer is a matrix or inner is
+// separable (see above), so that is all this does: it returns
+// NULL otherwise. The output may be the same as either input.
+KOLIBA_FLUT * FRELIBA_ComposeFluts(KOLIBA_FLUT *output, const KOLIBA_FLUT *inner, const KOLIBA_FLUT *outer);
+
+// Does what FRELIBA_PruneFlutChain does, and also folds together
+// any adjacent links FRELIBA_ComposeFluts can, as long as their
+// flags let Koliba use all of their terms. The folded FLUTs go
+// to fLuts, with room for n of them, which must not be where
+// any input link points. Their flags are calculated anew. The
+// order of the links never changes, so the output chain does
+// exactly what the input does, only in fewer steps.
+unsigned int FRELIBA_CollapseFlutChain(KOLIBA_FLUT *fLuts, KOLIBA_FFLUT *output, const KOLIBA_FFLUT *input, unsigned int n, unsigned char srgb);
+
+// Marks the FRELIBA_FASTFLUT as doing nothing at all and copies
+// count pixels from inframe to outframe. Plug-ins that skip their
+// FLUT altogether at some settings (e.g., when the efficacy is 0)
+// call this instead of FRELIBA_CopyRgba8Frame, so their FASTFLUT
+// always describes what they did to the last frame.
+KOLIBA_RGBA8PIXEL * FRELIBA_FastCopyRgba8Frame(FRELIBA_FASTFLUT *fast, KOLIBA_RGBA8PIXEL *outframe, const KOLIBA_RGBA8PIXEL *inframe, size_t count);
+
+// Both of the above in one call. This is what most plug-ins
+// with a single FLUT use in their f0r_update.
+KOLIBA_RGBA8PIXEL * FRELIBA_FlutRgba8Frame(FRELIBA_FASTFLUT *fast, KOLIBA_RGBA8PIXEL *outframe, const KOLIBA_RGBA8PIXEL *inframe, size_t count, const KOLIBA_FLUT *fLut, KOLIBA_FLAGS flags, unsigned char srgb);
+
+// What each plug-in does to count consecutive pixels. The
+// instance is whatever the plug-in's f0r_construct returned.
+typedef void (*FRELIBA_ROWS)(void *instance, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe, size_t count);
+
+// Runs rows over a frame of width by height pixels, whose rows
+// start instride and outstride bytes apart (0 means the rows are
+// packed, i.e., width pixels apart). When the rows of both frames
+// are packed, the whole frame is processed in one call. That
+// includes a frame of 0 pixels, which lets the plug-in prepare
+// itself without processing anything.
+//
+// Every plug-in exports
+//
+//	void freliba_update(f0r_instance_t instance, double time,
+//		const KOLIBA_RGBA8PIXEL *inframe, ptrdiff_t instride,
+//		KOLIBA_RGBA8PIXEL *outframe, ptrdiff_t outstride,
+//		size_t width, size_t height);
+//
+// which does this, so a host can feed it frames of any size
+// without reconstructing the instance. The width and height
+// given to f0r_construct only matter to f0r_update.
+void FRELIBA_Rgba8Rows(FRELIBA_ROWS rows, void *instance, const KOLIBA_RGBA8PIXEL *inframe, ptrdiff_t instride, KOLIBA_RGBA8PIXEL *outframe, ptrdiff_t outstride, size_t width, size_t height);
+
+// The same as FRELIBA_Rgba8Rows, but for plug-ins whose Koliba
+// kernels cannot be told about the BGRA order (e.g., Lumidux,
+// whose luma weights are fixed, or the fly grids, which are
+// indexed by red first). It swaps red and blue before and after
+// calling rows, a cache-sized chunk of pixels at a time, so the
+// pixels are still in the cache when they are swapped back.
+void FRELIBA_Bgra8Rows(FRELIBA_ROWS rows, void *instance, const KOLIBA_RGBA8PIXEL *inframe, ptrdiff_t instride, KOLIBA_RGBA8PIXEL *outframe, ptrdiff_t outstride, size_t width, size_t height);
+
+// A part of the frame: the rectangle of width by height pixels
+// whose top left corner is at x, y (a width or height of 0 means
+// all the way to the edge of the frame), and if mask is not 0, only
+// as much of it as the alpha of each pixel says (0 not at all, 255
+// fully, anything between a mix of the pixel before and after).
+typedef struct _FRELIBA_REGION {
+	size_t			x;
+	size_t			y;
+	size_t			width;
+	size_t			height;
+	unsigned char	mask;
+} FRELIBA_REGION;
+
+// Like FRELIBA_Rgba8Rows, but rows only gets the pixels in the
+// region, so power windows and masked grades only cost as much
+// as the area they cover. All other pixels are copied, or left
+// alone altogether when the frame is processed in place. With
+// mask, runs of opaque pixels go to rows as they are, and runs
+// of translucent ones a chunk at a time, to be mixed afterwards.
+// A NULL region is the whole frame.
+void FRELIBA_RegionRgba8Rows(FRELIBA_ROWS rows, void *instance, const FRELIBA_REGION *region, const KOLIBA_RGBA8PIXEL *inframe, ptrdiff_t instride, KOLIBA_RGBA8PIXEL *outframe, ptrdiff_t outstride, size_t width, size_t height);
+
+// What such plug-ins call from their freliba_update.
+#ifdef	FRELIBA_BGRA
+#define	FRELIBA_RgbaOnlyRows	FRELIBA_Bgra8Rows
+#else
+#define	FRELIBA_RgbaOnlyRows	FRELIBA_Rgba8Rows
+#endif
+
+// Swaps the roles of red and blue in a FLUT, so it does to BGRA
+// pixels what the original does to RGBA pixels. The output may
+// be the same as the input. Returns the output.
+KOLIBA_FLUT * FRELIBA_SwapFlutRedBlue(KOLIBA_FLUT *output, const KOLIBA_FLUT *input);
+
+// Swaps red and blue in count pixels. The output may be the
+// same as the input. Returns the output.
+KOLIBA_RGBA8PIXEL * FRELIBA_SwapRgba8RedBlue(KOLIBA_RGBA8PIXEL *outframe, const KOLIBA_RGBA8PIXEL *inframe, size_t count);
+
+// Converts a FLUT the plug-in has just calculated in RGBA terms
+// (or a palette of pixels) to the order the plug-in is built
+// for, in place. In RGBA builds they do nothing at all.
+#ifdef	FRELIBA_BGRA
+#define	FRELIBA_OrderFlut(fLut)				FRELIBA_SwapFlutRedBlue(fLut, fLut)
+#define	FRELIBA_OrderRgba8(pixels, count)	((void)FRELIBA_SwapRgba8RedBlue(pixels, pixels, count))
+#else
+#define	FRELIBA_OrderFlut(fLut)				(fLut)
+#define	FRELIBA_OrderRgba8(pixels, count)	((void)0)
+#endif
+
+// The RGBA64 paths. Koliba only works with 8-bit pixels, so we
+// evaluate the FLUTs ourselves, in double, same as Koliba does
+// internally. In sRGB mode the input goes through a 65536-entry
+// table, the output through an interpolated one. The flags are
+// not consulted, and that is only safe when they cover all the
+// terms: flags that leave some out (such as the matrix flags on
+// a FLUT that is not a matrix) have Koliba ignore those terms
+// even when they are not 0. FRELIBA_FastFlutAllTerms tells the
+// two apart, and the callers must not hand these paths a FASTFLUT
+// for which it returns 0.
+//
+// FRELIBA_FastRgba16Frame applies whatever a plug-in last did
+// with its FRELIBA_FASTFLUT. Plug-ins export
+//
+//	const FRELIBA_FASTFLUT * freliba_fastflut(f0r_instance_t instance);
+//
+// which returns their FASTFLUT, or NULL if they do not use one.
+int FRELIBA_FastFlutAllTerms(const FRELIBA_FASTFLUT *fast);
+FRELIBA_RGBA16PIXEL * FRELIBA_FastRgba16Frame(const FRELIBA_FASTFLUT *fast, FRELIBA_RGBA16PIXEL *outframe, const FRELIBA_RGBA16PIXEL *inframe, size_t count);
+FRELIBA_RGBA16PIXEL * FRELIBA_FlutRgba16Frame(FRELIBA_RGBA16PIXEL *outframe, const FRELIBA_RGBA16PIXEL *inframe, size_t count, const KOLIBA_FLUT *fLut, unsigned char srgb);
+
+// The float paths, for scene-linear pixels. These use the same
+// evaluator as the RGBA64 paths, but there is nothing to decode
+// or encode: the pixels already are linear, so the sRGB setting
+// of a plug-in does not apply, and nothing gets clamped, so values
+// below 0 or above 1 go through the FLUT the same as any other.
+FRELIBA_RGBAFPIXEL * FRELIBA_FastRgbafFrame(const FRELIBA_FASTFLUT *fast, FRELIBA_RGBAFPIXEL *outframe, const FRELIBA_RGBAFPIXEL *inframe, size_t count);
+FRELIBA_RGBAFPIXEL * FRELIBA_FlutRgbafFrame(FRELIBA_RGBAFPIXEL *outframe, const FRELIBA_RGBAFPIXEL *inframe, size_t count, const KOLIBA_FLUT *fLut);
+
+// The planar Y'CbCr path, 8 bits per sample. The three planes
+// (Y, Cb, Cr) are converted to R'G'B' with the chosen matrix, go
+// through the FASTFLUT (linearized first if it works in sRGB, as
+// the plug-ins do), are clamped, and go back to Y'CbCr, all in
+// one pass. The chroma planes are subsampled xshift and yshift
+// times horizontally and vertically (so 0, 0 is 4:4:4, 1, 0 is
+// 4:2:2, and 1, 1 is 4:2:0). Each chroma sample is shared by all
+// the luma samples it covers, and gets their average back.
+// Planes may be processed in place. If full is 0, the samples
+// use the video range (16-235 and 16-240).
+#define	FRELIBA_YUV601	0
+#define	FRELIBA_YUV709	1
+#define	FRELIBA_YUV2020	2
+
+void FRELIBA_FastYuv8Frame(const FRELIBA_FASTFLUT *fast, unsigned char *const outplanes[3], const ptrdiff_t outstrides[3], const unsigned char *const inplanes[3], const ptrdiff_t instrides[3], size_t width, size_t height, unsigned int matrix, unsigned int xshift, unsigned int yshift, unsigned char full);
+
+// The FRELIBA_FASTFLUT of an effect created by libfreliba, after
+// it has been brought up to date, or NULL if it does not use one.
+// It lives in libfreliba.c, since only that knows what an effect
+// is, so only code linked with libfreliba can use it.
+struct _FRELIBA;
+const FRELIBA_FASTFLUT * FRELIBA_EffectFastFlut(struct _FRELIBA *fx);
+
+// How many pixels a chain of effects works on at a time: 64 KiB
+// of them, so a tile can be read, worked on by every effect, and
+// written while it stays in the L2 cache.
+#define	FRELIBA_TILEPIXELS	16384
+
+// A 3D LUT of size points along each axis (with red changing
+// fastest, as in .cube and Hald files), turned into one FLUT per
+// cell of the lattice. Each FLUT maps the position within its
+// cell (0-1 along each axis) to the output, which is exactly the
+// trilinear interpolation of the eight points at its corners.
+// The tables tell us in which cell each byte of each channel
+// falls, and where within it, both as is and decoded from sRGB.
+typedef struct _FRELIBA_LATTICE {
+	KOLIBA_FLUT		*fLuts;
+	unsigned int	size;
+	unsigned int	offset[2][3][256];
+	double			frac[2][3][256];
+	// The rest is for FRELIBA_LoadLattice.
+	const void		*parser;
+	uint64_t		hash;
+	unsigned int	refs;
+	struct _FRELIBA_LATTICE	*next;
+} FRELIBA_LATTICE;
+
+// The most points along each axis of a lattice. Every cell is a
+// FLUT of 192 bytes, so 65 points (the most common big .cube
+// size) take 64 * 64 * 64 cells, or 48 MiB, while 256 points
+// would take almost 3 GiB.
+#define	FRELIBA_MAXLATTICE	65
+
+// Creates a lattice from size x size x size r, g, b points.
+// The domain (what input the first and the last points stand
+// for) is 0 to 1 unless domainmin and domainmax say otherwise.
+// The FLUTs are calculated by several threads at once. Returns
+// NULL if size is less than 2 or more than FRELIBA_MAXLATTICE,
+// or if there is not enough memory.
+FRELIBA_LATTICE * FRELIBA_CreateLattice(const float *points, unsigned int size, const double *domainmin, const double *domainmax);
+void FRELIBA_DestroyLattice(FRELIBA_LATTICE *lattice);
+
+// Applies the lattice to count pixels. With srgb, the pixels
+// are linearized before the lookup and converted back to sRGB
+// after it. With bgra, the pixels are BGRA, but the lattice
+// is still indexed by red first.
+KOLIBA_RGBA8PIXEL * FRELIBA_LatticeRgba8Frame(const FRELIBA_LATTICE *lattice, KOLIBA_RGBA8PIXEL *outframe, const KOLIBA_RGBA8PIXEL *inframe, size_t count, unsigned char srgb, unsigned char bgra);
+
+// Makes a lattice of the contents of a file, or returns NULL.
+typedef FRELIBA_LATTICE * (*FRELIBA_LATTICEPARSER)(const char *data, size_t size);
+
+// Maps the file to memory and has the parser make a lattice of
+// it, unless we already have one made of the same contents by
+// the same parser, which we then share. Release it when done.
+FRELIBA_LATTICE * FRELIBA_LoadLattice(const char *path, FRELIBA_LATTICEPARSER parser);
+void FRELIBA_ReleaseLattice(FRELIBA_LATTICE *lattice);
+
+// When a file was last modified, and how big it was then, so the
+// plug-ins reading one can tell when it changes under them.
+typedef struct _FRELIBA_FILESTAMP {
+	long long	mtime;		// In nanoseconds
+	long long	size;
+} FRELIBA_FILESTAMP;
+
+// Takes the stamp of the file. Returns 0, or -1 if there is no file
+// (with the stamp then all zeros).
+int FRELIBA_FileStamp(const char *path, FRELIBA_FILESTAMP *stamp);
+
+// Returns 1 if the file no longer matches its stamp, 0 if it does.
+int FRELIBA_FileChanged(const char *path, const FRELIBA_FILESTAMP *stamp);
+
+// The other way around: fills points with a size x size x size
+// lattice (red changing fastest) of what n FASTFLUTs, one after
+// the other, do to the colors from 0 to 1, each the way it does
+// it to a frame (linearizing sRGB first if it is set, and in its
+// own channel order), but without rounding anything to bytes.
+// The planes of the lattice are calculated by several threads.
+float * FRELIBA_SampleFastFluts(float *points, unsigned int size, const FRELIBA_FASTFLUT *const *fasts, unsigned int n);
+
+// Copies count pixels from inframe to outframe. When the host
+// processes the frame in place (inframe == outframe), there
+// is nothing to copy at all.
+KOLIBA_RGBA8PIXEL * FRELIBA_CopyRgba8Frame(KOLIBA_RGBA8PIXEL *outframe, const KOLIBA_RGBA8PIXEL *inframe, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	// _FRELIBA_H_
@@ -0,0 +1,254 @@
+/*
+	hald.c
+
+	Copyright 2021 G. Adam Stanislav.
+	All rights reserved.
+
+	http://www.pantarheon.org
+
+	This is a frei0r-compatible plug-in, applying a Hald CLUT,
+	i.e., a 3D LUT stored as an image, from a binary PPM file
+	(8 or 16 bits per sample). It decodes the image once, and
+	again whenever its path or the file itself changes, turning
+	every cell of the LUT into a FLUT, so each pixel only costs
+	a table lookup and one FLUT. All instances using the same
+	image share the same FLUTs.
+
+	A Hald CLUT of level L has L * L points along each axis, and
+	each cell between them takes 192 bytes, so level 8 (the
+	highest we accept, with 64 points) takes 46 MiB. Level 16
+	would take almost 3 GiB, so we refuse it.
+
+	It needs to be linked dynamically using the -lkoliba
+	switch in Unix and its derivatives, or koliba.lib in
+	Windows.
+*/
+
+#include	<koliba.h>
+#include	"freliba.h"
+#include	<stdlib.h>
+#include	<string.h>
+
+/* From frei0r.h, which may or may not be on your system */
+typedef struct f0r_plugin_info
+{
+  const char* name;
+  const char* author;
+  int plugin_type;
+  int color_model;
+  int frei0r_version;
+  int major_version;
+  int minor_version;
+  int num_params;
+  const char* explanation;
+} f0r_plugin_info_t;
+
+typedef struct f0r_param_info
+{
+  const char* name;
+  int type;
+  const char* explanation;
+} f0r_param_info_t;
+
+#define FREI0R_MAJOR_VERSION 1
+#define F0R_PLUGIN_TYPE_FILTER 0
+#define F0R_COLOR_MODEL_RGBA8888 1
+#define	F0R_PARAM_BOOL	0
+#define F0R_PARAM_DOUBLE    1
+#define F0R_PARAM_COLOR     2
+#define F0R_PARAM_POSITION  3
+#define F0R_PARAM_STRING    4
+/* End of frei0r.h extract */
+
+typedef	struct _hald_instance {
+	char			*path;
+	FRELIBA_LATTICE	*lattice;
+	FRELIBA_FILESTAMP	stamp;
+	size_t			count;
+	unsigned char	srgb;
+	unsigned char	changed;
+} hald_instance, *f0r_instance_t;
+
+typedef	void	*f0r_param_t;
+
+void f0r_get_plugin_info(f0r_plugin_info_t* info) {
+	info->name				= "Koliba Hald" FRELIBA_NAME_SUFFIX;
+	info->author			= "G. Adam Stanislav";
+	info->plugin_type		= F0R_PLUGIN_TYPE_FILTER;
+	info->color_model		= FRELIBA_COLOR_MODEL;
+	info->frei0r_version	= FREI0R_MAJOR_VERSION;
+	info->major_version		= 1;
+	info->minor_version		= 0;
+	info->num_params		= 2;
+	info->explanation		= "Applies a Hald CLUT from a PPM file.";
+}
+
+int f0r_init() {
+	return 1;
+}
+
+void f0r_deinit() {}
+
+// Reads a number of the PPM header at p, skipping any white
+// space and comments before it. Returns where the number ends,
+// or NULL if there is no number at p.
+static const unsigned char * pnmnumber(const unsigned char *p, const unsigned char *end, unsigned int *value) {
+	unsigned int v = 0;
+
+	for (;;) {
+		while ((p < end) && ((*p == ' ') || (*p == '\t') || (*p == '\r') || (*p == '\n'))) p++;
+		if ((p < end) && (*p == '#')) while ((p < end) && (*p != '\n')) p++;
+		else break;
+	}
+
+	if ((p == end) || (*p < '0') || (*p > '9')) return NULL;
+	for (; (p < end) && (*p >= '0') && (*p <= '9'); p++) if (v < 100000000) v = v * 10 + (*p - '0');
+
+	*value	= v;
+	return p;
+}
+
+// Makes a lattice of a Hald CLUT of level L, which is an image of
+// L * L * L by L * L * L pixels, holding L * L points along each axis,
+// with red changing fastest, in the order its pixels are stored in.
+static FRELIBA_LATTICE * parsehald(const char *data, size_t size) {
+	const unsigned char *p = (const unsigned char *)data, *end = p + size;
+	FRELIBA_LATTICE *lattice;
+	float *points, *f, scale;
+	unsigned int width, height, maxval, level, bytes;
+	size_t n;
+
+	if ((size < 2) || (p[0] != 'P') || (p[1] != '6') ||
+		((p = pnmnumber(p + 2, end, &width)) == NULL) ||
+		((p = pnmnumber(p, end, &height)) == NULL) ||
+		((p = pnmnumber(p, end, &maxval)) == NULL) ||
+		(p == end) || (width != height) || (maxval == 0) || (maxval > 65535)) return NULL;
+
+	// A single white space ends the header.
+	p++;
+
+	for (level = 2; level * level * level < width; level++);
+	bytes	= (maxval > 255) ? 2 : 1;
+	n		= (size_t)width * height * 3;
+
+	if ((level * level * level != width) || (level * level > FRELIBA_MAXLATTICE) || ((size_t)(end - p) < n * bytes) ||
+		((points = malloc(n * sizeof(float))) == NULL)) return NULL;
+
+	scale	= 1.0f / (float)maxval;
+
+	if (bytes == 1) for (f = points; n; n--, p++) *f++ = (float)*p * scale;
+	else for (f = points; n; n--, p += 2) *f++ = (float)((p[0] << 8) | p[1]) * scale;
+
+	lattice	= FRELIBA_CreateLattice(points, level * level, NULL, NULL);
+	free(points);
+	return lattice;
+}
+
+f0r_instance_t f0r_construct(unsigned int width, unsigned int height) {
+	f0r_instance_t	instance;
+
+	if ((instance = calloc(sizeof(hald_instance),1)) != NULL) {
+		instance->count			= (size_t)width * (size_t)height;
+		instance->changed		= 1;
+	}
+	return instance;
+}
+
+void f0r_destruct(f0r_instance_t instance) {
+	if (instance != NULL) {
+		FRELIBA_ReleaseLattice(instance->lattice);
+		free(instance->path);
+		free(instance);
+	}
+}
+
+void f0r_get_param_info(f0r_param_info_t* info, int param_index) {
+	switch (param_index) {
+		case 0:
+			info->name			= "Path";
+			info->type			= F0R_PARAM_STRING;
+			info->explanation	= "The Hald CLUT (a binary PPM file) to apply.";
+			break;
+		case 1:
+			info->name			= "sRGB";
+			info->type			= F0R_PARAM_BOOL;
+			info->explanation	= "The LUT expects linear light, so linearize sRGB input (and encode the output).";
+			break;
+	}
+}
+
+void f0r_set_param_value(f0r_instance_t instance, f0r_param_t param, int param_index) {
+	const char *path;
+	char *copy;
+
+	if ((instance != NULL) && (param != NULL)) switch (param_index) {
+		case 0:
+			if ((path = *(const char **)param) == NULL) path = "";
+			if (((instance->path == NULL) || (strcmp(instance->path, path) != 0)) &&
+				((copy = strdup(path)) != NULL)) {
+				free(instance->path);
+				instance->path		= copy;
+				instance->changed	= 1;
+			}
+			break;
+		case 1:
+			instance->srgb	= (*(double *)param >= 0.5);
+			break;
+	}
+}
+
+void f0r_get_param_value(f0r_instance_t instance, f0r_param_t param, int param_index) {
+	if ((instance != NULL) && (param != NULL)) switch(param_index) {
+		case 0:
+			*(const char **)param = (instance->path != NULL) ? instance->path : "";
+			break;
+		case 1:
+			*(double *)param	= (double)instance->srgb;
+			break;
+	}
+}
+
+// Does the actual work for f0r_update and freliba_update,
+// count pixels at a time.
+static void update(void *data, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe, size_t count) {
+	f0r_instance_t instance = (f0r_instance_t)data;
+
+	if ((instance != NULL) && (inframe != NULL) && (outframe != NULL)) {
+
+		if (instance->changed) {
+			FRELIBA_ReleaseLattice(instance->lattice);
+			FRELIBA_FileStamp(instance->path, &instance->stamp);
+			instance->lattice	= ((instance->path != NULL) && (*instance->path != '\0')) ? FRELIBA_LoadLattice(instance->path, parsehald) : NULL;
+			instance->changed	= 0;
+		}
+
+		// Without a LUT (e.g., if we could not read the file)
+		// we leave the frame as it is.
+		if (instance->lattice == NULL) FRELIBA_CopyRgba8Frame(outframe, inframe, count);
+		else FRELIBA_LatticeRgba8Frame(instance->lattice, outframe, inframe, count, instance->srgb, FRELIBA_COLOR_MODEL == FRELIBA_MODEL_BGRA8888);
+	}
+}
+
+// Once a frame, we look if someone has changed the file,
+// so the new one is used without having to restart the host.
+static void checkfile(f0r_instance_t instance) {
+	if ((instance != NULL) && (instance->path != NULL) && (*instance->path != '\0') &&
+		(FRELIBA_FileChanged(instance->path, &instance->stamp))) instance->changed = 1;
+}
+
+void f0r_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe) {
+	if (instance != NULL) {
+		checkfile(instance);
+		update(instance, inframe, outframe, instance->count);
+	}
+}
+
+void freliba_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, ptrdiff_t instride, KOLIBA_RGBA8PIXEL *outframe, ptrdiff_t outstride, size_t width, size_t height) {
+	checkfile(instance);
+	FRELIBA_Rgba8Rows(update, instance, inframe, instride, outframe, outstride, width, height);
+}
+
+// Like any 3D LUT, a Hald CLUT is a FLUT per cell, not one FLUT.
+const FRELIBA_FASTFLUT * freliba_fastflut(f0r_instance_t instance) {
+	return NULL;
+}
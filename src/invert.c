@@ -14,6 +14,7 @@
 */
 
 #include	<koliba.h>
+#include	"freliba.h"
 #include	<stdlib.h>
 #include	<string.h>
 
@@ -52,6 +53,7 @@ typedef	struct _invert_instance {
 	KOLIBA_VERTICES	vertices;
 	KOLIBA_FLAGS	flags;
 	size_t			count;
+	FRELIBA_FASTFLUT	fast;
 	unsigned char	changed;
 	unsigned char	srgb;
 	unsigned char	iflags;
@@ -60,10 +62,10 @@ typedef	struct _invert_instance {
 typedef	void	*f0r_param_t;
 
 void f0r_get_plugin_info(f0r_plugin_info_t* info) {
-	info->name				= "Koliba Invert";
+	info->name				= "Koliba Invert" FRELIBA_NAME_SUFFIX;
 	info->author			= "G. Adam Stanislav";
 	info->plugin_type		= F0R_PLUGIN_TYPE_FILTER;
-	info->color_model		= F0R_COLOR_MODEL_RGBA8888;
+	info->color_model		= FRELIBA_COLOR_MODEL;
 	info->frei0r_version	= FREI0R_MAJOR_VERSION;
 	info->major_version		= 1;
 	info->minor_version		= 0;
@@ -80,6 +82,7 @@ f0r_instance_t f0r_construct(unsigned int width, unsigned int height) {
 
 	if ((instance = calloc(sizeof(invert_instance),1)) != NULL) {
 		instance->count		= (size_t)width * (size_t)height;
+		FRELIBA_InitFastFlut(&instance->fast);
 
 		KOLIBA_SlutToVertices(&instance->vertices, &instance->sLut);
 		KOLIBA_SetEfficacies(&instance->eLut, 1.0);
@@ -326,11 +329,13 @@ void f0r_get_param_value(f0r_instance_t instance, f0r_param_t param, int param_i
 	}
 }
 
-void f0r_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe) {
+// Does the actual work for f0r_update and freliba_update,
+// count pixels at a time.
+static void update(void *data, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe, size_t count) {
+	f0r_instance_t instance = (f0r_instance_t)data;
+
 	if ((instance != NULL) && (inframe != NULL) && (outframe != NULL)) {
-		size_t i = instance->count;
-		const double *iconv;
-		const unsigned char *oconv;
+		size_t i = count;
 
 		if (instance->changed) {
 			KOLIBA_ApplyEfficacies(&instance->sLut, KOLIBA_InvertSlutVertices(KOLIBA_ResetSlut(&instance->sLut), instance->iflags), &instance->eLut, &KOLIBA_IdentitySlut);
@@ -338,20 +343,18 @@ void f0r_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *i
 			instance->changed = 0;
 		}
 
-		if (KOLIBA_IsIdentityFlut(&instance->fLut)) memcpy(outframe, inframe, i*sizeof(KOLIBA_RGBA8PIXEL));
-		else {
-			if (instance->srgb) {
-				iconv = KOLIBA_SrgbByteToLinear;
-				oconv = KOLIBA_LinearByteToSrgb;
-			}
-			else {
-				iconv = NULL;
-				oconv = NULL;
-			}
-
-			for (; i; i--, inframe++, outframe++) {
-				KOLIBA_Rgba8Pixel(outframe, inframe, &instance->fLut, instance->flags, iconv, oconv)->a = inframe->a;
-			}
-		}
+		FRELIBA_FlutRgba8Frame(&instance->fast, outframe, inframe, i, &instance->fLut, instance->flags, instance->srgb);
 	}
 }
+
+void f0r_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe) {
+	if (instance != NULL) update(instance, inframe, outframe, instance->count);
+}
+
+void freliba_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, ptrdiff_t instride, KOLIBA_RGBA8PIXEL *outframe, ptrdiff_t outstride, size_t width, size_t height) {
+	FRELIBA_Rgba8Rows(update, instance, inframe, instride, outframe, outstride, width, height);
+}
+
+const FRELIBA_FASTFLUT * freliba_fastflut(f0r_instance_t instance) {
+	return &instance->fast;
+}
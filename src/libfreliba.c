@@ -0,0 +1,908 @@
+/*
+	libfreliba.c
+
+	Copyright 2021 G. Adam Stanislav.
+	All rights reserved.
+
+	http://www.pantarheon.org
+
+	The freliba effects as a library. See libfreliba.h for
+	the details.
+
+	We do not duplicate any of the plug-ins here. The makefile
+	takes the very objects the frei0r plug-ins are linked from
+	(both the RGBA and the BGRA builds), renames their f0r_*,
+	freliba_update and freliba_fastflut functions to, say,
+	freliba_palette_f0r_construct or
+	freliba_bgra_palette_f0r_construct, and hides everything
+	else they define. That way they can all live in one library,
+	and all we do here is keep a table of them.
+*/
+
+#include	"libfreliba.h"
+#include	"freliba.h"
+#include	<stdlib.h>
+#include	<stdio.h>
+#include	<string.h>
+#include	<ctype.h>
+#include	<stdarg.h>
+
+/* From frei0r.h, which may or may not be on your system */
+typedef struct f0r_plugin_info
+{
+  const char* name;
+  const char* author;
+  int plugin_type;
+  int color_model;
+  int frei0r_version;
+  int major_version;
+  int minor_version;
+  int num_params;
+  const char* explanation;
+} f0r_plugin_info_t;
+
+typedef struct f0r_param_info
+{
+  const char* name;
+  int type;
+  const char* explanation;
+} f0r_param_info_t;
+/* End of frei0r.h extract */
+
+// Every effect in the library. To add an effect, add it here
+// and to the effects list in the makefile. The first argument
+// is the name of the plug-in with any '-' changed to '_', the
+// last one is 1 if the effect changes from one frame to the
+// next (see FRELIBA_Timed).
+#define	FRELIBA_EFFECTS	\
+	FRELIBA_EFFECT(601_2020, "601-2020", 0)	\
+	FRELIBA_EFFECT(allnatcons, "allnatcons", 0)	\
+	FRELIBA_EFFECT(anachromatic, "anachromatic", 0)	\
+	FRELIBA_EFFECT(artdeco, "artdeco", 0)	\
+	FRELIBA_EFFECT(autobalance, "autobalance", 1)	\
+	FRELIBA_EFFECT(bleachbypass, "bleachbypass", 0)	\
+	FRELIBA_EFFECT(chanex, "chanex", 0)	\
+	FRELIBA_EFFECT(chanex2, "chanex2", 0)	\
+	FRELIBA_EFFECT(chblend, "chblend", 0)	\
+	FRELIBA_EFFECT(chroma, "chroma", 0)	\
+	FRELIBA_EFFECT(chromatomorphosis, "chromatomorphosis", 0)	\
+	FRELIBA_EFFECT(chrzone, "chrzone", 0)	\
+	FRELIBA_EFFECT(colordials, "colordials", 0)	\
+	FRELIBA_EFFECT(colorroller, "colorroller", 0)	\
+	FRELIBA_EFFECT(colors, "colors", 0)	\
+	FRELIBA_EFFECT(crimsonite, "crimsonite", 0)	\
+	FRELIBA_EFFECT(cube, "cube", 0)	\
+	FRELIBA_EFFECT(diachromatic, "diachromatic", 0)	\
+	FRELIBA_EFFECT(dichromatic, "dichromatic", 0)	\
+	FRELIBA_EFFECT(erythropy, "erythropy", 0)	\
+	FRELIBA_EFFECT(fromsrgb, "fromsrgb", 0)	\
+	FRELIBA_EFFECT(gains, "gains", 0)	\
+	FRELIBA_EFFECT(gcomp, "gcomp", 0)	\
+	FRELIBA_EFFECT(hald, "hald", 0)	\
+	FRELIBA_EFFECT(index, "index", 0)	\
+	FRELIBA_EFFECT(invert, "invert", 0)	\
+	FRELIBA_EFFECT(lifts, "lifts", 0)	\
+	FRELIBA_EFFECT(lut, "lut", 0)	\
+	FRELIBA_EFFECT(lutty, "lutty", 0)	\
+	FRELIBA_EFFECT(magicflute, "magicflute", 0)	\
+	FRELIBA_EFFECT(monofarba, "monofarba", 0)	\
+	FRELIBA_EFFECT(natcon, "natcon", 0)	\
+	FRELIBA_EFFECT(objective, "objective", 0)	\
+	FRELIBA_EFFECT(orion_betelgeuse, "orion-betelgeuse", 0)	\
+	FRELIBA_EFFECT(palette, "palette", 0)	\
+	FRELIBA_EFFECT(pinkfade, "pinkfade", 0)	\
+	FRELIBA_EFFECT(primary_secondary, "primary-secondary", 0)	\
+	FRELIBA_EFFECT(purecolor, "purecolor", 0)	\
+	FRELIBA_EFFECT(ranges, "ranges", 0)	\
+	FRELIBA_EFFECT(redmonofarba, "redmonofarba", 0)	\
+	FRELIBA_EFFECT(saturation, "saturation", 0)	\
+	FRELIBA_EFFECT(selene_nyx, "selene-nyx", 0)	\
+	FRELIBA_EFFECT(setfrange, "setfrange", 0)	\
+	FRELIBA_EFFECT(solidcolor, "solidcolor", 0)	\
+	FRELIBA_EFFECT(strut, "strut", 0)	\
+	FRELIBA_EFFECT(tetramat, "tetramat", 0)	\
+	FRELIBA_EFFECT(tint, "tint", 0)	\
+	FRELIBA_EFFECT(tosrgb, "tosrgb", 0)	\
+	FRELIBA_EFFECT(vampyrectomy, "vampyrectomy", 0)	\
+	FRELIBA_EFFECT(vcchain, "vcchain", 0)	\
+	FRELIBA_EFFECT(vcflutter, "vcflutter", 0)	\
+	FRELIBA_EFFECT(vcqube, "vcqube", 0)	\
+	FRELIBA_EFFECT(vertsat, "vertsat", 0)	\
+	FRELIBA_EFFECT(vivid, "vivid", 0)	\
+	FRELIBA_EFFECT(warm_and_cold, "warm-and-cold", 0)	\
+	FRELIBA_EFFECT(warm_cold, "warm-cold", 0)
+
+// The renamed functions of each plug-in, both as built for RGBA
+// (freliba_<effect>_*) and for BGRA (freliba_bgra_<effect>_*). The
+// instances are void pointers here, since only the plug-in itself
+// knows what they point at.
+#define	FRELIBA_DECLARE(fn)	\
+	int fn##_f0r_init(void);	\
+	void fn##_f0r_deinit(void);	\
+	void fn##_f0r_get_plugin_info(f0r_plugin_info_t *info);	\
+	void fn##_f0r_get_param_info(f0r_param_info_t *info, int param_index);	\
+	void * fn##_f0r_construct(unsigned int width, unsigned int height);	\
+	void fn##_f0r_destruct(void *instance);	\
+	void fn##_f0r_set_param_value(void *instance, void *param, int param_index);	\
+	void fn##_f0r_get_param_value(void *instance, void *param, int param_index);	\
+	void fn##_update(void *instance, double time, const KOLIBA_RGBA8PIXEL *inframe, ptrdiff_t instride, KOLIBA_RGBA8PIXEL *outframe, ptrdiff_t outstride, size_t width, size_t height);	\
+	const FRELIBA_FASTFLUT * fn##_fastflut(void *instance);
+
+#define	FRELIBA_EFFECT(id, name, timed)	FRELIBA_DECLARE(freliba_##id) FRELIBA_DECLARE(freliba_bgra_##id)
+
+FRELIBA_EFFECTS
+
+#undef	FRELIBA_EFFECT
+
+typedef struct _FRELIBA_PLUGIN {
+	const char	*name;
+	int		(*init)(void);
+	void	(*deinit)(void);
+	void	(*get_plugin_info)(f0r_plugin_info_t *info);
+	void	(*get_param_info)(f0r_param_info_t *info, int param_index);
+	void *	(*construct)(unsigned int width, unsigned int height);
+	void	(*destruct)(void *instance);
+	void	(*set_param_value)(void *instance, void *param, int param_index);
+	void	(*get_param_value)(void *instance, void *param, int param_index);
+	void	(*update)(void *instance, double time, const KOLIBA_RGBA8PIXEL *inframe, ptrdiff_t instride, KOLIBA_RGBA8PIXEL *outframe, ptrdiff_t outstride, size_t width, size_t height);
+	const FRELIBA_FASTFLUT *	(*fastflut)(void *instance);
+	int		timed;
+} FRELIBA_PLUGIN;
+
+#define	FRELIBA_ENTRY(fn, name, timed)	\
+	{	\
+		name,	\
+		fn##_f0r_init,	\
+		fn##_f0r_deinit,	\
+		fn##_f0r_get_plugin_info,	\
+		fn##_f0r_get_param_info,	\
+		fn##_f0r_construct,	\
+		fn##_f0r_destruct,	\
+		fn##_f0r_set_param_value,	\
+		fn##_f0r_get_param_value,	\
+		fn##_update,	\
+		fn##_fastflut,	\
+		timed	\
+	},
+
+#define	FRELIBA_EFFECT(id, name, timed)	FRELIBA_ENTRY(freliba_##id, name, timed)
+
+static const FRELIBA_PLUGIN plugins[] = {
+	FRELIBA_EFFECTS
+};
+
+#undef	FRELIBA_EFFECT
+#define	FRELIBA_EFFECT(id, name, timed)	FRELIBA_ENTRY(freliba_bgra_##id, name, timed)
+
+static const FRELIBA_PLUGIN bgraplugins[] = {
+	FRELIBA_EFFECTS
+};
+
+#undef	FRELIBA_EFFECT
+
+#define	NPLUGINS	(sizeof(plugins) / sizeof(FRELIBA_PLUGIN))
+
+struct _FRELIBA {
+	const FRELIBA_PLUGIN	*plugin;
+	void				*instance;
+	f0r_plugin_info_t	info;
+	int					model;
+	double				time;
+	FRELIBA_REGION		region;
+	unsigned char		regional;	// Is the region not the whole frame?
+	unsigned char		rectangle;	// Is it smaller than the frame?
+};
+
+// Like strcasecmp, which not every system has.
+static int samename(const char *a, const char *b) {
+	for (; (*a) && (tolower((unsigned char)*a) == tolower((unsigned char)*b)); a++, b++);
+	return (*a == '\0') && (*b == '\0');
+}
+
+unsigned int FRELIBA_Effects(void) {
+	return NPLUGINS;
+}
+
+const char * FRELIBA_EffectName(unsigned int effect) {
+	return (effect < NPLUGINS) ? plugins[effect].name : NULL;
+}
+
+int FRELIBA_FindEffect(const char *name) {
+	unsigned int i;
+
+	if (name != NULL) for (i = 0; i < NPLUGINS; i++) {
+		if (samename(plugins[i].name, name)) return (int)i;
+	}
+	return -1;
+}
+
+FRELIBA * FRELIBA_CreateEffectModel(unsigned int effect, int model) {
+	FRELIBA *fx;
+
+	if ((effect >= NPLUGINS) || ((model != FRELIBA_MODEL_RGBA8888) && (model != FRELIBA_MODEL_BGRA8888))) return NULL;
+
+	if ((fx = malloc(sizeof(FRELIBA))) != NULL) {
+		fx->plugin	= (model == FRELIBA_MODEL_BGRA8888) ? &bgraplugins[effect] : &plugins[effect];
+		fx->model	= model;
+		fx->time	= 0.0;
+		memset(&fx->region, 0, sizeof(FRELIBA_REGION));
+		fx->regional	= 0;
+		fx->rectangle	= 0;
+
+		// None of our plug-ins does anything in f0r_init,
+		// so there is no harm in calling it every time.
+		fx->plugin->init();
+		fx->plugin->get_plugin_info(&fx->info);
+
+		// The size only matters to f0r_update, which we never call.
+		if ((fx->instance = fx->plugin->construct(1, 1)) == NULL) {
+			free(fx);
+			fx	= NULL;
+		}
+	}
+
+	return fx;
+}
+
+FRELIBA * FRELIBA_CreateEffect(unsigned int effect) {
+	return FRELIBA_CreateEffectModel(effect, FRELIBA_MODEL_RGBA8888);
+}
+
+FRELIBA * FRELIBA_CreateModel(const char *name, int model) {
+	int effect = FRELIBA_FindEffect(name);
+
+	return (effect < 0) ? NULL : FRELIBA_CreateEffectModel((unsigned int)effect, model);
+}
+
+FRELIBA * FRELIBA_Create(const char *name) {
+	return FRELIBA_CreateModel(name, FRELIBA_MODEL_RGBA8888);
+}
+
+int FRELIBA_Model(const FRELIBA *fx) {
+	return (fx != NULL) ? fx->model : -1;
+}
+
+void FRELIBA_Destroy(FRELIBA *fx) {
+	if (fx != NULL) {
+		fx->plugin->destruct(fx->instance);
+		free(fx);
+	}
+}
+
+const char * FRELIBA_Name(const FRELIBA *fx) {
+	return (fx != NULL) ? fx->info.name : NULL;
+}
+
+const char * FRELIBA_Explanation(const FRELIBA *fx) {
+	return (fx != NULL) ? fx->info.explanation : NULL;
+}
+
+int FRELIBA_Params(const FRELIBA *fx) {
+	return (fx != NULL) ? fx->info.num_params : 0;
+}
+
+// Returns 0 and fills in the info, or returns -1.
+static int paraminfo(const FRELIBA *fx, int param, f0r_param_info_t *info) {
+	if ((fx == NULL) || (param < 0) || (param >= fx->info.num_params)) return -1;
+	fx->plugin->get_param_info(info, param);
+	return 0;
+}
+
+const char * FRELIBA_ParamName(const FRELIBA *fx, int param) {
+	f0r_param_info_t info;
+
+	return (paraminfo(fx, param, &info) == 0) ? info.name : NULL;
+}
+
+const char * FRELIBA_ParamExplanation(const FRELIBA *fx, int param) {
+	f0r_param_info_t info;
+
+	return (paraminfo(fx, param, &info) == 0) ? info.explanation : NULL;
+}
+
+int FRELIBA_ParamType(const FRELIBA *fx, int param) {
+	f0r_param_info_t info;
+
+	return (paraminfo(fx, param, &info) == 0) ? info.type : -1;
+}
+
+int FRELIBA_FindParam(const FRELIBA *fx, const char *name) {
+	f0r_param_info_t info;
+	int param;
+
+	if (name != NULL) for (param = 0; paraminfo(fx, param, &info) == 0; param++) {
+		if (samename(info.name, name)) return param;
+	}
+	return -1;
+}
+
+int FRELIBA_SetParam(FRELIBA *fx, int param, const void *value) {
+	if ((value == NULL) || (fx == NULL) || (param < 0) || (param >= fx->info.num_params)) return -1;
+
+	// The plug-ins do not change the value, frei0r just
+	// never bothered to declare it const.
+	fx->plugin->set_param_value(fx->instance, (void *)value, param);
+	return 0;
+}
+
+int FRELIBA_SetParamByName(FRELIBA *fx, const char *name, const void *value) {
+	return FRELIBA_SetParam(fx, FRELIBA_FindParam(fx, name), value);
+}
+
+int FRELIBA_ParseParam(FRELIBA *fx, const char *setting) {
+	char name[256];
+	const char *value;
+	double d;
+	FRELIBA_COLOR color;
+	FRELIBA_POSITION position;
+	int param;
+
+	if ((fx == NULL) || (setting == NULL) || ((value = strchr(setting, '=')) == NULL) ||
+		((size_t)(value - setting) >= sizeof(name))) return -1;
+
+	memcpy(name, setting, value - setting);
+	name[value - setting] = '\0';
+	value++;
+
+	if ((param = FRELIBA_FindParam(fx, name)) < 0) return -1;
+
+	switch (FRELIBA_ParamType(fx, param)) {
+		case FRELIBA_PARAM_BOOL:
+		case FRELIBA_PARAM_DOUBLE:
+			if (sscanf(value, "%lf", &d) != 1) break;
+			return FRELIBA_SetParam(fx, param, &d);
+		case FRELIBA_PARAM_COLOR:
+			if (sscanf(value, "%f,%f,%f", &color.r, &color.g, &color.b) != 3) break;
+			return FRELIBA_SetParam(fx, param, &color);
+		case FRELIBA_PARAM_POSITION:
+			if (sscanf(value, "%lf,%lf", &position.x, &position.y) != 2) break;
+			return FRELIBA_SetParam(fx, param, &position);
+		case FRELIBA_PARAM_STRING:
+			return FRELIBA_SetParam(fx, param, &value);
+	}
+
+	return -1;
+}
+
+int FRELIBA_GetParam(const FRELIBA *fx, int param, void *value) {
+	if ((value == NULL) || (fx == NULL) || (param < 0) || (param >= fx->info.num_params)) return -1;
+
+	fx->plugin->get_param_value(fx->instance, value, param);
+	return 0;
+}
+
+void FRELIBA_Prepare(FRELIBA *fx) {
+	KOLIBA_RGBA8PIXEL pixel = {0};
+
+	// Every plug-in brings itself up to date before it
+	// touches the first pixel, so we just give it a frame
+	// with no pixels in it.
+	if (fx != NULL) fx->plugin->update(fx->instance, fx->time, &pixel, 0, &pixel, 0, 0, 1);
+}
+
+void FRELIBA_SetTime(FRELIBA *fx, double time) {
+	if (fx != NULL) fx->time = time;
+}
+
+int FRELIBA_Timed(const FRELIBA *fx) {
+	return (fx != NULL) && (fx->plugin->timed);
+}
+
+void FRELIBA_SetRegion(FRELIBA *fx, size_t x, size_t y, size_t width, size_t height) {
+	if (fx != NULL) {
+		fx->region.x		= x;
+		fx->region.y		= y;
+		fx->region.width	= width;
+		fx->region.height	= height;
+		fx->rectangle		= (x) || (y) || (width) || (height);
+		fx->regional		= (fx->rectangle) || (fx->region.mask);
+	}
+}
+
+void FRELIBA_SetMask(FRELIBA *fx, int mask) {
+	if (fx != NULL) {
+		fx->region.mask	= (mask != 0);
+		fx->regional	= (fx->rectangle) || (fx->region.mask);
+	}
+}
+
+// What FRELIBA_RegionRgba8Rows calls for each run of pixels.
+static void applyrun(void *data, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe, size_t count) {
+	FRELIBA *fx = (FRELIBA *)data;
+
+	fx->plugin->update(fx->instance, fx->time, inframe, 0, outframe, 0, count, 1);
+}
+
+void FRELIBA_Apply(FRELIBA *fx, const void *src, ptrdiff_t srcstride, void *dst, ptrdiff_t dststride, size_t width, size_t height) {
+	if (fx == NULL) return;
+
+	if (fx->regional) FRELIBA_RegionRgba8Rows(applyrun, fx, &fx->region, (const KOLIBA_RGBA8PIXEL *)src, srcstride, (KOLIBA_RGBA8PIXEL *)dst, dststride, width, height);
+	else fx->plugin->update(fx->instance, fx->time, (const KOLIBA_RGBA8PIXEL *)src, srcstride, (KOLIBA_RGBA8PIXEL *)dst, dststride, width, height);
+}
+
+// The luma of a pixel from its code values, with the Rec. 709
+// weights in 256ths, which add up to exactly 256.
+#define	LUMA(r, g, b)	(((unsigned int)(r) * 54 + (unsigned int)(g) * 183 + (unsigned int)(b) * 19 + 128) >> 8)
+
+void FRELIBA_ClearStats(FRELIBA_STATS *stats) {
+	if (stats != NULL) memset(stats, 0, sizeof(FRELIBA_STATS));
+}
+
+void FRELIBA_MergeStats(FRELIBA_STATS *stats, const FRELIBA_STATS *more) {
+	unsigned int c, i;
+
+	if ((stats == NULL) || (more == NULL)) return;
+
+	stats->pixels	+= more->pixels;
+	for (c = 0; c < 4; c++) for (i = 0; i < 256; i++) {
+		stats->in[c][i]		+= more->in[c][i];
+		stats->out[c][i]	+= more->out[c][i];
+	}
+	for (c = 0; c < 3; c++) {
+		stats->clipped[c][0]	+= more->clipped[c][0];
+		stats->clipped[c][1]	+= more->clipped[c][1];
+	}
+}
+
+void FRELIBA_Rgba8Stats(FRELIBA_STATS *stats, const void *src, const void *dst, size_t count, int model) {
+	const unsigned char *in = (const unsigned char *)src;
+	const unsigned char *out = (const unsigned char *)dst;
+	const unsigned int r = (model == FRELIBA_MODEL_BGRA8888) ? 2 : 0;
+	const unsigned int b = 2 - r;
+
+	if ((stats == NULL) || (src == NULL) || (dst == NULL)) return;
+
+	stats->pixels	+= count;
+
+	for (; count; count--, in += 4, out += 4) {
+		stats->in[0][in[r]]++;
+		stats->in[1][in[1]]++;
+		stats->in[2][in[b]]++;
+		stats->in[FRELIBA_STATLUMA][LUMA(in[r], in[1], in[b])]++;
+		stats->out[0][out[r]]++;
+		stats->out[1][out[1]]++;
+		stats->out[2][out[b]]++;
+		stats->out[FRELIBA_STATLUMA][LUMA(out[r], out[1], out[b])]++;
+
+		// Added rather than tested, so there is nothing to mispredict.
+		stats->clipped[0][0]	+= (out[r] == 0) & (in[r] != 0);
+		stats->clipped[0][1]	+= (out[r] == 255) & (in[r] != 255);
+		stats->clipped[1][0]	+= (out[1] == 0) & (in[1] != 0);
+		stats->clipped[1][1]	+= (out[1] == 255) & (in[1] != 255);
+		stats->clipped[2][0]	+= (out[b] == 0) & (in[b] != 0);
+		stats->clipped[2][1]	+= (out[b] == 255) & (in[b] != 255);
+	}
+}
+
+// The statistics of rows of width pixels, in which before holds
+// what the rows were before the chain got to them.
+static void rowstats(FRELIBA_STATS *stats, const unsigned char *before, ptrdiff_t beforestride, const unsigned char *after, ptrdiff_t afterstride, size_t width, size_t rows, int model) {
+	for (; rows; rows--, before += beforestride, after += afterstride)
+		FRELIBA_Rgba8Stats(stats, before, after, width, model);
+}
+
+// When the frame is processed in place, the rows are about to be
+// overwritten, so we keep a packed copy of them in the scratch.
+// Returns where the rows will be before the chain is done with them.
+static const unsigned char * keeprows(unsigned char *scratch, const unsigned char *in, ptrdiff_t instride, const unsigned char *out, size_t bytes, size_t rows) {
+	size_t y;
+
+	if (in != out) return in;
+	for (y = 0; y < rows; y++) memcpy(scratch + y * bytes, in + (ptrdiff_t)y * instride, bytes);
+	return scratch;
+}
+
+int FRELIBA_ApplyChainStats(FRELIBA *const *chain, unsigned int n, FRELIBA_STATS *stats, const void *src, ptrdiff_t srcstride, void *dst, ptrdiff_t dststride, size_t width, size_t height) {
+	const ptrdiff_t packed = (ptrdiff_t)(width * sizeof(KOLIBA_RGBA8PIXEL));
+	const unsigned char *in, *before = NULL;
+	unsigned char *out, *scratch = NULL;
+	size_t y, x, rows, span;
+	unsigned int e;
+	int model, result = 0;
+
+	if (((n) && (chain == NULL)) || (src == NULL) || (dst == NULL) || (width == 0)) return -1;
+
+	model	= (n) ? chain[0]->model : FRELIBA_MODEL_RGBA8888;
+
+	if (srcstride == 0) srcstride = packed;
+	if (dststride == 0) dststride = packed;
+
+	if (n == 0) {
+		if (src != dst) for (y = 0; y < height; y++)
+			memmove((unsigned char *)dst + y * dststride, (const unsigned char *)src + y * srcstride, packed);
+		if (stats != NULL) rowstats(stats, (const unsigned char *)src, srcstride, (const unsigned char *)dst, dststride, width, height, model);
+		return 0;
+	}
+
+	// A tile does not know where in the frame it is, so a chain
+	// with a rectangle in it goes through the frame an effect at
+	// a time. A mask only cares about each pixel, so it is fine.
+	// The statistics then cost a pass of their own, and a copy
+	// of the frame if it is processed in place.
+	for (e = 0; (e < n) && (!chain[e]->rectangle); e++);
+	if (e < n) {
+		if ((stats != NULL) && (src == dst) && ((scratch = malloc(packed * height)) == NULL)) {
+			stats	= NULL;
+			result	= -1;
+		}
+		if (stats != NULL) before = keeprows(scratch, (const unsigned char *)src, srcstride, (const unsigned char *)dst, packed, height);
+		for (e = 0; e < n; e++) FRELIBA_Apply(chain[e], (e) ? dst : src, (e) ? dststride : srcstride, dst, dststride, width, height);
+		if (stats != NULL) rowstats(stats, before, (before == scratch) ? packed : srcstride, (const unsigned char *)dst, dststride, width, height, model);
+		free(scratch);
+		return result;
+	}
+
+	if ((stats != NULL) && (src == dst) && ((scratch = malloc(FRELIBA_TILEPIXELS * sizeof(KOLIBA_RGBA8PIXEL))) == NULL)) {
+		stats	= NULL;
+		result	= -1;
+	}
+
+	// A tile is as many rows as fit in it, or a piece of a row
+	// when not even one does. Only the first effect reads the
+	// source, all others work on the tile in the destination.
+	// Its statistics are gathered while it is still in the cache.
+	if (width >= FRELIBA_TILEPIXELS) for (y = 0; y < height; y++) {
+		for (x = 0; x < width; x += FRELIBA_TILEPIXELS) {
+			span	= ((width - x) < FRELIBA_TILEPIXELS) ? width - x : FRELIBA_TILEPIXELS;
+			in		= (const unsigned char *)src + y * srcstride + x * sizeof(KOLIBA_RGBA8PIXEL);
+			out		= (unsigned char *)dst + y * dststride + x * sizeof(KOLIBA_RGBA8PIXEL);
+			if (stats != NULL) before = keeprows(scratch, in, 0, out, span * sizeof(KOLIBA_RGBA8PIXEL), 1);
+			for (e = 0; e < n; e++) FRELIBA_Apply(chain[e], (e) ? out : in, 0, out, 0, span, 1);
+			if (stats != NULL) FRELIBA_Rgba8Stats(stats, before, out, span, model);
+		}
+	}
+	else for (y = 0, rows = FRELIBA_TILEPIXELS / width; y < height; y += rows) {
+		if (rows > height - y) rows = height - y;
+		in	= (const unsigned char *)src + y * srcstride;
+		out	= (unsigned char *)dst + y * dststride;
+		if (stats != NULL) before = keeprows(scratch, in, srcstride, out, packed, rows);
+		for (e = 0; e < n; e++) FRELIBA_Apply(chain[e], (e) ? out : in, (e) ? dststride : srcstride, out, dststride, width, rows);
+		if (stats != NULL) rowstats(stats, before, (before == scratch) ? packed : srcstride, out, dststride, width, rows, model);
+	}
+
+	free(scratch);
+	return result;
+}
+
+void FRELIBA_ApplyChain(FRELIBA *const *chain, unsigned int n, const void *src, ptrdiff_t srcstride, void *dst, ptrdiff_t dststride, size_t width, size_t height) {
+	FRELIBA_ApplyChainStats(chain, n, NULL, src, srcstride, dst, dststride, width, height);
+}
+
+// Adds to the text as snprintf would, keeping track of how long
+// it would be if there were room enough for all of it.
+static size_t append(char *text, size_t size, size_t len, const char *format, ...) {
+	va_list args;
+	int n;
+
+	va_start(args, format);
+	n	= vsnprintf((len < size) ? text + len : NULL, (len < size) ? size - len : 0, format, args);
+	va_end(args);
+
+	return (n > 0) ? len + (size_t)n : len;
+}
+
+// One side (before or after) of the report.
+static size_t sidereport(char *text, size_t size, size_t len, const char *name, const unsigned long long hist[4][256], unsigned long long pixels) {
+	unsigned long long sum;
+	unsigned int c, i, lo[4], hi[4];
+	double mean[4];
+
+	for (c = 0; c < 4; c++) {
+		for (lo[c] = 0; (lo[c] < 255) && (hist[c][lo[c]] == 0); lo[c]++);
+		for (hi[c] = 255; (hi[c] > 0) && (hist[c][hi[c]] == 0); hi[c]--);
+		for (i = 0, sum = 0; i < 256; i++) sum += hist[c][i] * i;
+		mean[c]	= (pixels) ? (double)sum / (double)pixels : 0.0;
+	}
+
+	len	= append(text, size, len, "\"%s\":{\"min\":[%u,%u,%u,%u],\"max\":[%u,%u,%u,%u],\"mean\":[%.3f,%.3f,%.3f,%.3f],\"histogram\":[",
+		name, lo[0], lo[1], lo[2], lo[3], hi[0], hi[1], hi[2], hi[3], mean[0], mean[1], mean[2], mean[3]);
+
+	for (c = 0; c < 4; c++) for (i = 0; i < 256; i++)
+		len	= append(text, size, len, "%s%llu%s", (i) ? "," : "[", hist[c][i], (i < 255) ? "" : (c < 3) ? "]," : "]]}");
+
+	return len;
+}
+
+size_t FRELIBA_StatsReport(const FRELIBA_STATS *stats, char *text, size_t size) {
+	size_t len = 0;
+
+	if ((text == NULL) || (size == 0)) size = 0;
+	else *text = '\0';
+
+	if (stats == NULL) return 0;
+
+	len	= append(text, size, len, "{\"pixels\":%llu,", stats->pixels);
+	len	= sidereport(text, size, len, "in", stats->in, stats->pixels);
+	len	= append(text, size, len, ",");
+	len	= sidereport(text, size, len, "out", stats->out, stats->pixels);
+	len	= append(text, size, len, ",\"clipped\":{\"black\":[%llu,%llu,%llu],\"white\":[%llu,%llu,%llu]}}",
+		stats->clipped[0][0], stats->clipped[1][0], stats->clipped[2][0],
+		stats->clipped[0][1], stats->clipped[1][1], stats->clipped[2][1]);
+
+	return len;
+}
+
+const FRELIBA_FASTFLUT * FRELIBA_EffectFastFlut(FRELIBA *fx) {
+	if (fx == NULL) return NULL;
+	FRELIBA_Prepare(fx);
+	return fx->plugin->fastflut(fx->instance);
+}
+
+// Both FRELIBA_ApplyRgba16 and FRELIBA_ApplyRgbaf walk the rows
+// the same way, only with a different kernel and pixel size.
+typedef void (*FRELIBA_WIDEFRAME)(const FRELIBA_FASTFLUT *fast, void *outframe, const void *inframe, size_t count);
+
+static void rgba16frame(const FRELIBA_FASTFLUT *fast, void *outframe, const void *inframe, size_t count) {
+	FRELIBA_FastRgba16Frame(fast, (FRELIBA_RGBA16PIXEL *)outframe, (const FRELIBA_RGBA16PIXEL *)inframe, count);
+}
+
+static void rgbafframe(const FRELIBA_FASTFLUT *fast, void *outframe, const void *inframe, size_t count) {
+	FRELIBA_FastRgbafFrame(fast, (FRELIBA_RGBAFPIXEL *)outframe, (const FRELIBA_RGBAFPIXEL *)inframe, count);
+}
+
+// The wide, YUV and lattice paths evaluate the FLUT on their own,
+// without the flags, so they can only take one that uses all its
+// terms. Anything else goes through Koliba or not at all.
+static const FRELIBA_FASTFLUT * wholeflut(FRELIBA *fx) {
+	const FRELIBA_FASTFLUT *fast = FRELIBA_EffectFastFlut(fx);
+
+	return ((fast != NULL) && (FRELIBA_FastFlutAllTerms(fast))) ? fast : NULL;
+}
+
+static int applywide(FRELIBA *fx, FRELIBA_WIDEFRAME frame, size_t pixel, const void *src, ptrdiff_t srcstride, void *dst, ptrdiff_t dststride, size_t width, size_t height) {
+	const FRELIBA_FASTFLUT *fast;
+	const ptrdiff_t packed = (ptrdiff_t)(width * pixel);
+	const char *in = (const char *)src;
+	char *out = (char *)dst;
+
+	if ((fx == NULL) || (src == NULL) || (dst == NULL)) return -1;
+
+	// The plug-in decides what its FLUT is on its own terms, so
+	// we let it, and only then go through the wider pixels.
+	if ((fast = wholeflut(fx)) == NULL) return -1;
+
+	if (srcstride == 0) srcstride = packed;
+	if (dststride == 0) dststride = packed;
+
+	if ((srcstride == packed) && (dststride == packed))
+		frame(fast, out, in, width * height);
+	else for (; height; height--, in += srcstride, out += dststride)
+		frame(fast, out, in, width);
+
+	return 0;
+}
+
+int FRELIBA_ApplyRgba16(FRELIBA *fx, const void *src, ptrdiff_t srcstride, void *dst, ptrdiff_t dststride, size_t width, size_t height) {
+	return applywide(fx, rgba16frame, sizeof(FRELIBA_RGBA16PIXEL), src, srcstride, dst, dststride, width, height);
+}
+
+int FRELIBA_ApplyRgbaf(FRELIBA *fx, const void *src, ptrdiff_t srcstride, void *dst, ptrdiff_t dststride, size_t width, size_t height) {
+	return applywide(fx, rgbafframe, sizeof(FRELIBA_RGBAFPIXEL), src, srcstride, dst, dststride, width, height);
+}
+
+int FRELIBA_ApplyYuv(FRELIBA *fx, const void *const src[3], const ptrdiff_t srcstride[3], void *const dst[3], const ptrdiff_t dststride[3], size_t width, size_t height, int matrix, int xshift, int yshift, int full) {
+	const FRELIBA_FASTFLUT *fast;
+	const unsigned char *in[3];
+	unsigned char *out[3];
+	unsigned int i;
+
+	if ((fx == NULL) || (src == NULL) || (dst == NULL) || (srcstride == NULL) || (dststride == NULL) ||
+		(matrix < FRELIBA_YUV601) || (matrix > FRELIBA_YUV2020) ||
+		(xshift < 0) || (xshift > 1) || (yshift < 0) || (yshift > 1)) return -1;
+
+	for (i = 0; i < 3; i++) {
+		if ((src[i] == NULL) || (dst[i] == NULL)) return -1;
+		in[i]	= (const unsigned char *)src[i];
+		out[i]	= (unsigned char *)dst[i];
+	}
+
+	if ((fast = wholeflut(fx)) == NULL) return -1;
+
+	FRELIBA_FastYuv8Frame(fast, out, dststride, in, srcstride, width, height, (unsigned int)matrix, (unsigned int)xshift, (unsigned int)yshift, (unsigned char)(full != 0));
+	return 0;
+}
+
+int FRELIBA_ApplyYuvChain(FRELIBA *const *chain, unsigned int n, const void *const src[3], const ptrdiff_t srcstride[3], void *const dst[3], const ptrdiff_t dststride[3], size_t width, size_t height, int matrix, int xshift, int yshift, int full) {
+	const void *in[3];
+	void *out[3];
+	size_t y, rows;
+	unsigned int e, i;
+
+	if (((n) && (chain == NULL)) || (src == NULL) || (dst == NULL) || (srcstride == NULL) || (dststride == NULL) ||
+		(width == 0) || (xshift < 0) || (xshift > 1) || (yshift < 0) || (yshift > 1)) return -1;
+
+	for (e = 0; e < n; e++) if (wholeflut(chain[e]) == NULL) return -1;
+
+	if (n == 0) {
+		for (i = 0; i < 3; i++) if (src[i] != dst[i]) {
+			rows	= (i) ? (height + (size_t)yshift) >> yshift : height;
+			for (y = 0; y < rows; y++)
+				memmove((unsigned char *)dst[i] + (ptrdiff_t)y * dststride[i], (const unsigned char *)src[i] + (ptrdiff_t)y * srcstride[i], (i) ? (width + (size_t)xshift) >> xshift : width);
+		}
+		return 0;
+	}
+
+	// The bands must not split the rows sharing their chroma.
+	if ((rows = (FRELIBA_TILEPIXELS / width) & ~(size_t)yshift) == 0) rows = (size_t)1 << yshift;
+
+	for (y = 0; y < height; y += rows) {
+		if (rows > height - y) rows = height - y;
+
+		for (i = 0; i < 3; i++) {
+			in[i]	= (const unsigned char *)src[i] + (ptrdiff_t)((i) ? y >> yshift : y) * srcstride[i];
+			out[i]	= (unsigned char *)dst[i] + (ptrdiff_t)((i) ? y >> yshift : y) * dststride[i];
+		}
+
+		for (e = 0; e < n; e++) {
+			if (FRELIBA_ApplyYuv(chain[e], (e) ? (const void *const *)out : in, (e) ? dststride : srcstride, out, dststride, width, rows, matrix, xshift, yshift, full) < 0) return -1;
+		}
+	}
+
+	return 0;
+}
+
+float * FRELIBA_SampleChain(FRELIBA *const *chain, unsigned int n, float *points, unsigned int size) {
+	const FRELIBA_FASTFLUT **fasts;
+	KOLIBA_RGBA8PIXEL *grid;
+	const size_t count = (size_t)size * size * size;
+	const unsigned int last = size - 1;
+	unsigned int e, i, j, k, r, b;
+	size_t p;
+
+	if ((points == NULL) || (size < 2) || ((n) && (chain == NULL)) || ((fasts = calloc(n + 1, sizeof(FRELIBA_FASTFLUT *))) == NULL)) return NULL;
+
+	for (e = 0; (e < n) && ((fasts[e] = wholeflut(chain[e])) != NULL); e++);
+
+	if (e == n) {
+		points	= FRELIBA_SampleFastFluts(points, size, fasts, n);
+		free(fasts);
+		return points;
+	}
+
+	free(fasts);
+
+	// Some effect is more than a FLUT, or its flags leave out
+	// some terms, so it needs a frame, which Koliba applies.
+	if ((grid = malloc(count * sizeof(KOLIBA_RGBA8PIXEL))) == NULL) return NULL;
+
+	r	= (FRELIBA_Model(chain[0]) == FRELIBA_MODEL_BGRA8888) ? 2 : 0;
+	b	= 2 - r;
+
+	for (k = 0, p = 0; k < size; k++) for (j = 0; j < size; j++) for (i = 0; i < size; i++, p++) {
+		((unsigned char *)(grid + p))[r]	= (unsigned char)((i * 255 + last / 2) / last);
+		((unsigned char *)(grid + p))[1]	= (unsigned char)((j * 255 + last / 2) / last);
+		((unsigned char *)(grid + p))[b]	= (unsigned char)((k * 255 + last / 2) / last);
+		((unsigned char *)(grid + p))[3]	= 255;
+	}
+
+	FRELIBA_ApplyChain(chain, n, grid, 0, grid, 0, count, 1);
+
+	for (p = 0; p < count; p++) {
+		points[p * 3]		= (float)((unsigned char *)(grid + p))[r] / 255.0f;
+		points[p * 3 + 1]	= (float)((unsigned char *)(grid + p))[1] / 255.0f;
+		points[p * 3 + 2]	= (float)((unsigned char *)(grid + p))[b] / 255.0f;
+	}
+
+	free(grid);
+	return points;
+}
+
+// A 65-point cube has 274,625 lines, so we do not leave them to
+// printf. Writes v with six decimals and returns where it ends.
+static char * decimal(char *s, float v) {
+	char digits[24];
+	unsigned long long u;
+	double d = (double)v * 1000000.0;
+	unsigned int n = 0;
+
+	if (d < 0.0) {
+		*s++	= '-';
+		d		= -d;
+	}
+	u	= (d < 1e18) ? (unsigned long long)(d + 0.5) : 1000000000000000000ULL;
+
+	do {
+		digits[n++]	= (char)('0' + u % 10);
+		u			/= 10;
+	} while ((u) || (n < 7));
+
+	while (n > 6) *s++ = digits[--n];
+	*s++	= '.';
+	while (n) *s++ = digits[--n];
+
+	return s;
+}
+
+static int writecube(FILE *f, const float *points, unsigned int size) {
+	const size_t plane = (size_t)size * size;
+	char *buffer, *s;
+	size_t k, p;
+	int status = 0;
+
+	// One plane at a time, each color on a line of its own.
+	if ((buffer = malloc(plane * 3 * 32)) == NULL) return -1;
+
+	fprintf(f, "TITLE \"freliba\"\nLUT_3D_SIZE %u\nDOMAIN_MIN 0.0 0.0 0.0\nDOMAIN_MAX 1.0 1.0 1.0\n", size);
+
+	for (k = 0; (k < size) && (status == 0); k++) {
+		for (p = 0, s = buffer; p < plane; p++, points += 3) {
+			s		= decimal(s, points[0]);
+			*s++	= ' ';
+			s		= decimal(s, points[1]);
+			*s++	= ' ';
+			s		= decimal(s, points[2]);
+			*s++	= '\n';
+		}
+		if (fwrite(buffer, 1, s - buffer, f) != (size_t)(s - buffer)) status = -1;
+	}
+
+	free(buffer);
+	return status;
+}
+
+static int writehald(FILE *f, const float *points, unsigned int size) {
+	const size_t plane = (size_t)size * size * 3;
+	unsigned char *buffer, *s;
+	unsigned int level, v;
+	size_t k, p;
+	double d;
+	int status = 0;
+
+	for (level = 1; level * level < size; level++);
+	if ((level * level != size) || ((buffer = malloc(plane * 2)) == NULL)) return -1;
+
+	// The image is level cubed pixels square, so all of the points
+	// fill it row after row, and 16-bit PPM samples are big-endian.
+	fprintf(f, "P6\n%u %u\n65535\n", level * level * level, level * level * level);
+
+	for (k = 0; (k < size) && (status == 0); k++) {
+		for (p = 0, s = buffer; p < plane; p++, points++) {
+			d		= (double)*points;
+			v		= (!(d > 0.0)) ? 0 : (d >= 1.0) ? 65535 : (unsigned int)(d * 65535.0 + 0.5);
+			*s++	= (unsigned char)(v >> 8);
+			*s++	= (unsigned char)v;
+		}
+		if (fwrite(buffer, 1, plane * 2, f) != plane * 2) status = -1;
+	}
+
+	free(buffer);
+	return status;
+}
+
+int FRELIBA_WriteLut(const char *path, int format, const float *points, unsigned int size) {
+	const size_t count = (size_t)size * size * size * 3;
+	FILE *f;
+	int status;
+
+	if ((path == NULL) || (points == NULL) || (size < 2) ||
+		((format != FRELIBA_LUTCUBE) && (format != FRELIBA_LUTHALD) && (format != FRELIBA_LUTRAW)) ||
+		((f = fopen(path, "wb")) == NULL)) return -1;
+
+	switch (format) {
+		case FRELIBA_LUTCUBE:
+			status	= writecube(f, points, size);
+			break;
+		case FRELIBA_LUTHALD:
+			status	= writehald(f, points, size);
+			break;
+		default:
+			status	= (fwrite(points, sizeof(float), count, f) == count) ? 0 : -1;
+			break;
+	}
+
+	if (fclose(f) != 0) status = -1;
+	if (status < 0) remove(path);
+	return status;
+}
+
+int FRELIBA_ExportLut(FRELIBA *const *chain, unsigned int n, unsigned int size, int format, const char *path) {
+	float *points;
+	int status = -1;
+
+	if ((size < 2) || ((points = malloc((size_t)size * size * size * 3 * sizeof(float))) == NULL)) return -1;
+
+	if (FRELIBA_SampleChain(chain, n, points, size) != NULL) status = FRELIBA_WriteLut(path, format, points, size);
+
+	free(points);
+	return status;
+}
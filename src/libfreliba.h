@@ -0,0 +1,307 @@
+/*
+	libfreliba.h
+
+	Copyright 2021 G. Adam Stanislav.
+	All rights reserved.
+
+	http://www.pantarheon.org
+
+	The freliba effects as a library, for programs that are
+	not frei0r hosts. Each effect is the very same code as
+	the corresponding frei0r plug-in, but here the frames
+	are not required to be tightly packed, nor to keep the
+	same size from one call to the next, so they can be
+	processed right in the caller's own buffers.
+
+	A typical use:
+
+		FRELIBA *fx = FRELIBA_Create("palette");
+		double on = 1.0;
+
+		FRELIBA_SetParamByName(fx, "sRGB", &on);
+		FRELIBA_Prepare(fx);
+		FRELIBA_Apply(fx, src, srcstride, dst, dststride, width, height);
+		...
+		FRELIBA_Destroy(fx);
+
+	Link with -lfreliba -lkoliba.
+*/
+
+#ifndef	_LIBFRELIBA_H_
+#define	_LIBFRELIBA_H_
+
+#include	<stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The parameter types, same as in frei0r. A FRELIBA_PARAM_BOOL
+// is passed as a double (0.0 or 1.0), just as in frei0r.
+#define	FRELIBA_PARAM_BOOL		0
+#define	FRELIBA_PARAM_DOUBLE	1
+#define	FRELIBA_PARAM_COLOR		2
+#define	FRELIBA_PARAM_POSITION	3
+#define	FRELIBA_PARAM_STRING	4
+
+// Laid out the same as f0r_param_color and f0r_param_position.
+typedef struct _FRELIBA_COLOR {
+	float	r;
+	float	g;
+	float	b;
+} FRELIBA_COLOR;
+
+typedef struct _FRELIBA_POSITION {
+	double	x;
+	double	y;
+} FRELIBA_POSITION;
+
+// The pixel formats, same as the frei0r color models. Either
+// of the first two can be used to create an effect. Neither
+// costs any more than the other.
+#define	FRELIBA_MODEL_BGRA8888	0
+#define	FRELIBA_MODEL_RGBA8888	1
+#define	FRELIBA_MODEL_PACKED32	2
+
+// An instance of an effect. Its contents are private.
+typedef struct _FRELIBA FRELIBA;
+
+// The number of effects in the library, and the name of
+// each. The names are those of the plug-ins without the
+// koliba_ prefix, e.g., "palette" or "warm-cold".
+unsigned int FRELIBA_Effects(void);
+const char * FRELIBA_EffectName(unsigned int effect);
+
+// Returns the index of the named effect, or -1 if there is
+// no such effect.
+int FRELIBA_FindEffect(const char *name);
+
+// Creates an instance of the named effect, with all of its
+// parameters at their defaults, working on pixels in the given
+// model. Returns NULL if there is no such effect, if it does not
+// support the model, or if we are out of memory.
+FRELIBA * FRELIBA_CreateModel(const char *name, int model);
+FRELIBA * FRELIBA_CreateEffectModel(unsigned int effect, int model);
+
+// The same for FRELIBA_MODEL_RGBA8888.
+FRELIBA * FRELIBA_Create(const char *name);
+FRELIBA * FRELIBA_CreateEffect(unsigned int effect);
+
+// The model the instance was created for.
+int FRELIBA_Model(const FRELIBA *fx);
+
+void FRELIBA_Destroy(FRELIBA *fx);
+
+// What the effect calls itself, and what it does.
+const char * FRELIBA_Name(const FRELIBA *fx);
+const char * FRELIBA_Explanation(const FRELIBA *fx);
+
+// The parameters of the effect are numbered from 0.
+int FRELIBA_Params(const FRELIBA *fx);
+const char * FRELIBA_ParamName(const FRELIBA *fx, int param);
+const char * FRELIBA_ParamExplanation(const FRELIBA *fx, int param);
+int FRELIBA_ParamType(const FRELIBA *fx, int param);
+
+// Returns the number of the named parameter, or -1. The
+// comparison ignores case.
+int FRELIBA_FindParam(const FRELIBA *fx, const char *name);
+
+// Sets or gets a parameter. The value points at a double,
+// a FRELIBA_COLOR, a FRELIBA_POSITION, or a char *, depending
+// on the type of the parameter. They return 0 on success
+// and -1 if there is no such parameter.
+int FRELIBA_SetParam(FRELIBA *fx, int param, const void *value);
+int FRELIBA_SetParamByName(FRELIBA *fx, const char *name, const void *value);
+int FRELIBA_GetParam(const FRELIBA *fx, int param, void *value);
+
+// Sets a parameter from text of the form "name=value", where the
+// value is a number for FRELIBA_PARAM_BOOL and FRELIBA_PARAM_DOUBLE,
+// "r,g,b" for a color, "x,y" for a position, and anything at all
+// for a string. Returns 0 on success, -1 if there is no such
+// parameter or the value makes no sense for it.
+int FRELIBA_ParseParam(FRELIBA *fx, const char *setting);
+
+// Does whatever the effect needs to do after its parameters
+// have changed, so that the next FRELIBA_Apply only has the
+// pixels to deal with. Calling it is optional: FRELIBA_Apply
+// will do the same when it finds it has not been done.
+void FRELIBA_Prepare(FRELIBA *fx);
+
+// Applies the effect to a frame of width by height pixels,
+// 8 bits per channel, in the model of the instance. Their rows
+// start srcstride and dststride bytes apart (0 means width * 4).
+// The source and destination may be the same buffer. Alpha is
+// copied from src to dst.
+void FRELIBA_Apply(FRELIBA *fx, const void *src, ptrdiff_t srcstride, void *dst, ptrdiff_t dststride, size_t width, size_t height);
+
+// Tells the effect the time (in seconds, or anything else that goes
+// up from one frame to the next) of the frames FRELIBA_Apply gets
+// from now on. Most effects do not care, but those that change from
+// one frame to the next (e.g., autobalance) only know a new frame
+// by its time. It is 0 unless set.
+void FRELIBA_SetTime(FRELIBA *fx, double time);
+
+// Returns 1 if the effect changes from one frame to the next, so it
+// has to see all the frames, whole and in order, through a single
+// instance. Splitting the frames (or their rows) among instances
+// of it in separate threads would give each a different view of
+// the video, and the results would flicker. Returns 0 otherwise.
+int FRELIBA_Timed(const FRELIBA *fx);
+
+// Limits what FRELIBA_Apply (and FRELIBA_ApplyChain) does to a
+// rectangle of width by height pixels whose top left corner is at
+// x, y (a width or height of 0 reaches the edge of the frame; all
+// zeros are the whole frame). The pixels outside it are copied, or
+// not touched at all if the frame is processed in place.
+void FRELIBA_SetRegion(FRELIBA *fx, size_t x, size_t y, size_t width, size_t height);
+
+// With mask set, the alpha of each pixel says how much of the
+// effect it gets: none at 0, all of it at 255, and a mix of before
+// and after anywhere between. The wider and the Y'CbCr paths below
+// know nothing of regions or masks.
+void FRELIBA_SetMask(FRELIBA *fx, int mask);
+
+// Applies n effects, one after the other, to a frame, the same
+// as calling FRELIBA_Apply for each of them in turn, only a tile
+// at a time: each tile, small enough to stay in the cache, goes
+// through all of the effects before we read the next one. That
+// way the frame travels to and from memory once, not n times.
+// The effects must all be created for the same model. With no
+// effects, src is just copied to dst.
+void FRELIBA_ApplyChain(FRELIBA *const *chain, unsigned int n, const void *src, ptrdiff_t srcstride, void *dst, ptrdiff_t dststride, size_t width, size_t height);
+
+// Statistics for quality control, gathered as the frame is graded
+// instead of in a pass of their own: histograms of red, green, blue
+// and luma (from the code values, with the Rec. 709 weights) of the
+// pixels before and after, and how many channel values were clamped
+// to black or white that were not black or white to begin with.
+// Red, green and blue are in that order whatever the model is.
+#define	FRELIBA_STATLUMA	3
+
+typedef struct _FRELIBA_STATS {
+	unsigned long long	pixels;
+	unsigned long long	in[4][256];
+	unsigned long long	out[4][256];
+	unsigned long long	clipped[3][2];	// Black, white
+} FRELIBA_STATS;
+
+// Empties the statistics, or adds more to them. Threads grading
+// parts of the same frame (or of the same clip) should each keep
+// their own, and merge them once they are done.
+void FRELIBA_ClearStats(FRELIBA_STATS *stats);
+void FRELIBA_MergeStats(FRELIBA_STATS *stats, const FRELIBA_STATS *more);
+
+// Adds count pixels, before (src) and after (dst) grading, to the
+// statistics, for those who grade the frames some other way.
+void FRELIBA_Rgba8Stats(FRELIBA_STATS *stats, const void *src, const void *dst, size_t count, int model);
+
+// Does what FRELIBA_ApplyChain does, and adds the frame to the
+// statistics (unless they are NULL) while each tile is still in the
+// cache. With no effects, the pixels are taken to be RGBA. Returns 0,
+// or -1 if there was no memory to keep the pixels of a frame graded
+// in place until we are done with them, in which case the frame is
+// graded but the statistics are left alone.
+int FRELIBA_ApplyChainStats(FRELIBA *const *chain, unsigned int n, FRELIBA_STATS *stats, const void *src, ptrdiff_t srcstride, void *dst, ptrdiff_t dststride, size_t width, size_t height);
+
+// Writes the statistics to text as a line of JSON, with the least,
+// greatest and mean values, the histograms, and the clamped counts.
+// Like snprintf, it never writes more than size bytes (the last of
+// them '\0'), and returns how long the whole text is.
+size_t FRELIBA_StatsReport(const FRELIBA_STATS *stats, char *text, size_t size);
+
+// The same with 16 bits per channel (RGBA64, or BGRA64 for an
+// instance created for FRELIBA_MODEL_BGRA8888), 8 bytes per pixel.
+// Only the effects that boil down to a single FLUT, with all of
+// its terms in use, can do this. Returns 0 on success, -1 if the
+// effect cannot.
+int FRELIBA_ApplyRgba16(FRELIBA *fx, const void *src, ptrdiff_t srcstride, void *dst, ptrdiff_t dststride, size_t width, size_t height);
+
+// The same with a 32-bit float per channel, 16 bytes per pixel,
+// for scene-linear (e.g., OpenEXR) frames. The pixels are taken
+// to be linear whatever the sRGB parameter of the effect says,
+// and nothing is clamped: values outside 0 to 1 go through the
+// effect just like any others.
+int FRELIBA_ApplyRgbaf(FRELIBA *fx, const void *src, ptrdiff_t srcstride, void *dst, ptrdiff_t dststride, size_t width, size_t height);
+
+// The Y'CbCr matrices FRELIBA_ApplyYuv knows.
+#define	FRELIBA_YUV601	0
+#define	FRELIBA_YUV709	1
+#define	FRELIBA_YUV2020	2
+
+// Applies the effect to a planar Y'CbCr frame, 8 bits per
+// sample, without converting it to RGBA and back. The Y, Cb and
+// Cr planes are src[0], src[1] and src[2], their rows srcstride[0],
+// etc., bytes apart (and the same for dst). The chroma planes are
+// subsampled xshift and yshift times (0 or 1): 0, 0 is 4:4:4,
+// 1, 0 is 4:2:2, and 1, 1 is 4:2:0. If full is 0, the samples are
+// in the video range (16-235 and 16-240). The planes may be done
+// in place. Only the effects that boil down to a single FLUT,
+// with all of its terms in use, can do this; returns 0 on success,
+// -1 if the effect cannot.
+int FRELIBA_ApplyYuv(FRELIBA *fx, const void *const src[3], const ptrdiff_t srcstride[3], void *const dst[3], const ptrdiff_t dststride[3], size_t width, size_t height, int matrix, int xshift, int yshift, int full);
+
+// The same for a chain of n effects, a band of rows at a time,
+// as FRELIBA_ApplyChain does. Returns -1 without touching the
+// frame if any of the effects cannot do this.
+int FRELIBA_ApplyYuvChain(FRELIBA *const *chain, unsigned int n, const void *const src[3], const ptrdiff_t srcstride[3], void *const dst[3], const ptrdiff_t dststride[3], size_t width, size_t height, int matrix, int xshift, int yshift, int full);
+
+// Samples what n effects, one after the other, do to a lattice
+// of size x size x size colors, evenly spread from 0 to 1, into
+// points (3 floats per color, red changing fastest), just as they
+// would do it to a frame, sRGB settings and all. When every one of
+// them boils down to a FLUT with all of its terms in use, the
+// samples are exact and several threads calculate them. Otherwise
+// the colors are rounded to bytes and go through the effects as
+// any frame would, which is only as precise as 8 bits are. Returns
+// points, or NULL if size is below 2.
+float * FRELIBA_SampleChain(FRELIBA *const *chain, unsigned int n, float *points, unsigned int size);
+
+// The formats FRELIBA_WriteLut and FRELIBA_ExportLut know.
+#define	FRELIBA_LUTCUBE	0	// .cube, as Resolve and Adobe read it
+#define	FRELIBA_LUTHALD	1	// A Hald CLUT, as a 16-bit binary PPM
+#define	FRELIBA_LUTRAW	2	// Just the floats, in our byte order
+
+// Writes a lattice of points as FRELIBA_SampleChain makes them to
+// a file. A Hald CLUT of level L has L * L points along each axis,
+// so size must be a square (e.g., 64 for level 8). Returns 0 on
+// success, -1 on failure.
+int FRELIBA_WriteLut(const char *path, int format, const float *points, unsigned int size);
+
+// Both of the above at once, for those who can send our grades
+// only where 3D LUTs are accepted.
+int FRELIBA_ExportLut(FRELIBA *const *chain, unsigned int n, unsigned int size, int format, const char *path);
+
+// A connection to freliba-server (Linux only), which applies a
+// grade for us and everyone else who asks for the same one, so its
+// effects are only set up once however many processes use them.
+// The grade is a list of effects separated by spaces, each followed
+// by its parameters, as in "palette:sRGB=1:Efficacy=0.5 tint". The
+// frames are width by height pixels in the model. With a NULL
+// socketpath, we connect to where the server listens by default.
+// Returns NULL if there is no server, or it does not like the grade.
+typedef struct _FRELIBA_REMOTE FRELIBA_REMOTE;
+
+FRELIBA_REMOTE * FRELIBA_Connect(const char *socketpath, const char *grade, size_t width, size_t height, int model);
+void FRELIBA_Disconnect(FRELIBA_REMOTE *remote);
+
+// The simple way: the frame is copied to the server's shared memory,
+// graded there, and copied back. Returns 0 on success, -1 on failure
+// (including a frame of a different size than we connected for).
+int FRELIBA_RemoteApply(FRELIBA_REMOTE *remote, const void *src, ptrdiff_t srcstride, void *dst, ptrdiff_t dststride, size_t width, size_t height);
+
+// The fast way, without the copies and with several frames in flight:
+// write a tightly packed frame to FRELIBA_RemoteFrame(remote, slot),
+// FRELIBA_RemoteSubmit it, and once FRELIBA_RemoteWait returns 0, the
+// graded frame is there. The slots must be submitted in order, from 0
+// to FRELIBA_RemoteSlots(remote) - 1 and back to 0. Do not mix this
+// with FRELIBA_RemoteApply on the same connection.
+unsigned int FRELIBA_RemoteSlots(const FRELIBA_REMOTE *remote);
+void * FRELIBA_RemoteFrame(FRELIBA_REMOTE *remote, unsigned int slot);
+int FRELIBA_RemoteSubmit(FRELIBA_REMOTE *remote, unsigned int slot);
+int FRELIBA_RemoteWait(FRELIBA_REMOTE *remote, unsigned int slot);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	// _LIBFRELIBA_H_
@@ -25,9 +25,16 @@
 */
 
 #include	<koliba.h>
+#include	"freliba.h"
 #include	<stdlib.h>
 #include	<math.h>
 
+#ifdef	_WIN32
+#include	<windows.h>
+#else
+#include	<pthread.h>
+#endif
+
 // We define the x, y, z dimensions here, so we can test
 // this with a variety of them.
 
@@ -80,6 +87,47 @@ static KOLIBA_FLUT fLut[XDIM*YDIM*ZDIM];
 // any FLUT has already been calculated.
 static KOLIBA_FLAGS flags[XDIM*YDIM*ZDIM] = {0};
 
+// The instances may render in different threads, so we cannot
+// let KOLIBA_FlyRgba8Pixel fill in the tables as it goes: one
+// thread could see a flag before the FLUT it stands for. So the
+// first frame of any instance has all of them filled in at once,
+// by feeding KOLIBA_FlyRgba8Pixel colors that fall into every
+// cell (the smallest is 1/8 of the range, so every fourth byte
+// and 255 will do), and from then on they are only ever read.
+static unsigned int nextbyte(unsigned int v) {
+	return (v == 252) ? 255 : v + 4;
+}
+
+static void filltables(void) {
+	KOLIBA_RGBA8PIXEL in, out;
+	unsigned int r, g, b;
+
+	in.a	= 255;
+
+	for (b = 0; b < 256; b = nextbyte(b))
+	for (g = 0; g < 256; g = nextbyte(g))
+	for (r = 0; r < 256; r = nextbyte(r)) {
+		in.r	= (unsigned char)r;
+		in.g	= (unsigned char)g;
+		in.b	= (unsigned char)b;
+		KOLIBA_FlyRgba8Pixel(&out, &in, fLut, flags, dim, KOLIBA_MakeVertex, &KOLIBA_PiDiv2, NULL, NULL);
+	}
+}
+
+#ifdef	_WIN32
+static INIT_ONCE fillonce = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK fillinit(PINIT_ONCE once, PVOID param, PVOID *context) {
+	filltables();
+	return TRUE;
+}
+
+#define	fill()	InitOnceExecuteOnce(&fillonce, fillinit, NULL, NULL)
+#else
+static pthread_once_t fillonce = PTHREAD_ONCE_INIT;
+#define	fill()	pthread_once(&fillonce, filltables)
+#endif
+
 typedef	struct _lut_instance {
 	size_t			count;
 	unsigned char	srgb;
@@ -88,10 +136,10 @@ typedef	struct _lut_instance {
 typedef	void	*f0r_param_t;
 
 void f0r_get_plugin_info(f0r_plugin_info_t* info) {
-	info->name				= "Koliba LUT Test";
+	info->name				= "Koliba LUT Test" FRELIBA_NAME_SUFFIX;
 	info->author			= "G. Adam Stanislav";
 	info->plugin_type		= F0R_PLUGIN_TYPE_FILTER;
-	info->color_model		= F0R_COLOR_MODEL_RGBA8888;
+	info->color_model		= FRELIBA_COLOR_MODEL;
 	info->frei0r_version	= FREI0R_MAJOR_VERSION;
 	info->major_version		= 1;
 	info->minor_version		= 0;
@@ -145,7 +193,10 @@ void f0r_get_param_value(f0r_instance_t instance, f0r_param_t param, int param_i
 	}
 }
 
-void f0r_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe) {
+// Does the actual work for f0r_update and freliba_update,
+// count pixels at a time.
+static void update(void *data, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe, size_t count) {
+	f0r_instance_t instance = (f0r_instance_t)data;
 	unsigned int ind[3];
 	int index;
 
@@ -154,6 +205,8 @@ void f0r_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *i
 		const double *iconv;
 		const unsigned char *oconv;
 
+		fill();
+
 		if (instance->srgb) {
 			iconv = KOLIBA_SrgbByteToLinear;
 			oconv = KOLIBA_LinearByteToSrgb;
@@ -163,10 +216,26 @@ void f0r_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *i
 			oconv = NULL;
 		}
 
-		for (i = instance->count; i; i--, inframe++, outframe++) {
-			// This will will out the fLut array and the flags array on the go
-			// as needed, and apply the effect on the fly.
+		for (i = count; i; i--, inframe++, outframe++) {
+			// The fLut array and the flags array are all filled
+			// in by now, so this only applies the effect.
 			KOLIBA_FlyRgba8Pixel(outframe, inframe, fLut, flags, dim, KOLIBA_MakeVertex, &KOLIBA_PiDiv2, iconv, oconv)->a = inframe->a;
 		}
 	}
 }
+
+void freliba_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, ptrdiff_t instride, KOLIBA_RGBA8PIXEL *outframe, ptrdiff_t outstride, size_t width, size_t height) {
+	FRELIBA_RgbaOnlyRows(update, instance, inframe, instride, outframe, outstride, width, height);
+}
+
+// We do not work through a FRELIBA_FASTFLUT, so there is
+// no RGBA64 path for us.
+const FRELIBA_FASTFLUT * freliba_fastflut(f0r_instance_t instance) {
+	return NULL;
+}
+
+// Koliba only knows RGBA, so in BGRA builds even the frames
+// frei0r gives us go through freliba_update.
+void f0r_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe) {
+	if (instance != NULL) freliba_update(instance, time, inframe, 0, outframe, 0, instance->count, 1);
+}
@@ -26,6 +26,7 @@
 
 #define	KOLIBCALLS
 #include	<koliba.h>
+#include	"freliba.h"
 #include	<stdlib.h>
 
 #ifdef __cplusplus
@@ -2180,10 +2181,10 @@ static const unsigned int FlutFlags[1] = {
 };
 
 void f0r_get_plugin_info(f0r_plugin_info_t* info) {
-	info->name				= "Koliba Lutty";
+	info->name				= "Koliba Lutty" FRELIBA_NAME_SUFFIX;
 	info->author			= "G. Adam Stanislav";
 	info->plugin_type		= F0R_PLUGIN_TYPE_FILTER;
-	info->color_model		= F0R_COLOR_MODEL_RGBA8888;
+	info->color_model		= FRELIBA_COLOR_MODEL;
 	info->frei0r_version	= FREI0R_MAJOR_VERSION;
 	info->major_version		= 1;
 	info->minor_version		= 0;
@@ -2237,7 +2238,10 @@ void f0r_get_param_value(f0r_instance_t instance, f0r_param_t param, int param_i
 	}
 }
 
-void f0r_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe) {
+// Does the actual work for f0r_update and freliba_update,
+// count pixels at a time.
+static void update(void *data, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe, size_t count) {
+	f0r_instance_t instance = (f0r_instance_t)data;
 	KOLIBA_XYZ xyz;
 	unsigned int ind[3];
 	int index;
@@ -2256,7 +2260,7 @@ void f0r_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *i
 			oconv = NULL;
 		}
 
-		for (i = instance->count; i; i--, inframe++, outframe++) {
+		for (i = count; i; i--, inframe++, outframe++) {
 			// Convert the r, g, b channels of KOLIBA_RGBA8PIXEL
 			// to KOLIBA_XYZ, but remember the alpha channel for
 			// later, as this plug-in does not affect the alpha
@@ -2274,6 +2278,22 @@ void f0r_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *i
 	}
 }
 
+void freliba_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, ptrdiff_t instride, KOLIBA_RGBA8PIXEL *outframe, ptrdiff_t outstride, size_t width, size_t height) {
+	FRELIBA_RgbaOnlyRows(update, instance, inframe, instride, outframe, outstride, width, height);
+}
+
+// We do not work through a FRELIBA_FASTFLUT, so there is
+// no RGBA64 path for us.
+const FRELIBA_FASTFLUT * freliba_fastflut(f0r_instance_t instance) {
+	return NULL;
+}
+
+// Koliba only knows RGBA, so in BGRA builds even the frames
+// frei0r gives us go through freliba_update.
+void f0r_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe) {
+	if (instance != NULL) freliba_update(instance, time, inframe, 0, outframe, 0, instance->count, 1);
+}
+
 
 
 
@@ -13,6 +13,7 @@
 */
 
 #include	<koliba.h>
+#include	"freliba.h"
 #include	<stdlib.h>
 #include	<string.h>
 #include	<stdint.h>
@@ -96,10 +97,10 @@ const uint64_t vrt[] = {
 KOLIBA_SLUT *sLut[2] = { (KOLIBA_SLUT *)&eLut_D08, (KOLIBA_SLUT *)&eLut_768B };
 
 void f0r_get_plugin_info(f0r_plugin_info_t* info) {
-	info->name				= "Koliba Magic Flute";
+	info->name				= "Koliba Magic Flute" FRELIBA_NAME_SUFFIX;
 	info->author			= "G. Adam Stanislav";
 	info->plugin_type		= F0R_PLUGIN_TYPE_FILTER;
-	info->color_model		= F0R_COLOR_MODEL_RGBA8888;
+	info->color_model		= FRELIBA_COLOR_MODEL;
 	info->frei0r_version	= FREI0R_MAJOR_VERSION;
 	info->major_version		= 1;
 	info->minor_version		= 1;
@@ -338,48 +339,84 @@ void f0r_get_param_value(f0r_instance_t instance, f0r_param_t param, int param_i
 }
 
 
-void f0r_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe) {
+// Does the actual work for f0r_update and freliba_update,
+// count pixels at a time.
+static void update(void *data, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe, size_t count) {
+	f0r_instance_t instance = (f0r_instance_t)data;
+
 	if ((instance != NULL) && (inframe != NULL) && (outframe != NULL)) {
-		size_t i = instance->count;
+		size_t i = count;
 		const double *iconv;
 		const unsigned char *oconv;
+		int idle[2];
 
 		// Changed or not, if both efficacies are 0, just do a quick copy
 		// of all input pixels to corresponding output pixels.
 		if ((instance->efficacy[0] == 0.0) && (instance->efficacy[1] == 0.0))
-			memcpy(outframe, inframe, i*sizeof(KOLIBA_RGBA8PIXEL));
+			FRELIBA_CopyRgba8Frame(outframe, inframe, i);
 		else {
 			if (instance->changed[0]) {
 				KOLIBA_InterpolateSluts(&instance->sLut[0], sLut[0], instance->lut, sLut[1]);
 				KOLIBA_Interpolate((double *)&instance->sLut[0].Magenta, (double *)vrt, instance->magenta, (double *)&instance->sLut[0].Magenta, 3);
 				KOLIBA_SlutEfficacy(&instance->sLut[0], &instance->sLut[0], (instance->inverse[0]) ? -instance->efficacy[0] : instance->efficacy[0]);
-				instance->ffLut[0].flags = KOLIBA_FlutFlags(KOLIBA_ConvertSlutToFlut(&instance->fLut[0], &instance->vertices[0]));
+				instance->ffLut[0].flags = KOLIBA_FlutFlags(FRELIBA_OrderFlut(KOLIBA_ConvertSlutToFlut(&instance->fLut[0], &instance->vertices[0])));
 				instance->changed[0]	 = 0;
 			}
 
 			if (instance->changed[1]) {
 				KOLIBA_ColorRoller(&instance->sLut[1], instance->imp, instance->angle * 360.0, instance->atmo * 360.0, instance->fx, (instance->inverse[1]) ? -instance->efficacy[1] : instance->efficacy[1]);
-				instance->ffLut[1].flags = KOLIBA_FlutFlags(KOLIBA_ConvertSlutToFlut(&instance->fLut[1], &instance->vertices[1]));
+				instance->ffLut[1].flags = KOLIBA_FlutFlags(FRELIBA_OrderFlut(KOLIBA_ConvertSlutToFlut(&instance->fLut[1], &instance->vertices[1])));
 
 				// Only the last LUT in the chain of LUTs is scaled.
 				KOLIBA_ScaleFlut(&instance->fLut[1], &instance->fLut[1], 255.0);
 				instance->changed[1]	 = 0;
 			}
 
-			if (instance->srgb) {
-				iconv = KOLIBA_SrgbByteToLinear;
-				oconv = KOLIBA_LinearByteToSrgb;
-			}
-			else {
-				iconv = NULL;
-				oconv = NULL;
-			}
+			// Either link of the chain may do nothing at its current
+			// settings, in which case we leave it out of the chain.
+			// The last link can be close enough to an identity, but
+			// the first one is stretched by the one after it, so we
+			// only leave it out when it is an exact identity.
+			idle[0] = KOLIBA_IsIdentityFlut(&instance->fLut[0]);
+			idle[1] = FRELIBA_IsNearIdentityScaledFlut(&instance->fLut[1], instance->srgb);
 
-			for (; i; i--, inframe++, outframe++) {
-				KOLIBA_ScaledPolyRgba8Pixel(outframe, inframe, instance->ffLut, 2, iconv, oconv)->a = inframe->a;
+			if ((idle[0]) && (idle[1])) FRELIBA_CopyRgba8Frame(outframe, inframe, i);
+			else {
+				if (instance->srgb) {
+					iconv = KOLIBA_SrgbByteToLinear;
+					oconv = KOLIBA_LinearByteToSrgb;
+				}
+				else {
+					iconv = NULL;
+					oconv = NULL;
+				}
+
+				if (idle[0]) for (; i; i--, inframe++, outframe++) {
+					KOLIBA_ScaledRgba8Pixel(outframe, inframe, &instance->fLut[1], instance->ffLut[1].flags, iconv, oconv)->a = inframe->a;
+				}
+				else if (idle[1]) for (; i; i--, inframe++, outframe++) {
+					KOLIBA_Rgba8Pixel(outframe, inframe, &instance->fLut[0], instance->ffLut[0].flags, iconv, oconv)->a = inframe->a;
+				}
+				else for (; i; i--, inframe++, outframe++) {
+					KOLIBA_ScaledPolyRgba8Pixel(outframe, inframe, instance->ffLut, 2, iconv, oconv)->a = inframe->a;
+				}
 			}
 		}
 	}
 }
 
+void f0r_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe) {
+	if (instance != NULL) update(instance, inframe, outframe, instance->count);
+}
+
+void freliba_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, ptrdiff_t instride, KOLIBA_RGBA8PIXEL *outframe, ptrdiff_t outstride, size_t width, size_t height) {
+	FRELIBA_Rgba8Rows(update, instance, inframe, instride, outframe, outstride, width, height);
+}
+
+// We do not work through a FRELIBA_FASTFLUT, so there is
+// no RGBA64 path for us.
+const FRELIBA_FASTFLUT * freliba_fastflut(f0r_instance_t instance) {
+	return NULL;
+}
+
 
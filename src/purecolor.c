@@ -21,14 +21,32 @@
 	corresponding flag equals zero, we will simply fill the
 	falgs array with zeros whenever such a change happens.
 
+	The FLUTs take up megabytes, so they do not live in the
+	instance. Instead, we keep a list of grids, one for each
+	set of impurities in use, and all instances with the same
+	impurities share the same grid. A grid is only allocated
+	when an instance renders its first frame, and it is freed
+	when the last instance using it lets go of it. Since the
+	instances sharing a grid may render in different threads,
+	we do not let KOLIBA_FlyRgba8Pixel fill it in as it goes.
+	We fill in all of its FLUTs before anyone gets to use it,
+	so from then on it is only ever read.
+
 	It needs to be linked dynamically using the -lkoliba switch
 	in Unix and its derivatives, or koliba.lib in Windows.
 */
 
 #include	<koliba.h>
+#include	"freliba.h"
 #include	<stdlib.h>
 #include	<string.h>
 
+#ifdef	_WIN32
+#include	<windows.h>
+#else
+#include	<pthread.h>
+#endif
+
 // We define the x, y, z dimensions here, so we can test
 // this with a variety of them.
 
@@ -69,22 +87,121 @@ typedef struct f0r_param_info
 // static and const.
 static const unsigned int dim[3] = {XDIM, YDIM, ZDIM};
 
-typedef	struct _purecol_instance {
+// The grid of FLUTs for one set of impurities, all of them
+// filled in by fillgrid() before it goes on the list.
+typedef	struct _purecol_grid {
+	struct _purecol_grid	*next;
+	KOLIBA_RGB		impurities;
+	unsigned int	refs;
+	KOLIBA_FLAGS	flags[XDIM*YDIM*ZDIM];
 	KOLIBA_FLUT		fLut[XDIM*YDIM*ZDIM];
+} purecol_grid;
+
+typedef	struct _purecol_instance {
+	purecol_grid	*grid;
 	KOLIBA_RGB		impurities;
 	size_t			count;
-	KOLIBA_FLAGS	flags[XDIM*YDIM*ZDIM];
 	unsigned char	changed;
 	unsigned char	srgb;
 } purecol_instance, *f0r_instance_t;
 
+// The hosts may construct, destruct, and render different
+// instances in different threads, so the list is guarded.
+static purecol_grid *grids = NULL;
+
+#ifdef	_WIN32
+static SRWLOCK gridlock = SRWLOCK_INIT;
+#define	lockgrids()		AcquireSRWLockExclusive(&gridlock)
+#define	unlockgrids()	ReleaseSRWLockExclusive(&gridlock)
+#else
+static pthread_mutex_t gridlock = PTHREAD_MUTEX_INITIALIZER;
+#define	lockgrids()		pthread_mutex_lock(&gridlock)
+#define	unlockgrids()	pthread_mutex_unlock(&gridlock)
+#endif
+
+// Has KOLIBA_FlyRgba8Pixel fill in every FLUT of the grid,
+// by feeding it colors that fall into every one of its cells.
+// A cell is 1/32 of the range wide along each axis, so every
+// fourth byte (and 255) lands in each of them at least once.
+// Decoding sRGB only moves a pixel to another cell of the same
+// grid, so going through the bytes as they are reaches them all.
+static unsigned int nextbyte(unsigned int v) {
+	return (v == 252) ? 255 : v + 4;
+}
+
+static void fillgrid(purecol_grid *grid) {
+	KOLIBA_RGBA8PIXEL in, out;
+	unsigned int r, g, b;
+
+	in.a	= 255;
+
+	for (b = 0; b < 256; b = nextbyte(b))
+	for (g = 0; g < 256; g = nextbyte(g))
+	for (r = 0; r < 256; r = nextbyte(r)) {
+		in.r	= (unsigned char)r;
+		in.g	= (unsigned char)g;
+		in.b	= (unsigned char)b;
+		KOLIBA_FlyRgba8Pixel(&out, &in, grid->fLut, grid->flags, dim, KOLIBA_PureColor, &grid->impurities, NULL, NULL);
+	}
+}
+
+// Returns the grid for the impurities, allocating and filling
+// it if no other instance uses those impurities yet. It is
+// filled under the lock, so nobody finds it half done. Returns
+// NULL if we are out of memory.
+static purecol_grid * acquiregrid(const KOLIBA_RGB *impurities) {
+	purecol_grid *grid;
+
+	lockgrids();
+
+	for (grid = grids; grid != NULL; grid = grid->next) {
+		if ((grid->impurities.r == impurities->r) &&
+			(grid->impurities.g == impurities->g) &&
+			(grid->impurities.b == impurities->b)) break;
+	}
+
+	// All flags start at zero, so calloc() is all the
+	// initialization a new grid needs before we fill it.
+	if ((grid == NULL) && ((grid = calloc(sizeof(purecol_grid), 1)) != NULL)) {
+		grid->impurities	= *impurities;
+		fillgrid(grid);
+		grid->next			= grids;
+		grids				= grid;
+	}
+
+	if (grid != NULL) grid->refs++;
+
+	unlockgrids();
+	return grid;
+}
+
+static void releasegrid(purecol_grid *grid) {
+	purecol_grid **link;
+
+	if (grid == NULL) return;
+
+	lockgrids();
+
+	if (--grid->refs == 0) {
+		for (link = &grids; *link != NULL; link = &(*link)->next) {
+			if (*link == grid) {
+				*link = grid->next;
+				break;
+			}
+		}
+		free(grid);
+	}
+
+	unlockgrids();
+}
+
 typedef	void	*f0r_param_t;
 
 void f0r_get_plugin_info(f0r_plugin_info_t* info) {
-	info->name				= "Koliba Pure Color";
+	info->name				= "Koliba Pure Color" FRELIBA_NAME_SUFFIX;
 	info->author			= "G. Adam Stanislav";
 	info->plugin_type		= F0R_PLUGIN_TYPE_FILTER;
-	info->color_model		= F0R_COLOR_MODEL_RGBA8888;
+	info->color_model		= FRELIBA_COLOR_MODEL;
 	info->frei0r_version	= FREI0R_MAJOR_VERSION;
 	info->major_version		= 1;
 	info->minor_version		= 0;
@@ -104,15 +221,20 @@ f0r_instance_t f0r_construct(unsigned int width, unsigned int height) {
 	if ((instance = calloc(sizeof(purecol_instance),1)) != NULL) {
 		instance->count			= (size_t)width * (size_t)height;
 		instance->srgb			= 1;
+		instance->changed		= 1;
 
-		// We do not need to set the value of "changed" because it is 0,
-		// which is what calloc() set everything to. Same for the flags.
+		// The impurities are 0 and there is no grid yet,
+		// which is what calloc() set everything to. We get
+		// the grid when we render the first frame.
 	}
 	return instance;
 }
 
 void f0r_destruct(f0r_instance_t instance) {
-	if (instance != NULL) free(instance);
+	if (instance != NULL) {
+		releasegrid(instance->grid);
+		free(instance);
+	}
 }
 
 void f0r_get_param_info(f0r_param_info_t* info, int param_index) {
@@ -143,17 +265,23 @@ void f0r_get_param_info(f0r_param_info_t* info, int param_index) {
 void f0r_set_param_value(f0r_instance_t instance, f0r_param_t param, int param_index) {
 	if ((instance != NULL) && (param != NULL)) switch (param_index) {
 		case 0:
+			if (instance->impurities.r		!= *(double *)param) {
 				instance->impurities.r		 = *(double *)param;
 				instance->changed			 = 1;
-				break;
+			}
+			break;
 		case 1:
+			if (instance->impurities.g		!= *(double *)param) {
 				instance->impurities.g		 = *(double *)param;
 				instance->changed			 = 1;
-				break;
+			}
+			break;
 		case 2:
+			if (instance->impurities.b		!= *(double *)param) {
 				instance->impurities.b		 = *(double *)param;
 				instance->changed			 = 1;
-				break;
+			}
+			break;
 		case 3:
 				instance->srgb				 = ((*(double *)param) >= 0.5);
 			break;
@@ -177,7 +305,11 @@ void f0r_get_param_value(f0r_instance_t instance, f0r_param_t param, int param_i
 	}
 }
 
-void f0r_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe) {
+// Does the actual work for f0r_update and freliba_update,
+// count pixels at a time.
+static void update(void *data, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe, size_t count) {
+	f0r_instance_t instance = (f0r_instance_t)data;
+	purecol_grid *grid;
 	KOLIBA_XYZ xyz;
 	unsigned int ind[3];
 	int index;
@@ -187,9 +319,29 @@ void f0r_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *i
 		const double *iconv;
 		const unsigned char *oconv;
 
+		// Some hosts set every parameter before every frame, and
+		// filling a grid takes a while, so we keep the grid we
+		// have if the impurities are back to what it was made
+		// for. Otherwise we get the new grid before we let go
+		// of the old one.
 		if (instance->changed != 0) {
-			memset(instance->flags, 0, sizeof(unsigned int)*XDIM*YDIM*ZDIM);
-			instance->changed = 0;
+			grid	= instance->grid;
+
+			if ((grid == NULL) ||
+				(grid->impurities.r != instance->impurities.r) ||
+				(grid->impurities.g != instance->impurities.g) ||
+				(grid->impurities.b != instance->impurities.b)) {
+				instance->grid	= acquiregrid(&instance->impurities);
+				releasegrid(grid);
+			}
+			instance->changed	= 0;
+		}
+
+		// Out of memory, nothing we can do but pass the frame through.
+		if (instance->grid == NULL) {
+			FRELIBA_CopyRgba8Frame(outframe, inframe, count);
+			instance->changed	= 1;
+			return;
 		}
 
 		if (instance->srgb) {
@@ -201,8 +353,24 @@ void f0r_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *i
 			oconv = NULL;
 		}
 
-		for (i = instance->count; i; i--, inframe++, outframe++) {
-			KOLIBA_FlyRgba8Pixel(outframe, inframe, instance->fLut, instance->flags, dim, KOLIBA_PureColor, &instance->impurities, iconv, oconv)->a = inframe->a;
+		for (i = count; i; i--, inframe++, outframe++) {
+			KOLIBA_FlyRgba8Pixel(outframe, inframe, instance->grid->fLut, instance->grid->flags, dim, KOLIBA_PureColor, &instance->grid->impurities, iconv, oconv)->a = inframe->a;
 		}
 	}
 }
+
+void freliba_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, ptrdiff_t instride, KOLIBA_RGBA8PIXEL *outframe, ptrdiff_t outstride, size_t width, size_t height) {
+	FRELIBA_RgbaOnlyRows(update, instance, inframe, instride, outframe, outstride, width, height);
+}
+
+// We do not work through a FRELIBA_FASTFLUT, so there is
+// no RGBA64 path for us.
+const FRELIBA_FASTFLUT * freliba_fastflut(f0r_instance_t instance) {
+	return NULL;
+}
+
+// Koliba only knows RGBA, so in BGRA builds even the frames
+// frei0r gives us go through freliba_update.
+void f0r_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe) {
+	if (instance != NULL) freliba_update(instance, time, inframe, 0, outframe, 0, instance->count, 1);
+}
@@ -0,0 +1,526 @@
+/*
+	stack.c
+
+	Copyright 2021 G. Adam Stanislav.
+	All rights reserved.
+
+	http://www.pantarheon.org
+
+	This is a frei0r-compatible plug-in, hosting an ordered
+	stack of other Koliba effects and applying all of them
+	to each frame, in as few passes over it as possible.
+
+	The stack is a single string parameter, listing the effects
+	separated by spaces, each followed by its parameters, the
+	same way freliba-apply takes them, e.g.,
+
+		natcon saturation:Saturation=0.8 warm-and-cold
+
+	Every effect which is a FLUT at its current settings is
+	combined with the FLUTs next to it: A FLUT followed by a
+	matrix is itself a FLUT, so we fold the matrix into it,
+	and so is a separable matrix (one that only scales and
+	offsets each channel) followed by a FLUT. Anything else
+	becomes a chain of FLUTs applied to each pixel in one go.
+	Only the effects which are not FLUTs at all need passes
+	of their own, and we make all of them over one tile of
+	the frame, small enough to stay in the cache, before we
+	move on to the next tile.
+
+	The stack can be limited to a rectangle of the frame (a
+	power window), given as fractions of its width and height,
+	and to the pixels its alpha lets through. Only those pixels
+	go through the effects at all.
+
+	With Statistics on, it also gathers the histograms of the
+	pixels it grades, before and after, their least, greatest
+	and mean values, and how many got clamped, all while each
+	tile is still in the cache. Report returns them for the
+	last frame, as a line of JSON.
+
+	It needs to be linked with libfreliba.a, and dynamically
+	using the -lkoliba switch in Unix and its derivatives,
+	or koliba.lib in Windows.
+*/
+
+#include	<koliba.h>
+#include	"freliba.h"
+#include	"libfreliba.h"
+#include	<stdlib.h>
+#include	<string.h>
+
+/* From frei0r.h, which may or may not be on your system */
+typedef struct f0r_plugin_info
+{
+  const char* name;
+  const char* author;
+  int plugin_type;
+  int color_model;
+  int frei0r_version;
+  int major_version;
+  int minor_version;
+  int num_params;
+  const char* explanation;
+} f0r_plugin_info_t;
+
+typedef struct f0r_param_info
+{
+  const char* name;
+  int type;
+  const char* explanation;
+} f0r_param_info_t;
+
+#define FREI0R_MAJOR_VERSION 1
+#define F0R_PLUGIN_TYPE_FILTER 0
+#define F0R_COLOR_MODEL_RGBA8888 1
+#define	F0R_PARAM_BOOL	0
+#define F0R_PARAM_DOUBLE    1
+#define F0R_PARAM_COLOR     2
+#define F0R_PARAM_POSITION  3
+#define F0R_PARAM_STRING    4
+/* End of frei0r.h extract */
+
+// One pass over the frame. Either an effect which is not a FLUT,
+// or one or more FLUTs, all with the same sRGB setting.
+typedef struct _stack_stage {
+	FRELIBA				*fx;		// NULL for FLUTs
+	KOLIBA_FFLUT		*fChain;
+	unsigned int		links;
+	unsigned char		srgb;
+	FRELIBA_FASTFLUT	fast;		// For a single FLUT
+} stack_stage;
+
+typedef	struct _stack_instance {
+	char			*effects;
+	FRELIBA			**fx;
+	KOLIBA_FLUT		*fLuts;
+	KOLIBA_FFLUT	*fChain;
+	stack_stage		*stages;
+	unsigned int	neffects;
+	unsigned int	nstages;
+	unsigned int	width;
+	unsigned int	height;
+	double			window[4];	// Left, top, width, height
+	FRELIBA_STATS	*stats;
+	KOLIBA_RGBA8PIXEL	*scratch;	// A tile before it is graded in place
+	char			*report;
+	unsigned char	mask;
+	unsigned char	statistics;
+	unsigned char	changed;
+} stack_instance, *f0r_instance_t;
+
+typedef	void	*f0r_param_t;
+
+void f0r_get_plugin_info(f0r_plugin_info_t* info) {
+	info->name				= "Koliba Stack" FRELIBA_NAME_SUFFIX;
+	info->author			= "G. Adam Stanislav";
+	info->plugin_type		= F0R_PLUGIN_TYPE_FILTER;
+	info->color_model		= FRELIBA_COLOR_MODEL;
+	info->frei0r_version	= FREI0R_MAJOR_VERSION;
+	info->major_version		= 1;
+	info->minor_version		= 0;
+	info->num_params		= 8;
+	info->explanation		= "Applies a stack of Koliba effects in as few passes as possible.";
+}
+
+int f0r_init() {
+	return 1;
+}
+
+void f0r_deinit() {}
+
+// Gets rid of the effects and everything we made of them.
+static void unstack(f0r_instance_t instance) {
+	while (instance->neffects) FRELIBA_Destroy(instance->fx[--instance->neffects]);
+	free(instance->fx);
+	free(instance->fLuts);
+	free(instance->fChain);
+	free(instance->stages);
+	instance->fx		= NULL;
+	instance->fLuts		= NULL;
+	instance->fChain	= NULL;
+	instance->stages	= NULL;
+	instance->nstages	= 0;
+}
+
+// Creates the effects the string lists. We ignore any effect
+// we do not know and any parameter it does not understand,
+// since there is no way to tell the host about them.
+static void createeffects(f0r_instance_t instance) {
+	char *copy, *effect, *setting, *savefx, *saveset, *p;
+	unsigned int n = 0;
+
+	if ((instance->effects == NULL) || ((copy = strdup(instance->effects)) == NULL)) return;
+
+	for (p = copy; *p != '\0'; n++) {
+		while (*p == ' ') p++;
+		if (*p == '\0') break;
+		while ((*p != ' ') && (*p != '\0')) p++;
+	}
+
+	if ((n == 0) ||
+		((instance->fx = calloc(n, sizeof(FRELIBA *))) == NULL) ||
+		((instance->fLuts = calloc(2 * n, sizeof(KOLIBA_FLUT))) == NULL) ||
+		((instance->fChain = calloc(2 * n, sizeof(KOLIBA_FFLUT))) == NULL) ||
+		((instance->stages = calloc(n, sizeof(stack_stage))) == NULL)) {
+		free(copy);
+		unstack(instance);
+		return;
+	}
+
+	for (effect = strtok_r(copy, " ", &savefx); effect != NULL; effect = strtok_r(NULL, " ", &savefx)) {
+		setting	= strtok_r(effect, ":", &saveset);
+		if ((instance->fx[instance->neffects] = FRELIBA_CreateModel(setting, FRELIBA_COLOR_MODEL)) == NULL) continue;
+
+		while ((setting = strtok_r(NULL, ":", &saveset)) != NULL)
+			FRELIBA_ParseParam(instance->fx[instance->neffects], setting);
+
+		instance->neffects++;
+	}
+
+	free(copy);
+}
+
+// Turns the effects into as few stages as we can. The FLUTs
+// come from the FASTFLUTs of the effects, so they are already
+// in the order of the pixels of the frame (i.e., swapped for
+// BGRA), which is why our own FASTFLUTs must not swap them again.
+static void stackeffects(f0r_instance_t instance) {
+	const FRELIBA_FASTFLUT *fast;
+	stack_stage *stage = NULL;
+	unsigned int e, s, n = 0;
+
+	for (e = 0; e < instance->neffects; e++) {
+		if ((fast = FRELIBA_EffectFastFlut(instance->fx[e])) == NULL) {
+			stage		= instance->stages + instance->nstages++;
+			stage->fx	= instance->fx[e];
+			continue;
+		}
+
+		// An effect that does nothing at its current settings
+		// does not need to be in the stack at all.
+		if (fast->kind == FRELIBA_FLUTIDENTITY) continue;
+
+		if ((stage == NULL) || (stage->fx != NULL) || (stage->srgb != fast->srgb)) {
+			stage			= instance->stages + instance->nstages++;
+			stage->fChain	= instance->fChain + n;
+			stage->srgb		= fast->srgb;
+		}
+
+		instance->fLuts[n]			= fast->fLut;
+		instance->fChain[n].fLut	= instance->fLuts + n;
+		instance->fChain[n].flags	= fast->flags;
+		stage->links++;
+		n++;
+	}
+
+	// The second half of fLuts and fChain is where each run
+	// of FLUTs goes once we have folded together whatever
+	// we can. What is left may do nothing at all.
+	for (s = 0, e = 0; s < instance->nstages; s++) {
+		stage	= instance->stages + s;
+
+		if (stage->fx == NULL) {
+			n				= stage->fChain - instance->fChain + instance->neffects;
+			stage->links	= FRELIBA_CollapseFlutChain(instance->fLuts + n, instance->fChain + n, stage->fChain, stage->links, stage->srgb);
+			stage->fChain	= instance->fChain + n;
+			if (stage->links == 0) continue;
+			FRELIBA_InitFastFlutModel(&stage->fast, FRELIBA_MODEL_RGBA8888);
+		}
+
+		if (e != s) instance->stages[e]	= *stage;
+		e++;
+	}
+
+	instance->nstages	= e;
+}
+
+f0r_instance_t f0r_construct(unsigned int width, unsigned int height) {
+	f0r_instance_t	instance;
+
+	if ((instance = calloc(sizeof(stack_instance),1)) != NULL) {
+		instance->width			= width;
+		instance->height		= height;
+		instance->window[2]		= 1.0;
+		instance->window[3]		= 1.0;
+		instance->changed		= 1;
+	}
+	return instance;
+}
+
+void f0r_destruct(f0r_instance_t instance) {
+	if (instance != NULL) {
+		unstack(instance);
+		free(instance->stats);
+		free(instance->scratch);
+		free(instance->report);
+		free(instance->effects);
+		free(instance);
+	}
+}
+
+void f0r_get_param_info(f0r_param_info_t* info, int param_index) {
+	switch (param_index) {
+		case 0:
+			info->name			= "Effects";
+			info->type			= F0R_PARAM_STRING;
+			info->explanation	= "The effects to apply, in order, separated by spaces, each followed by its parameters, e.g., saturation:Saturation=0.8.";
+			break;
+		case 1:
+			info->name			= "Left";
+			info->type			= F0R_PARAM_DOUBLE;
+			info->explanation	= "Where the window starts, as a fraction of the frame width.";
+			break;
+		case 2:
+			info->name			= "Top";
+			info->type			= F0R_PARAM_DOUBLE;
+			info->explanation	= "Where the window starts, as a fraction of the frame height.";
+			break;
+		case 3:
+			info->name			= "Width";
+			info->type			= F0R_PARAM_DOUBLE;
+			info->explanation	= "How wide the window is, as a fraction of the frame width.";
+			break;
+		case 4:
+			info->name			= "Height";
+			info->type			= F0R_PARAM_DOUBLE;
+			info->explanation	= "How tall the window is, as a fraction of the frame height.";
+			break;
+		case 5:
+			info->name			= "Alpha Mask";
+			info->type			= F0R_PARAM_BOOL;
+			info->explanation	= "Use the alpha of each pixel as a mask of how much of the stack it gets.";
+			break;
+		case 6:
+			info->name			= "Statistics";
+			info->type			= F0R_PARAM_BOOL;
+			info->explanation	= "Gather histograms and clipping counts of each frame while grading it.";
+			break;
+		case 7:
+			info->name			= "Report";
+			info->type			= F0R_PARAM_STRING;
+			info->explanation	= "The statistics of the last frame, as JSON (read only).";
+			break;
+	}
+}
+
+void f0r_set_param_value(f0r_instance_t instance, f0r_param_t param, int param_index) {
+	const char *effects;
+	char *copy;
+
+	if ((instance != NULL) && (param != NULL)) switch (param_index) {
+		case 0:
+			if ((effects = *(const char **)param) == NULL) effects = "";
+			if (((instance->effects == NULL) || (strcmp(instance->effects, effects) != 0)) &&
+				((copy = strdup(effects)) != NULL)) {
+				free(instance->effects);
+				instance->effects	= copy;
+				instance->changed	= 1;
+			}
+			break;
+		case 1:
+		case 2:
+		case 3:
+		case 4:
+			instance->window[param_index - 1]	= *(double *)param;
+			break;
+		case 5:
+			instance->mask	= (*(double *)param >= 0.5);
+			break;
+		case 6:
+			instance->statistics	= (*(double *)param >= 0.5);
+			break;
+	}
+}
+
+// Writes the statistics of the last frame into the report,
+// which is only as long as it needs to be.
+static const char * report(f0r_instance_t instance) {
+	size_t size;
+	char *text;
+
+	if (instance->stats == NULL) return "";
+
+	size	= FRELIBA_StatsReport(instance->stats, NULL, 0) + 1;
+	if ((text = realloc(instance->report, size)) == NULL) return "";
+
+	instance->report	= text;
+	FRELIBA_StatsReport(instance->stats, text, size);
+	return text;
+}
+
+void f0r_get_param_value(f0r_instance_t instance, f0r_param_t param, int param_index) {
+	if ((instance != NULL) && (param != NULL)) switch(param_index) {
+		case 0:
+			*(const char **)param = (instance->effects != NULL) ? instance->effects : "";
+			break;
+		case 1:
+		case 2:
+		case 3:
+		case 4:
+			*(double *)param	= instance->window[param_index - 1];
+			break;
+		case 5:
+			*(double *)param	= (double)instance->mask;
+			break;
+		case 6:
+			*(double *)param	= (double)instance->statistics;
+			break;
+		case 7:
+			*(const char **)param	= report(instance);
+			break;
+	}
+}
+
+// Runs count pixels through every stage. The first stage
+// reads the input, all others work on the output of the
+// stage before them.
+static void stages(f0r_instance_t instance, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe, size_t count) {
+	const KOLIBA_RGBA8PIXEL *in;
+	KOLIBA_RGBA8PIXEL *out;
+	const double *iconv;
+	const unsigned char *oconv;
+	stack_stage *stage;
+	unsigned int s;
+	size_t i;
+
+	for (s = 0, stage = instance->stages; s < instance->nstages; s++, stage++, inframe = outframe) {
+		if (stage->fx != NULL) FRELIBA_Apply(stage->fx, inframe, 0, outframe, 0, count, 1);
+		else if (stage->links == 1) FRELIBA_FlutRgba8Frame(&stage->fast, outframe, inframe, count, stage->fChain[0].fLut, stage->fChain[0].flags, stage->srgb);
+		else {
+			if (stage->srgb) {
+				iconv = KOLIBA_SrgbByteToLinear;
+				oconv = KOLIBA_LinearByteToSrgb;
+			}
+			else {
+				iconv = NULL;
+				oconv = NULL;
+			}
+
+			for (i = count, in = inframe, out = outframe; i; i--, in++, out++) {
+				KOLIBA_PolyRgba8Pixel(out, in, stage->fChain, stage->links, iconv, oconv)->a = in->a;
+			}
+		}
+	}
+}
+
+// Runs the stages over a tile at a time, and adds each tile
+// to the statistics before it leaves the cache.
+static void gather(f0r_instance_t instance, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe, size_t count) {
+	const KOLIBA_RGBA8PIXEL *before;
+	size_t n;
+
+	for (; count; count -= n, inframe += n, outframe += n) {
+		n	= (count < FRELIBA_TILEPIXELS) ? count : FRELIBA_TILEPIXELS;
+
+		if (inframe != outframe) before = inframe;
+		else before = memcpy(instance->scratch, inframe, n * sizeof(KOLIBA_RGBA8PIXEL));
+
+		if (instance->nstages == 0) FRELIBA_CopyRgba8Frame(outframe, inframe, n);
+		else stages(instance, inframe, outframe, n);
+
+		FRELIBA_Rgba8Stats(instance->stats, before, outframe, n, FRELIBA_COLOR_MODEL);
+	}
+}
+
+// Does the actual work for f0r_update and freliba_update,
+// count pixels at a time.
+static void update(void *data, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe, size_t count) {
+	f0r_instance_t instance = (f0r_instance_t)data;
+	size_t n;
+
+	if ((instance != NULL) && (inframe != NULL) && (outframe != NULL)) {
+
+		if (instance->changed) {
+			unstack(instance);
+			createeffects(instance);
+			stackeffects(instance);
+			instance->changed	= 0;
+		}
+
+		if (instance->stats != NULL) gather(instance, inframe, outframe, count);
+		else if (instance->nstages == 0) FRELIBA_CopyRgba8Frame(outframe, inframe, count);
+		else if (instance->nstages == 1) stages(instance, inframe, outframe, count);
+
+		// With more than one pass to make, we make all of them
+		// over one tile before moving to the next one, so the
+		// frame only goes through the memory once.
+		else for (; count; count -= n, inframe += n, outframe += n) {
+			n	= (count < FRELIBA_TILEPIXELS) ? count : FRELIBA_TILEPIXELS;
+			stages(instance, inframe, outframe, n);
+		}
+	}
+}
+
+// Turns the window into pixels of a frame of width by height.
+// An empty window is no window at all, but a window that is all
+// outside the frame leaves nothing to process.
+static void window(f0r_instance_t instance, FRELIBA_REGION *region, size_t width, size_t height) {
+	double w[4];
+	unsigned int i;
+
+	for (i = 0; i < 4; i++) w[i] = (instance->window[i] <= 0.0) ? 0.0 : (instance->window[i] >= 1.0) ? 1.0 : instance->window[i];
+
+	region->x		= (size_t)(w[0] * (double)width + 0.5);
+	region->y		= (size_t)(w[1] * (double)height + 0.5);
+	region->width	= (size_t)(w[2] * (double)width + 0.5);
+	region->height	= (size_t)(w[3] * (double)height + 0.5);
+	region->mask	= instance->mask;
+
+	if ((region->width == 0) || (region->height == 0)) region->x = region->y = width + height;
+}
+
+// Every frame starts its statistics anew, if there are to be any.
+// A frame of no pixels, which only prepares the stack, does not.
+static void startstats(f0r_instance_t instance, size_t pixels) {
+	if ((instance->statistics) && (instance->stats == NULL) &&
+		(((instance->stats = calloc(1, sizeof(FRELIBA_STATS))) == NULL) ||
+		((instance->scratch = malloc(FRELIBA_TILEPIXELS * sizeof(KOLIBA_RGBA8PIXEL))) == NULL))) {
+		free(instance->stats);
+		instance->stats	= NULL;
+	}
+	else if ((!instance->statistics) && (instance->stats != NULL)) {
+		free(instance->stats);
+		free(instance->scratch);
+		instance->stats		= NULL;
+		instance->scratch	= NULL;
+	}
+
+	if (pixels) FRELIBA_ClearStats(instance->stats);
+}
+
+static void windowed(f0r_instance_t instance, const KOLIBA_RGBA8PIXEL *inframe, ptrdiff_t instride, KOLIBA_RGBA8PIXEL *outframe, ptrdiff_t outstride, size_t width, size_t height) {
+	FRELIBA_REGION region;
+
+	if (instance != NULL) {
+		startstats(instance, width * height);
+		window(instance, &region, width, height);
+		FRELIBA_RegionRgba8Rows(update, instance, &region, inframe, instride, outframe, outstride, width, height);
+	}
+}
+
+// Tells the effects the time of the frame, for any of them
+// that change from one frame to the next.
+static void settime(f0r_instance_t instance, double time) {
+	unsigned int e;
+
+	for (e = 0; e < instance->neffects; e++) FRELIBA_SetTime(instance->fx[e], time);
+}
+
+void f0r_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe) {
+	if (instance != NULL) {
+		settime(instance, time);
+		windowed(instance, inframe, 0, outframe, 0, instance->width, instance->height);
+	}
+}
+
+void freliba_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, ptrdiff_t instride, KOLIBA_RGBA8PIXEL *outframe, ptrdiff_t outstride, size_t width, size_t height) {
+	if (instance != NULL) settime(instance, time);
+	windowed(instance, inframe, instride, outframe, outstride, width, height);
+}
+
+// The stack is not one of the effects of libfreliba, which
+// already lets its users stack the effects any way they like.
+const FRELIBA_FASTFLUT * freliba_fastflut(f0r_instance_t instance) {
+	return NULL;
+}
@@ -13,6 +13,7 @@
 */
 
 #include	<koliba.h>
+#include	"freliba.h"
 #include	<stdlib.h>
 #include	<string.h>
 #include	<stdint.h>
@@ -66,10 +67,10 @@ typedef	struct _struttedring_instance {
 typedef	void	*f0r_param_t;
 
 void f0r_get_plugin_info(f0r_plugin_info_t* info) {
-	info->name				= "Koliba Strutted Ring";
+	info->name				= "Koliba Strutted Ring" FRELIBA_NAME_SUFFIX;
 	info->author			= "G. Adam Stanislav";
 	info->plugin_type		= F0R_PLUGIN_TYPE_FILTER;
-	info->color_model		= F0R_COLOR_MODEL_RGBA8888;
+	info->color_model		= FRELIBA_COLOR_MODEL;
 	info->frei0r_version	= FREI0R_MAJOR_VERSION;
 	info->major_version		= 1;
 	info->minor_version		= 0;
@@ -238,38 +239,60 @@ void f0r_get_param_value(f0r_instance_t instance, f0r_param_t param, int param_i
 }
 
 
-void f0r_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe) {
+// Does the actual work for f0r_update and freliba_update,
+// count pixels at a time.
+static void update(void *data, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe, size_t count) {
+	f0r_instance_t instance = (f0r_instance_t)data;
+
 	if ((instance != NULL) && (inframe != NULL) && (outframe != NULL)) {
-		size_t i = instance->count;
+		size_t i = count;
 		const double *iconv;
 		const unsigned char *oconv;
 
 		// Changed or not, if the efficacy is 0, just do a quick copy
 		// of all input pixels to corresponding output pixels.
-		if (instance->efficacy == 0.0) memcpy(outframe, inframe, i*sizeof(KOLIBA_RGBA8PIXEL));
+		if (instance->efficacy == 0.0) FRELIBA_CopyRgba8Frame(outframe, inframe, i);
 		else {
 			if (instance->changed) {
 				instance->plut = (instance->secondary) ? (instance->ring <= 1.0/3.0) ? KOLIBA_PlutCyan : (instance->ring <= 2.0/3.0) ? KOLIBA_PlutMagenta : KOLIBA_PlutYellow : (instance->ring <= 1.0/3.0) ? KOLIBA_PlutRed : (instance->ring <= 2.0/3.0) ? KOLIBA_PlutGreen : KOLIBA_PlutBlue;
 				KOLIBA_SlutEfficacy(&instance->sLut, KOLIBA_ApplyStrutRing(&instance->sLut, &instance->vertex, instance->plut, instance->strut), (instance->inverse) ? -instance->efficacy : instance->efficacy);
-				instance->flags = KOLIBA_FlutFlags(KOLIBA_ConvertSlutToFlut(&instance->fLut, &instance->vertices));
+				instance->flags = KOLIBA_FlutFlags(FRELIBA_OrderFlut(KOLIBA_ConvertSlutToFlut(&instance->fLut, &instance->vertices)));
 				KOLIBA_ScaleFlut(&instance->fLut, &instance->fLut, 255.0);
 				instance->changed = 0;
 			}
 
-			if (instance->srgb) {
-				iconv = KOLIBA_SrgbByteToLinear;
-				oconv = KOLIBA_LinearByteToSrgb;
-			}
+			if (FRELIBA_IsNearIdentityScaledFlut(&instance->fLut, instance->srgb))
+				FRELIBA_CopyRgba8Frame(outframe, inframe, i);
 			else {
-				iconv = NULL;
-				oconv = NULL;
-			}
+				if (instance->srgb) {
+					iconv = KOLIBA_SrgbByteToLinear;
+					oconv = KOLIBA_LinearByteToSrgb;
+				}
+				else {
+					iconv = NULL;
+					oconv = NULL;
+				}
 
-			for (; i; i--, inframe++, outframe++) {
-				KOLIBA_ScaledRgba8Pixel(outframe, inframe, &instance->fLut, instance->flags, iconv, oconv)->a = inframe->a;
+				for (; i; i--, inframe++, outframe++) {
+					KOLIBA_ScaledRgba8Pixel(outframe, inframe, &instance->fLut, instance->flags, iconv, oconv)->a = inframe->a;
+				}
 			}
 		}
 	}
 }
 
+void f0r_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe) {
+	if (instance != NULL) update(instance, inframe, outframe, instance->count);
+}
+
+void freliba_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, ptrdiff_t instride, KOLIBA_RGBA8PIXEL *outframe, ptrdiff_t outstride, size_t width, size_t height) {
+	FRELIBA_Rgba8Rows(update, instance, inframe, instride, outframe, outstride, width, height);
+}
+
+// We do not work through a FRELIBA_FASTFLUT, so there is
+// no RGBA64 path for us.
+const FRELIBA_FASTFLUT * freliba_fastflut(f0r_instance_t instance) {
+	return NULL;
+}
+
 
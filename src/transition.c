@@ -0,0 +1,406 @@
+/*
+	transition.c
+
+	Copyright 2021 G. Adam Stanislav.
+	All rights reserved.
+
+	http://www.pantarheon.org
+
+	This is a frei0r-compatible plug-in, making a transition
+	from one grade to another in one pass over each frame,
+	rather than running both grades and blending the results.
+
+	Each grade is a string parameter, listing the effects
+	separated by spaces, each followed by its parameters, the
+	same way koliba_stack takes them. An empty grade leaves
+	the colors as they are, so a transition from or to it
+	fades the other grade in or out.
+
+	How far along the transition is comes either from the
+	Position parameter, or, if Duration is not 0, from the
+	time of the frame: it starts at Start and takes Duration
+	seconds.
+
+	The two grades are always mixed as they are encoded, the
+	same as a crossfade of their outputs would be. When each
+	grade boils down to a single FLUT working on the encoded
+	values, so does any mix of the two, and we interpolate
+	between them with KOLIBA_InterpolateFluts. Otherwise,
+	including when either FLUT works in linear light (sRGB),
+	we apply both grades to a tile of the frame small enough
+	to stay in the cache and mix them there.
+
+	It needs to be linked with libfreliba.a, and dynamically
+	using the -lkoliba switch in Unix and its derivatives,
+	or koliba.lib in Windows.
+*/
+
+#include	<koliba.h>
+#include	"freliba.h"
+#include	"libfreliba.h"
+#include	<stdlib.h>
+#include	<string.h>
+
+/* From frei0r.h, which may or may not be on your system */
+typedef struct f0r_plugin_info
+{
+  const char* name;
+  const char* author;
+  int plugin_type;
+  int color_model;
+  int frei0r_version;
+  int major_version;
+  int minor_version;
+  int num_params;
+  const char* explanation;
+} f0r_plugin_info_t;
+
+typedef struct f0r_param_info
+{
+  const char* name;
+  int type;
+  const char* explanation;
+} f0r_param_info_t;
+
+#define FREI0R_MAJOR_VERSION 1
+#define F0R_PLUGIN_TYPE_FILTER 0
+#define F0R_COLOR_MODEL_RGBA8888 1
+#define	F0R_PARAM_BOOL	0
+#define F0R_PARAM_DOUBLE    1
+#define F0R_PARAM_COLOR     2
+#define F0R_PARAM_POSITION  3
+#define F0R_PARAM_STRING    4
+/* End of frei0r.h extract */
+
+// One of the two grades.
+typedef struct _transition_grade {
+	char				*effects;
+	FRELIBA				**fx;
+	unsigned int		neffects;
+	KOLIBA_FLUT			fLut;		// All of it, if it is one FLUT
+	unsigned char		flut;
+	unsigned char		srgb;
+} transition_grade;
+
+typedef	struct _transition_instance {
+	transition_grade	grade[2];
+	KOLIBA_FLUT			fLut;		// The mix of the two
+	KOLIBA_FLAGS		flags;
+	FRELIBA_FASTFLUT	fast;
+	KOLIBA_RGBA8PIXEL	*tiles;		// Two tiles, when not a FLUT
+	double				position, start, duration;
+	double				mix;		// Where we are now
+	double				mixed;		// And where fLut is
+	unsigned int		width;
+	unsigned int		height;
+	unsigned char		changed;
+} transition_instance, *f0r_instance_t;
+
+typedef	void	*f0r_param_t;
+
+void f0r_get_plugin_info(f0r_plugin_info_t* info) {
+	info->name				= "Koliba Transition" FRELIBA_NAME_SUFFIX;
+	info->author			= "G. Adam Stanislav";
+	info->plugin_type		= F0R_PLUGIN_TYPE_FILTER;
+	info->color_model		= FRELIBA_COLOR_MODEL;
+	info->frei0r_version	= FREI0R_MAJOR_VERSION;
+	info->major_version		= 1;
+	info->minor_version		= 0;
+	info->num_params		= 5;
+	info->explanation		= "Makes a transition from one grade of Koliba effects to another in one pass.";
+}
+
+int f0r_init() {
+	return 1;
+}
+
+void f0r_deinit() {}
+
+static void ungrade(transition_grade *grade) {
+	while (grade->neffects) FRELIBA_Destroy(grade->fx[--grade->neffects]);
+	free(grade->fx);
+	grade->fx	= NULL;
+}
+
+// Creates the effects of a grade. We ignore any effect we do
+// not know and any parameter it does not understand, since
+// there is no way to tell the host about them.
+static void creategrade(transition_grade *grade) {
+	char *copy, *effect, *setting, *savefx, *saveset, *p;
+	unsigned int n = 0;
+
+	if ((grade->effects == NULL) || ((copy = strdup(grade->effects)) == NULL)) return;
+
+	for (p = copy; *p != '\0'; n++) {
+		while (*p == ' ') p++;
+		if (*p == '\0') break;
+		while ((*p != ' ') && (*p != '\0')) p++;
+	}
+
+	if ((n == 0) || ((grade->fx = calloc(n, sizeof(FRELIBA *))) == NULL)) {
+		free(copy);
+		return;
+	}
+
+	for (effect = strtok_r(copy, " ", &savefx); effect != NULL; effect = strtok_r(NULL, " ", &savefx)) {
+		setting	= strtok_r(effect, ":", &saveset);
+		if ((grade->fx[grade->neffects] = FRELIBA_CreateModel(setting, FRELIBA_COLOR_MODEL)) == NULL) continue;
+
+		while ((setting = strtok_r(NULL, ":", &saveset)) != NULL)
+			FRELIBA_ParseParam(grade->fx[grade->neffects], setting);
+
+		grade->neffects++;
+	}
+
+	free(copy);
+}
+
+// Finds out if the grade is a single FLUT. The FLUTs of the
+// effects are already in the order of the pixels of the frame.
+static void flutgrade(transition_grade *grade) {
+	const FRELIBA_FASTFLUT *fast;
+	KOLIBA_FLUT *fLuts;
+	KOLIBA_FFLUT *fChain;
+	unsigned int e, n = 0;
+
+	grade->flut	= 0;
+	grade->srgb	= 0;
+
+	if (grade->neffects == 0) {
+		grade->fLut	= KOLIBA_IdentityFlut;
+		grade->flut	= 1;
+		return;
+	}
+
+	if (((fLuts = calloc(2 * grade->neffects, sizeof(KOLIBA_FLUT))) == NULL) ||
+		((fChain = calloc(2 * grade->neffects, sizeof(KOLIBA_FFLUT))) == NULL)) {
+		free(fLuts);
+		return;
+	}
+
+	for (e = 0; e < grade->neffects; e++) {
+		if ((fast = FRELIBA_EffectFastFlut(grade->fx[e])) == NULL) break;
+		if (fast->kind == FRELIBA_FLUTIDENTITY) continue;
+
+		// The FLUTs must all agree about sRGB to go together.
+		if ((n) && (fast->srgb != grade->srgb)) break;
+
+		grade->srgb			= fast->srgb;
+		fLuts[n]			= fast->fLut;
+		fChain[n].fLut		= fLuts + n;
+		fChain[n].flags		= fast->flags;
+		n++;
+	}
+
+	if (e == grade->neffects) switch (FRELIBA_CollapseFlutChain(fLuts + grade->neffects, fChain + grade->neffects, fChain, n, grade->srgb)) {
+		case 0:
+			grade->fLut	= KOLIBA_IdentityFlut;
+			grade->flut	= 1;
+			break;
+		case 1:
+			grade->fLut	= *fChain[grade->neffects].fLut;
+			grade->flut	= 1;
+			break;
+	}
+
+	free(fLuts);
+	free(fChain);
+}
+
+f0r_instance_t f0r_construct(unsigned int width, unsigned int height) {
+	f0r_instance_t	instance;
+
+	if ((instance = calloc(sizeof(transition_instance),1)) != NULL) {
+		instance->width			= width;
+		instance->height		= height;
+		instance->mixed			= -1.0;
+		instance->changed		= 1;
+		FRELIBA_InitFastFlutModel(&instance->fast, FRELIBA_MODEL_RGBA8888);
+	}
+	return instance;
+}
+
+void f0r_destruct(f0r_instance_t instance) {
+	if (instance != NULL) {
+		ungrade(instance->grade);
+		ungrade(instance->grade + 1);
+		free(instance->grade[0].effects);
+		free(instance->grade[1].effects);
+		free(instance->tiles);
+		free(instance);
+	}
+}
+
+void f0r_get_param_info(f0r_param_info_t* info, int param_index) {
+	switch (param_index) {
+		case 0:
+			info->name			= "From";
+			info->type			= F0R_PARAM_STRING;
+			info->explanation	= "The grade to start with: effects separated by spaces, each followed by its parameters, e.g., saturation:Saturation=0.8.";
+			break;
+		case 1:
+			info->name			= "To";
+			info->type			= F0R_PARAM_STRING;
+			info->explanation	= "The grade to end with.";
+			break;
+		case 2:
+			info->name			= "Position";
+			info->type			= F0R_PARAM_DOUBLE;
+			info->explanation	= "How far along the transition is (0-1), unless Duration says otherwise.";
+			break;
+		case 3:
+			info->name			= "Start";
+			info->type			= F0R_PARAM_DOUBLE;
+			info->explanation	= "When the transition starts (in seconds).";
+			break;
+		case 4:
+			info->name			= "Duration";
+			info->type			= F0R_PARAM_DOUBLE;
+			info->explanation	= "How long the transition takes (in seconds), or 0 to use Position.";
+			break;
+	}
+}
+
+void f0r_set_param_value(f0r_instance_t instance, f0r_param_t param, int param_index) {
+	transition_grade *grade;
+	const char *effects;
+	char *copy;
+
+	if ((instance != NULL) && (param != NULL)) switch (param_index) {
+		case 0:
+		case 1:
+			grade	= instance->grade + param_index;
+			if ((effects = *(const char **)param) == NULL) effects = "";
+			if (((grade->effects == NULL) || (strcmp(grade->effects, effects) != 0)) &&
+				((copy = strdup(effects)) != NULL)) {
+				free(grade->effects);
+				grade->effects		= copy;
+				instance->changed	= 1;
+			}
+			break;
+		case 2:
+			instance->position	= *(double *)param;
+			break;
+		case 3:
+			instance->start		= *(double *)param;
+			break;
+		case 4:
+			instance->duration	= *(double *)param;
+			break;
+	}
+}
+
+void f0r_get_param_value(f0r_instance_t instance, f0r_param_t param, int param_index) {
+	if ((instance != NULL) && (param != NULL)) switch(param_index) {
+		case 0:
+		case 1:
+			*(const char **)param = (instance->grade[param_index].effects != NULL) ? instance->grade[param_index].effects : "";
+			break;
+		case 2:
+			*(double *)param	= instance->position;
+			break;
+		case 3:
+			*(double *)param	= instance->start;
+			break;
+		case 4:
+			*(double *)param	= instance->duration;
+			break;
+	}
+}
+
+// Mixes count pixels of two tiles into outframe.
+static void mixtiles(KOLIBA_RGBA8PIXEL *outframe, const KOLIBA_RGBA8PIXEL *from, const KOLIBA_RGBA8PIXEL *to, size_t count, double mix) {
+	const unsigned int b = (unsigned int)(mix * 256.0 + 0.5), a = 256 - b;
+
+	for (; count; count--, outframe++, from++, to++) {
+		outframe->r	= (unsigned char)((from->r * a + to->r * b + 128) >> 8);
+		outframe->g	= (unsigned char)((from->g * a + to->g * b + 128) >> 8);
+		outframe->b	= (unsigned char)((from->b * a + to->b * b + 128) >> 8);
+		outframe->a	= from->a;
+	}
+}
+
+// Returns non-zero if the grade is a single FLUT of the encoded
+// values. The identity is one either way.
+static int encodedflut(const transition_grade *grade) {
+	return (grade->flut) && ((!grade->srgb) || (KOLIBA_IsIdentityFlut(&grade->fLut)));
+}
+
+// Does the actual work for f0r_update and freliba_update,
+// count pixels at a time.
+static void update(void *data, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe, size_t count) {
+	f0r_instance_t instance = (f0r_instance_t)data;
+	transition_grade *grade;
+	size_t n;
+	unsigned int g;
+
+	if ((instance != NULL) && (inframe != NULL) && (outframe != NULL)) {
+
+		if (instance->changed) {
+			for (g = 0; g < 2; g++) {
+				grade	= instance->grade + g;
+				ungrade(grade);
+				creategrade(grade);
+				flutgrade(grade);
+			}
+			instance->mixed		= -1.0;
+			instance->changed	= 0;
+		}
+
+		// Both are FLUTs, and so is their mix, which is the same
+		// as mixing their outputs as long as neither FLUT works
+		// in linear light.
+		if ((encodedflut(instance->grade)) && (encodedflut(instance->grade + 1))) {
+			if (instance->mixed != instance->mix) {
+				KOLIBA_InterpolateFluts(&instance->fLut, &instance->grade[0].fLut, instance->mix, &instance->grade[1].fLut);
+				instance->flags	= KOLIBA_FlutFlags(&instance->fLut);
+				instance->mixed	= instance->mix;
+			}
+			FRELIBA_FlutRgba8Frame(&instance->fast, outframe, inframe, count, &instance->fLut, instance->flags, 0);
+		}
+
+		else if (instance->mix <= 0.0) FRELIBA_ApplyChain(instance->grade[0].fx, instance->grade[0].neffects, inframe, 0, outframe, 0, count, 1);
+		else if (instance->mix >= 1.0) FRELIBA_ApplyChain(instance->grade[1].fx, instance->grade[1].neffects, inframe, 0, outframe, 0, count, 1);
+
+		else if ((instance->tiles != NULL) || ((instance->tiles = malloc(2 * FRELIBA_TILEPIXELS * sizeof(KOLIBA_RGBA8PIXEL))) != NULL)) {
+			for (; count; count -= n, inframe += n, outframe += n) {
+				n	= (count < FRELIBA_TILEPIXELS) ? count : FRELIBA_TILEPIXELS;
+				FRELIBA_ApplyChain(instance->grade[0].fx, instance->grade[0].neffects, inframe, 0, instance->tiles, 0, n, 1);
+				FRELIBA_ApplyChain(instance->grade[1].fx, instance->grade[1].neffects, inframe, 0, instance->tiles + FRELIBA_TILEPIXELS, 0, n, 1);
+				mixtiles(outframe, instance->tiles, instance->tiles + FRELIBA_TILEPIXELS, n, instance->mix);
+			}
+		}
+
+		else FRELIBA_CopyRgba8Frame(outframe, inframe, count);
+	}
+}
+
+// Where the transition is at the time of the frame. The effects
+// of both grades are told the time, too, for any of them that
+// change from one frame to the next.
+static void position(f0r_instance_t instance, double time) {
+	double mix = (instance->duration > 0.0) ? (time - instance->start) / instance->duration : instance->position;
+	unsigned int g, e;
+
+	instance->mix	= (mix <= 0.0) ? 0.0 : (mix >= 1.0) ? 1.0 : mix;
+
+	for (g = 0; g < 2; g++) for (e = 0; e < instance->grade[g].neffects; e++) FRELIBA_SetTime(instance->grade[g].fx[e], time);
+}
+
+void f0r_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe) {
+	if (instance != NULL) {
+		position(instance, time);
+		update(instance, inframe, outframe, (size_t)instance->width * (size_t)instance->height);
+	}
+}
+
+void freliba_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, ptrdiff_t instride, KOLIBA_RGBA8PIXEL *outframe, ptrdiff_t outstride, size_t width, size_t height) {
+	if (instance != NULL) position(instance, time);
+	FRELIBA_Rgba8Rows(update, instance, inframe, instride, outframe, outstride, width, height);
+}
+
+// Like the stack, the transition is built on top of libfreliba,
+// not a part of it.
+const FRELIBA_FASTFLUT * freliba_fastflut(f0r_instance_t instance) {
+	return NULL;
+}
@@ -15,6 +15,7 @@
 */
 
 #include	<koliba.h>
+#include	"freliba.h"
 #include	<stdlib.h>
 #include	<stdint.h>
 
@@ -52,10 +53,12 @@ typedef	struct _vcchain_instance {
 	KOLIBA_SLUT		sLut;
 	KOLIBA_VERTICES	vert;
 	KOLIBA_FLUT		fLut[2];
+	KOLIBA_FLUT		iLut;		// iLut in the order we work in
 	KOLIBA_FFLUT	fChain[3];
 	double			con[2];
 	double			efficacy;
 	size_t			count;
+	FRELIBA_FASTFLUT	fast;
 	unsigned char	srgb;
 	unsigned char	matricize;
 	unsigned char	changed;
@@ -75,10 +78,10 @@ static const uint64_t iLut[8][3] = {
 };
 
 void f0r_get_plugin_info(f0r_plugin_info_t* info) {
-	info->name				= "Koliba VC Qube";
+	info->name				= "Koliba VC Qube" FRELIBA_NAME_SUFFIX;
 	info->author			= "G. Adam Stanislav";
 	info->plugin_type		= F0R_PLUGIN_TYPE_FILTER;
-	info->color_model		= F0R_COLOR_MODEL_RGBA8888;
+	info->color_model		= FRELIBA_COLOR_MODEL;
 	info->frei0r_version	= FREI0R_MAJOR_VERSION;
 	info->major_version		= 1;
 	info->minor_version		= 0;
@@ -100,7 +103,10 @@ f0r_instance_t f0r_construct(unsigned int width, unsigned int height) {
 		KOLIBA_InitializeMallet(instance->mallet+1, KOLIBA_SLUTSECONDARY);
 
 		instance->count					= (size_t)width * (size_t)height;
-		instance->fChain[0].fLut		= (KOLIBA_FLUT *)iLut;
+		// Our FLUTs are already in the order of the frame.
+		FRELIBA_InitFastFlutModel(&instance->fast, FRELIBA_MODEL_RGBA8888);
+		instance->iLut					= *(KOLIBA_FLUT *)iLut;
+		instance->fChain[0].fLut		= FRELIBA_OrderFlut(&instance->iLut);
 		instance->fChain[0].flags		= KOLIBA_AllFlutFlags;
 		instance->mallet[0].center.r	= 0.186529;
 		instance->mallet[0].center.g	= 0.135684;
@@ -215,16 +221,23 @@ void f0r_get_param_value(f0r_instance_t instance, f0r_param_t param, int param_i
 	}
 }
 
-void f0r_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe) {
+// Does the actual work for f0r_update and freliba_update,
+// count pixels at a time.
+static void update(void *data, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe, size_t count) {
+	f0r_instance_t instance = (f0r_instance_t)data;
+
 	if ((instance != NULL) && (inframe != NULL) && (outframe != NULL)) {
 		size_t i;
 		const double *iconv;
 		const unsigned char *oconv;
+		KOLIBA_FFLUT fChain[3];
+		KOLIBA_FLUT fLuts[3];
+		unsigned int links;
 
 		if (instance->changed) {
 			KOLIBA_ConvertMalletsToSlut(&instance->sLut, NULL, instance->mallet, NULL, 2);
-			KOLIBA_FlutEfficacy(&(instance->fLut[0]), (KOLIBA_FLUT *)&iLut, instance->efficacy);
-			KOLIBA_ConvertSlutToFlut(&(instance->fLut[1]), &instance->vert);
+			FRELIBA_OrderFlut(KOLIBA_FlutEfficacy(&(instance->fLut[0]), (KOLIBA_FLUT *)&iLut, instance->efficacy));
+			FRELIBA_OrderFlut(KOLIBA_ConvertSlutToFlut(&(instance->fLut[1]), &instance->vert));
 			KOLIBA_Flutter(&(instance->fLut[0]), &(instance->fLut[1]), &(instance->fLut[0]));
 			instance->fChain[1].fLut = &(instance->fLut[1]);
 			instance->fChain[2].fLut = &instance->fLut[0];
@@ -241,17 +254,42 @@ void f0r_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *i
 			instance->changed	= 0;
 		}
 
-		if (instance->srgb) {
-			iconv = KOLIBA_SrgbByteToLinear;
-			oconv = KOLIBA_LinearByteToSrgb;
-		}
+		// Leave out any link of the chain that does nothing
+		// at its current settings, and fold together the links
+		// that add up to a single FLUT (e.g., at an efficacy
+		// that leaves nothing but a matrix).
+		links = FRELIBA_CollapseFlutChain(fLuts, fChain, instance->fChain, 3, instance->srgb);
+
+		if (links == 0) FRELIBA_CopyRgba8Frame(outframe, inframe, count);
+		else if (links == 1) FRELIBA_FlutRgba8Frame(&instance->fast, outframe, inframe, count, fChain[0].fLut, fChain[0].flags, instance->srgb);
 		else {
-			iconv = NULL;
-			oconv = NULL;
-		}
+			if (instance->srgb) {
+				iconv = KOLIBA_SrgbByteToLinear;
+				oconv = KOLIBA_LinearByteToSrgb;
+			}
+			else {
+				iconv = NULL;
+				oconv = NULL;
+			}
 
-		for (i = instance->count; i; i--, inframe++, outframe++) {
-			KOLIBA_PolyRgba8Pixel(outframe, inframe, instance->fChain, 3, iconv, oconv)->a = inframe->a;
+			for (i = count; i; i--, inframe++, outframe++) {
+				KOLIBA_PolyRgba8Pixel(outframe, inframe, fChain, links, iconv, oconv)->a = inframe->a;
+			}
 		}
 	}
 }
+
+void f0r_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, KOLIBA_RGBA8PIXEL *outframe) {
+	if (instance != NULL) update(instance, inframe, outframe, instance->count);
+}
+
+void freliba_update(f0r_instance_t instance, double time, const KOLIBA_RGBA8PIXEL *inframe, ptrdiff_t instride, KOLIBA_RGBA8PIXEL *outframe, ptrdiff_t outstride, size_t width, size_t height) {
+	FRELIBA_Rgba8Rows(update, instance, inframe, instride, outframe, outstride, width, height);
+}
+
+// Our FRELIBA_FASTFLUT only covers the settings at which the
+// chain folds into a single FLUT, so there is no RGBA64 path
+// for us.
+const FRELIBA_FASTFLUT * freliba_fastflut(f0r_instance_t instance) {
+	return NULL;
+}